@@ -1,10 +1,9 @@
 #ifndef RESETTABLE_TIMER_H
 #define RESETTABLE_TIMER_H
 
+#include "TimerService.h"
+
 #include <functional>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <chrono>
 
 class ResettableTimer {
@@ -22,23 +21,14 @@ public:
     ~ResettableTimer();
 
     /**
-     * @brief Resets or disarms the timer.
+     * @brief Resets or disarms the timer (a single relaxed store, safe to call per frame).
      */
-    void reset();
+    inline void reset() {
+        TimerService::reset(timer);
+    }
 
 private:
-    std::chrono::seconds timeout;
-    std::function<void()> callback;
-    std::thread timerThread;
-    std::mutex mutex;
-    std::condition_variable cv;
-    bool running;
-    bool resetFlag = false;
-
-    /**
-     * @brief Main loop for the timer thread.
-     */
-    void timerLoop();
+    TimerService::Timer* timer;
 };
 
 #endif // RESETTABLE_TIMER_H
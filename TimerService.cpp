@@ -0,0 +1,158 @@
+#include "TimerService.h"
+
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+TimerService& TimerService::instance() {
+    static TimerService service;
+    return service;
+}
+
+TimerService::TimerService()
+: timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), running(true), firing(nullptr), armedDeadline(Disarmed) {
+    serviceThread = std::thread(&TimerService::serviceLoop, this);
+}
+
+TimerService::~TimerService() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false; // Stop the service
+    }
+    uint64_t value = 1;
+    ssize_t written = write(wakeFd, &value, sizeof(value));
+    (void)written;
+    if (serviceThread.joinable()) {
+        serviceThread.join(); // Ensure thread completes before destruction
+    }
+    close(timerFd);
+    close(wakeFd);
+}
+
+TimerService::Timer* TimerService::add(std::chrono::nanoseconds timeout, std::function<void()> callback) {
+    Timer* timer = new Timer();
+    timer->timeout = timeout.count();
+    timer->deadline.store(now() + timer->timeout, std::memory_order_relaxed);
+    timer->callback = std::move(callback);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.push_back(timer);
+    arm();
+    return timer;
+}
+
+TimerService::Timer* TimerService::add(std::function<void()> callback) {
+    Timer* timer = new Timer();
+    timer->timeout = 0;
+    timer->deadline.store(Disarmed, std::memory_order_relaxed);
+    timer->callback = std::move(callback);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.push_back(timer);
+    return timer;
+}
+
+void TimerService::schedule(Timer* timer, std::chrono::nanoseconds delay) {
+    int64_t deadline = now() + delay.count();
+    timer->deadline.store(deadline, std::memory_order_seq_cst);
+
+    // The service thread would sleep past the deadline, wake it up to re-arm
+    if (deadline < armedDeadline.load(std::memory_order_seq_cst)) {
+        uint64_t value = 1;
+        ssize_t written = write(wakeFd, &value, sizeof(value));
+        (void)written;
+    }
+}
+
+void TimerService::remove(Timer* timer) {
+    std::unique_lock<std::mutex> lock(mutex);
+    timers.erase(std::find(timers.begin(), timers.end(), timer));
+
+    // Wait for a running callback unless we're being called from it
+    if (std::this_thread::get_id() != serviceThread.get_id()) {
+        cv.wait(lock, [this, timer]() { return firing != timer; });
+    }
+    lock.unlock();
+
+    delete timer;
+}
+
+void TimerService::arm() {
+    // Find the earliest deadline we know of
+    auto earliestDeadline = [this]() {
+        int64_t earliest = Disarmed;
+        for (Timer* timer : timers) {
+            earliest = std::min(earliest, timer->deadline.load(std::memory_order_seq_cst));
+        }
+        return earliest;
+    };
+    int64_t earliest = earliestDeadline();
+
+    // Tell schedule() when we'll wake up, then look again (a timer scheduled meanwhile might have seen an older wake-up and not woken us)
+    armedDeadline.store(earliest, std::memory_order_seq_cst);
+    for (int64_t again = earliestDeadline(); again < earliest; again = earliestDeadline()) {
+        earliest = again;
+        armedDeadline.store(earliest, std::memory_order_seq_cst);
+    }
+
+    // Wake up at that deadline (or never)
+    struct itimerspec spec = {};
+    if (earliest != Disarmed) {
+        spec.it_value.tv_sec = earliest / 1000000000;
+        spec.it_value.tv_nsec = earliest % 1000000000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1; // Zero would disarm the timer
+        }
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void TimerService::serviceLoop() {
+    struct pollfd fds[2] = { { timerFd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        // Wait for the earliest deadline or the shutdown signal
+        lock.unlock();
+        poll(fds, 2, -1);
+        uint64_t expirations;
+        ssize_t consumed = read(timerFd, &expirations, sizeof(expirations));
+        consumed = read(wakeFd, &expirations, sizeof(expirations));
+        (void)consumed;
+        lock.lock();
+
+        // Fire every timer whose deadline has really passed (reset timers just get re-armed)
+        int64_t current = now();
+        for (size_t i = 0; running && i < timers.size(); i++) {
+            Timer* timer = timers[i];
+            int64_t deadline = timer->deadline.load(std::memory_order_relaxed);
+            if (deadline > current) {
+                continue;
+            }
+
+            // The next expiration is a full timeout away (one-shot timers wait to be scheduled again, unless that just happened)
+            if (!timer->deadline.compare_exchange_strong(deadline, timer->timeout > 0 ? current + timer->timeout : Disarmed, std::memory_order_relaxed)) {
+                continue;
+            }
+
+            // Timeout occurred, invoke callback
+            firing = timer;
+            lock.unlock();
+            if (timer->callback) {
+                timer->callback();
+            }
+            lock.lock();
+            firing = nullptr;
+            cv.notify_all();
+
+            // The callback might have removed timers, start over
+            i = (size_t)-1;
+            current = now();
+        }
+
+        // Sleep until the next deadline
+        arm();
+    }
+}
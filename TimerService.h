@@ -0,0 +1,121 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Hosts all watchdog timers of the process on a single thread and timerfd.
+ *
+ * Resetting a timer is a single relaxed store of its new deadline. The service
+ * thread only wakes up when a deadline it last saw is due, and lazily re-arms
+ * timers that were pushed back in the meantime.
+ */
+class TimerService {
+public:
+    /**
+     * @brief A registered timer.
+     */
+    struct Timer {
+        std::atomic<int64_t> deadline;  // Monotonic nanoseconds (Disarmed while a one-shot timer isn't scheduled)
+        int64_t timeout;                // Nanoseconds (0 for one-shot timers)
+        std::function<void()> callback;
+    };
+
+    /**
+     * @brief Returns the process-wide timer service.
+     */
+    static TimerService& instance();
+
+    /**
+     * @brief Registers a timer that calls back every timeout until it's reset.
+     * @param timeout Timeout duration.
+     * @param callback Function to call when the timer expires.
+     * @return The timer handle.
+     */
+    Timer* add(std::chrono::nanoseconds timeout, std::function<void()> callback);
+
+    /**
+     * @brief Registers a one-shot timer that only calls back once it's been scheduled.
+     * @param callback Function to call when the timer expires.
+     * @return The timer handle.
+     */
+    Timer* add(std::function<void()> callback);
+
+    /**
+     * @brief Unregisters a timer, waiting for its callback if it's currently running.
+     * @param timer The timer handle.
+     */
+    void remove(Timer* timer);
+
+    /**
+     * @brief Pushes the timer's deadline back by a full timeout.
+     * @param timer The timer handle.
+     */
+    static inline void reset(Timer* timer) {
+        timer->deadline.store(now() + timer->timeout, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Makes a one-shot timer call back after the given delay (only wakes the service thread if it would sleep past it).
+     * @param timer The timer handle.
+     * @param delay Time until the callback.
+     */
+    void schedule(Timer* timer, std::chrono::nanoseconds delay);
+
+    /**
+     * @brief Keeps a one-shot timer from calling back until it's scheduled again (a single relaxed store).
+     * @param timer The timer handle.
+     */
+    static inline void disarm(Timer* timer) {
+        timer->deadline.store(Disarmed, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the monotonic clock in nanoseconds.
+     */
+    static inline int64_t now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    /**
+     * @brief Destructor to stop the service thread.
+     */
+    ~TimerService();
+
+private:
+    TimerService();
+
+    static constexpr int64_t Disarmed = INT64_MAX;
+
+    int timerFd;
+    int wakeFd;
+    bool running;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Timer*> timers;
+    Timer* firing;
+    std::atomic<int64_t> armedDeadline;
+    std::thread serviceThread;
+
+    /**
+     * @brief Arms the timerfd for the earliest deadline (mutex must be held).
+     */
+    void arm();
+
+    /**
+     * @brief Main loop for the service thread.
+     */
+    void serviceLoop();
+};
+
+#endif // TIMER_SERVICE_H
@@ -0,0 +1,49 @@
+#ifndef ADDRESS_H
+#define ADDRESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Packs a "AA:BB:CC:DD:EE:FF" MAC address into a 48-bit integer, returns 0 if the address is malformed
+static inline uint64_t packAddress(const char* address)
+{
+    uint64_t packed = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        uint64_t octet = 0;
+        for (int j = 0; j < 2; j++)
+        {
+            char c = *address++;
+            int nibble = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (nibble < 0)
+            {
+                return 0;
+            }
+            octet = (octet << 4) | (uint64_t)nibble;
+        }
+        packed = (packed << 8) | octet;
+        if (*address != (i < 5 ? ':' : '\0'))
+        {
+            return 0;
+        }
+        address++;
+    }
+    return packed;
+}
+
+// Packs a MAC address string into a 48-bit integer, returns 0 if the address is malformed
+static inline uint64_t packAddress(const std::string& address)
+{
+    return packAddress(address.c_str());
+}
+
+// Formats a packed MAC address as "AA:BB:CC:DD:EE:FF"
+static inline std::string unpackAddress(uint64_t packed)
+{
+    char address[18];
+    snprintf(address, sizeof(address), "%02X:%02X:%02X:%02X:%02X:%02X", (unsigned)(packed >> 40) & 0xff, (unsigned)(packed >> 32) & 0xff, (unsigned)(packed >> 24) & 0xff, (unsigned)(packed >> 16) & 0xff, (unsigned)(packed >> 8) & 0xff, (unsigned)packed & 0xff);
+    return address;
+}
+
+#endif // ADDRESS_H
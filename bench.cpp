@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "guitar.h"
+#include "profile.h"
+#include "reactor.h"
+#include "simtransport.h"
+#include "spscring.h"
+
+// The number of heap allocations so far
+static std::atomic<uint64_t> g_allocations(0);
+
+// Counts every heap allocation of the process
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* pointer = malloc(size != 0 ? size : 1);
+    if (pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+// Pairs with the counting operator new
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+// Pairs with the counting operator new
+void operator delete(void* pointer, size_t /*size*/) noexcept
+{
+    free(pointer);
+}
+
+// The measurements of a single benchmark
+typedef struct BenchResult {
+    std::string name;         // The benchmark name
+    double nanoseconds;       // The time per frame
+    double allocations;       // The heap allocations per frame
+    double syscalls;          // The write syscalls per frame (negative if the kernel doesn't count them)
+    double reports;           // The input reports emitted per frame
+} BenchResult;
+
+// The measurements of an engine driving simulated guitars
+typedef struct EngineResult {
+    std::string name;         // The engine and the number of guitars
+    double threads;           // The threads of the process (including the simulator's)
+    double simulatorThreads;  // The threads the simulator runs on its own (one notification thread per link)
+    double contextSwitches;   // The context switches per second
+    double p99;               // The worst guitar's 99th percentile of frame arrival -> uinput write done in nanoseconds
+    double frames;            // The frames handled per second
+} EngineResult;
+
+// The resting state of a guitar
+static GuitarData rest_frame()
+{
+    GuitarData frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.directionalPad = Direction_Centered;
+    frame.unused1 = 0x80;
+    frame.strum = 0x80;
+    frame.lift = 0x80;
+    frame.whammy = 0x80;
+    frame.tilt = 0x80;
+    return frame;
+}
+
+// Nothing changes
+static std::vector<GuitarData> idle_frames()
+{
+    return std::vector<GuitarData>(256, rest_frame());
+}
+
+// A single fret is pressed and released
+static std::vector<GuitarData> single_fret_frames()
+{
+    std::vector<GuitarData> frames(256, rest_frame());
+    for (size_t i = 0; i < frames.size(); i += 2)
+    {
+        frames[i].frets = Fret_W1;
+    }
+    return frames;
+}
+
+// All frets are pressed and strummed, then released
+static std::vector<GuitarData> chord_frames()
+{
+    std::vector<GuitarData> frames(256, rest_frame());
+    for (size_t i = 0; i < frames.size(); i += 2)
+    {
+        frames[i].frets = Fret_W1 | Fret_W2 | Fret_W3 | Fret_B1 | Fret_B2 | Fret_B3;
+        frames[i].strum = (i / 2) % 2 == 0 ? 0xff : 0x00;
+    }
+    return frames;
+}
+
+// The whammy bar and tilt sensor jitter around their resting positions
+static std::vector<GuitarData> analog_noise_frames()
+{
+    std::vector<GuitarData> frames(256, rest_frame());
+    uint32_t random = 0x9e3779b9;
+    for (GuitarData& frame : frames)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        frame.whammy = (uint8_t)(0x80 + random % 3);
+        frame.tilt = (uint8_t)(0x7f + (random >> 8) % 3);
+    }
+    return frames;
+}
+
+// The whammy bar is pushed all the way down and let go again
+static std::vector<GuitarData> whammy_sweep_frames()
+{
+    std::vector<GuitarData> frames(256, rest_frame());
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        frames[i].whammy = (uint8_t)(i < 128 ? 0x80 + i : 0x80 + (255 - i));
+    }
+    return frames;
+}
+
+// Returns the number of write syscalls the process made so far (-1 if the kernel doesn't count them)
+static int64_t write_syscalls()
+{
+    // The kernel's per-process I/O accounting
+    FILE* file = fopen("/proc/self/io", "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    char line[128];
+    long long count = -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (sscanf(line, "syscw: %lld", &count) == 1)
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+// Runs a benchmark for the given number of frames (after a tenth of them as a warm-up)
+static BenchResult measure(const std::string& name, size_t frames, const std::function<void(size_t)>& frame, const std::function<uint64_t()>& reports)
+{
+    // Warm up (creates lazily allocated state like the gamepad)
+    for (size_t i = 0; i < frames / 10; i++)
+    {
+        frame(i);
+    }
+
+    // Measure
+    uint64_t reportsBefore = reports();
+    int64_t syscallsBefore = write_syscalls();
+    uint64_t allocationsBefore = g_allocations.load();
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++)
+    {
+        frame(i);
+    }
+    std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+    uint64_t allocationsAfter = g_allocations.load();
+    int64_t syscallsAfter = write_syscalls();
+    uint64_t reportsAfter = reports();
+
+    // Work out the per-frame numbers
+    BenchResult result;
+    result.name = name;
+    result.nanoseconds = std::chrono::duration<double, std::nano>(finished - started).count() / frames;
+    result.allocations = (double)(allocationsAfter - allocationsBefore) / frames;
+    result.syscalls = syscallsBefore >= 0 && syscallsAfter >= 0 ? (double)(syscallsAfter - syscallsBefore) / frames : -1;
+    result.reports = (double)(reportsAfter - reportsBefore) / frames;
+    return result;
+}
+
+// Measures Guitar::update (through an offline guitar feeding a null sink)
+static BenchResult bench_guitar(const std::string& mix, const std::vector<GuitarData>& data, size_t frames)
+{
+    Gamepad::setSink(Sink_Capture);
+    Guitar guitar("5E:00:00:00:BE:01");
+    return measure("guitar_update/" + mix, frames, [&](size_t i) {
+        guitar.replay(data[i % data.size()], LatencyStats::now());
+    }, [&]() {
+        return guitar.getLatency().get(Latency_Total).count();
+    });
+}
+
+// Measures emitting a four event frame (a chord being fretted) as one report or as a report per event
+static BenchResult bench_gamepad(const std::string& sinkName, GamepadSinks sink, bool batched, size_t frames, bool* available)
+{
+    // Create the gamepad
+    Gamepad::setSink(sink);
+    Gamepad gamepad("Guitar (bench)");
+
+    // The events of the frame
+    static const uint16_t codes[] = { BTN_XINPUT_B, BTN_XINPUT_X, BTN_XINPUT_Y, BTN_XINPUT_L1 };
+    uint64_t reports = 0;
+    bool failed = false;
+    BenchResult result = measure(std::string(batched ? "gamepad_frame/" : "gamepad_per_event/") + sinkName, frames, [&](size_t i) {
+        int32_t value = i % 2 == 0 ? BTN_PRESSED : BTN_RELEASED;
+
+        // Everything in one report
+        if (batched)
+        {
+            gamepad.beginFrame();
+            for (uint16_t code : codes)
+            {
+                gamepad.append(EV_KEY, code, value);
+            }
+            failed = !gamepad.commit() || failed;
+            reports++;
+        }
+
+        // A report per event
+        else
+        {
+            for (uint16_t code : codes)
+            {
+                struct input_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.type = EV_KEY;
+                ev.code = code;
+                ev.value = value;
+                failed = !gamepad.update(&ev) || failed;
+                reports++;
+            }
+        }
+    }, [&]() {
+        return reports;
+    });
+
+    // The sink wouldn't take the events (e.g. because uinput isn't accessible)
+    *available = !failed;
+    return result;
+}
+
+// Measures handing frames from a producer thread to a consumer thread through the guitar's frame ring
+static BenchResult bench_ring(size_t frames)
+{
+    // The consumer drains the ring until the producer is done
+    SpscRing<QueuedFrame, GUITAR_RING_CAPACITY> ring;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> popped(0);
+    std::thread consumer([&]() {
+        QueuedFrame frame;
+        while (!done.load(std::memory_order_relaxed))
+        {
+            while (ring.pop(&frame))
+            {
+                popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    // The producer pushes a frame, letting the consumer run while the ring is full
+    QueuedFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    BenchResult result = measure("spsc_ring", frames, [&](size_t i) {
+        frame.arrival = (int64_t)i;
+        while (!ring.push(frame))
+        {
+            std::this_thread::yield();
+        }
+    }, [&]() {
+        return popped.load(std::memory_order_relaxed);
+    });
+    done = true;
+    consumer.join();
+    return result;
+}
+
+// Returns the number of threads of the process
+static size_t thread_count()
+{
+    size_t count = 0;
+    DIR* directory = opendir("/proc/self/task");
+    if (directory != NULL)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL)
+        {
+            count += entry->d_name[0] != '.' ? 1 : 0;
+        }
+        closedir(directory);
+    }
+    return count;
+}
+
+// Returns the number of context switches of all threads of the process so far
+static uint64_t context_switches()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+// Measures an engine driving simulated guitars at 125 Hz for the given number of seconds (after a second to connect)
+static EngineResult bench_engine(const std::string& engine, size_t guitarCount, int seconds)
+{
+    // The simulated guitars and, for the reactor engine, the event loop
+    Gamepad::setSink(Sink_Capture);
+    SimTransport transport;
+    transport.configure("guitars=" + std::to_string(guitarCount) + ",rate=125");
+    transport.open();
+    bool reactorEngine = engine == "reactor";
+    GuitarInputModes inputMode = engine == "threads" ? InputMode_Poll : InputMode_Notify;
+    Reactor reactor;
+    if (reactorEngine)
+    {
+        reactor.start();
+    }
+
+    // Connect the guitars
+    EngineResult result;
+    {
+        std::vector<std::unique_ptr<Guitar>> guitars;
+        for (size_t i = 0; i < guitarCount; i++)
+        {
+            guitars.push_back(std::make_unique<Guitar>(&transport, SimTransport::guitarAddress((uint32_t)i), inputMode, reactorEngine ? &reactor : NULL));
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        // Measure
+        uint64_t framesBefore = 0;
+        for (const auto& guitar : guitars)
+        {
+            framesBefore += guitar->getLatency().get(Latency_Interval).count();
+        }
+        uint64_t switchesBefore = context_switches();
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        size_t threads = 0;
+        for (int i = 0; i < seconds * 10; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            threads = std::max(threads, thread_count());
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        uint64_t switchesAfter = context_switches();
+        uint64_t framesAfter = 0;
+        uint64_t p99 = 0;
+        for (const auto& guitar : guitars)
+        {
+            framesAfter += guitar->getLatency().get(Latency_Interval).count();
+            p99 = std::max(p99, guitar->getLatency().get(Latency_Total).percentile(99));
+        }
+
+        // Work out the per-second numbers (the benchmark's own thread sleeps, so it barely adds any switches)
+        result.name = engine + "/" + std::to_string(guitarCount);
+        result.threads = (double)threads;
+        result.simulatorThreads = inputMode == InputMode_Notify ? (double)guitarCount : 0;
+        result.contextSwitches = (switchesAfter - switchesBefore) / elapsed;
+        result.p99 = (double)p99;
+        result.frames = (framesAfter - framesBefore) / elapsed;
+    }
+
+    // Shut down
+    transport.close();
+    reactor.stop();
+    return result;
+}
+
+// Prints a number or null
+static void print_number(FILE* output, double value)
+{
+    if (value < 0)
+    {
+        fprintf(output, "null");
+    }
+    else
+    {
+        fprintf(output, "%.3f", value);
+    }
+}
+
+// Prints the usage
+static void print_usage()
+{
+    fprintf(stderr,
+        "Usage: ghlble_bench [options] > results.json\n"
+        "\t--frames=N\tMeasures N frames per benchmark (default: 200000)\n"
+        "\t--profiles=DIR\tMaps the frames with the profiles in DIR (default: the built-in mapping)\n"
+        "\t--no-uinput\tSkips the benchmarks against /dev/uinput\n"
+        "\t--analog-rate=HZ\tCaps analog-only reports like the daemon does (default: 0, no cap, since frames are replayed back-to-back)\n"
+        "\t--engines=SECONDS\tAlso drives 1, 4 and 16 simulated guitars with each engine for SECONDS and reports threads, context switches and p99 latency\n"
+    );
+}
+
+// The entry point
+int main(int argc, char* argv[])
+{
+    // The number of frames per benchmark
+    size_t frames = 200000;
+
+    // Whether to measure real uinput devices
+    bool uinput = true;
+
+    // How long to drive simulated guitars with each engine (0 = don't)
+    int engineSeconds = 0;
+
+    // Measure the built-in mapping unless told otherwise (a user's profiles would skew the baseline)
+    Profiles::setDirectory("/nonexistent");
+
+    // Frames are replayed back-to-back, a rate cap would hide the cost of analog reports
+    Guitar::setAnalogRate(0);
+
+    // Parse options
+    static struct option long_options[] = {
+        {"frames", required_argument, nullptr, 'f'},
+        {"profiles", required_argument, nullptr, 'p'},
+        {"no-uinput", no_argument, nullptr, 'n'},
+        {"analog-rate", required_argument, nullptr, 'a'},
+        {"engines", required_argument, nullptr, 'E'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt = -1;
+    while ((opt = getopt_long(argc, argv, "f:p:na:E:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                frames = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                Profiles::setDirectory(optarg);
+                break;
+            case 'n':
+                uinput = false;
+                break;
+            case 'a':
+                Guitar::setAnalogRate((int)strtol(optarg, NULL, 10));
+                break;
+            case 'E':
+                engineSeconds = (int)strtol(optarg, NULL, 10);
+                break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (frames == 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    // Keep stdout for the results, the log goes to stderr
+    FILE* output = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    Profiles::reload();
+
+    // Guitar::update with the typical frame mixes
+    std::vector<BenchResult> results;
+    results.push_back(bench_guitar("idle", idle_frames(), frames));
+    results.push_back(bench_guitar("single_fret", single_fret_frames(), frames));
+    results.push_back(bench_guitar("chord", chord_frames(), frames));
+    results.push_back(bench_guitar("analog_noise", analog_noise_frames(), frames));
+    results.push_back(bench_guitar("whammy_sweep", whammy_sweep_frames(), frames));
+
+    // Gamepad emission into a null sink
+    bool available;
+    results.push_back(bench_gamepad("null", Sink_Capture, true, frames, &available));
+    results.push_back(bench_gamepad("null", Sink_Capture, false, frames, &available));
+
+    // The frame hand-off between a guitar's receiving thread and its consumer
+    results.push_back(bench_ring(frames));
+
+    // Gamepad emission into real virtual devices (if we may create them)
+    uinput = uinput && access("/dev/uinput", W_OK) == 0;
+    if (uinput)
+    {
+        BenchResult batched = bench_gamepad("uinput", Sink_Uinput, true, frames, &available);
+        uinput = available;
+        if (uinput)
+        {
+            results.push_back(batched);
+            results.push_back(bench_gamepad("uinput", Sink_Uinput, false, frames, &available));
+        }
+    }
+
+    // The engines driving simulated guitars (thread per guitar polling, thread per guitar with notifications, one event loop)
+    std::vector<EngineResult> engineResults;
+    for (int guitarCount : { 1, 4, 16 })
+    {
+        for (const char* engine : { "threads", "threads_notify", "reactor" })
+        {
+            if (engineSeconds > 0)
+            {
+                engineResults.push_back(bench_engine(engine, (size_t)guitarCount, engineSeconds));
+            }
+        }
+    }
+
+    // Print the results as JSON
+    fprintf(output, "{\n  \"version\": 1,\n  \"frames\": %zu,\n  \"uinput\": %s,\n  \"results\": {\n", frames, uinput ? "true" : "false");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        fprintf(output, "    \"%s\": { \"ns_per_frame\": ", result.name.c_str());
+        print_number(output, result.nanoseconds);
+        fprintf(output, ", \"allocations_per_frame\": ");
+        print_number(output, result.allocations);
+        fprintf(output, ", \"write_syscalls_per_frame\": ");
+        print_number(output, result.syscalls);
+        fprintf(output, ", \"reports_per_frame\": ");
+        print_number(output, result.reports);
+        fprintf(output, " }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(output, "  }");
+    if (!engineResults.empty())
+    {
+        fprintf(output, ",\n  \"engines\": {\n");
+        for (size_t i = 0; i < engineResults.size(); i++)
+        {
+            const EngineResult& result = engineResults[i];
+            fprintf(output, "    \"%s\": { \"threads\": %.0f, \"simulator_threads\": %.0f, \"context_switches_per_second\": %.0f, \"p99_ns\": %.0f, \"frames_per_second\": %.0f }%s\n", result.name.c_str(), result.threads, result.simulatorThreads, result.contextSwitches, result.p99, result.frames, i + 1 < engineResults.size() ? "," : "");
+        }
+        fprintf(output, "  }");
+    }
+    fprintf(output, "\n}\n");
+    fclose(output);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "connectscheduler.h"
+#include "devicecache.h"
+#include "latency.h"
+
+#include <algorithm>
+
+// How long a guitar counts as recently seen after it advertised or streamed
+static const int64_t g_recently_seen = 30 * (int64_t)1000000000;
+
+std::mutex ConnectScheduler::mutex;
+size_t ConnectScheduler::limit = 2;
+uint64_t ConnectScheduler::lastTicket = 0;
+std::vector<ConnectScheduler::Request> ConnectScheduler::waiting;
+std::vector<uint64_t> ConnectScheduler::granted;
+std::unordered_map<uint64_t, int64_t> ConnectScheduler::lastSeen;
+
+void ConnectScheduler::setLimit(size_t concurrent)
+{
+    // Raising the limit can free slots right away
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = concurrent;
+    dispatch();
+}
+
+void ConnectScheduler::markSeen(uint64_t address)
+{
+    // Let the guitar jump the queue for a while
+    std::lock_guard<std::mutex> lock(mutex);
+    lastSeen[address] = LatencyStats::now();
+}
+
+uint64_t ConnectScheduler::request(uint64_t address, Grant grant)
+{
+    // Queue the request and serve it right away if there's a free slot
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t ticket = ++lastTicket;
+    waiting.push_back({ ticket, address, std::move(grant) });
+    dispatch();
+    return ticket;
+}
+
+void ConnectScheduler::release(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Give the slot back and pass it on
+    auto slot = std::find(granted.begin(), granted.end(), ticket);
+    if (slot != granted.end())
+    {
+        granted.erase(slot);
+        dispatch();
+        return;
+    }
+
+    // Withdraw the request
+    auto request = std::find_if(waiting.begin(), waiting.end(), [ticket](const Request& candidate) { return candidate.ticket == ticket; });
+    if (request != waiting.end())
+    {
+        waiting.erase(request);
+    }
+}
+
+int ConnectScheduler::priorityOf(uint64_t address, int64_t now)
+{
+    // The guitar advertised or streamed a moment ago, it's most likely in range and switched on
+    auto seen = lastSeen.find(address);
+    if (seen != lastSeen.end() && now - seen->second < g_recently_seen)
+    {
+        return 0;
+    }
+
+    // We've connected to the guitar before
+    DeviceCacheEntry entry;
+    if (DeviceCache::lookup(address, &entry))
+    {
+        return 1;
+    }
+
+    // We know nothing about it
+    return 2;
+}
+
+void ConnectScheduler::dispatch()
+{
+    int64_t now = LatencyStats::now();
+    while (!waiting.empty() && (limit == 0 || granted.size() < limit))
+    {
+        // Find the best request (the oldest one wins a tie, the queue is in ticket order)
+        size_t best = 0;
+        int bestPriority = priorityOf(waiting[0].address, now);
+        for (size_t i = 1; i < waiting.size() && bestPriority > 0; i++)
+        {
+            int priority = priorityOf(waiting[i].address, now);
+            if (priority < bestPriority)
+            {
+                best = i;
+                bestPriority = priority;
+            }
+        }
+
+        // Hand it the slot
+        Request request = std::move(waiting[best]);
+        waiting.erase(waiting.begin() + best);
+        granted.push_back(request.ticket);
+        request.grant();
+    }
+}
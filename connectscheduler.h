@@ -0,0 +1,69 @@
+#ifndef CONNECTSCHEDULER_H
+#define CONNECTSCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Hands out a limited number of connection slots to the guitars.
+//
+// BlueZ serializes LE connection attempts, so guitars that all try at once
+// just time out against each other. Guitars request a slot before they
+// connect and release it once the attempt has resolved. Waiting guitars are
+// served by priority: guitars that advertised (or streamed) recently first,
+// then guitars from the device cache, then everything else, each in the
+// order they asked.
+class ConnectScheduler {
+public:
+    // Called once a slot has been granted (under the scheduler's lock, so it must not block or call back into the scheduler)
+    typedef std::function<void()> Grant;
+
+    // Sets how many connection attempts may be in flight at once (0 = no limit)
+    static void setLimit(size_t concurrent);
+
+    // Remembers that a guitar has just been seen (it advertised or was streaming)
+    static void markSeen(uint64_t address);
+
+    // Queues a slot request for the guitar, returns its ticket (the grant may be called before this returns)
+    static uint64_t request(uint64_t address, Grant grant);
+
+    // Gives a granted slot back or withdraws a waiting request (does nothing for unknown or released tickets)
+    static void release(uint64_t ticket);
+
+private:
+    // A waiting request
+    struct Request {
+        uint64_t ticket;
+        uint64_t address;
+        Grant grant;
+    };
+
+    // Guards everything below
+    static std::mutex mutex;
+
+    // The number of slots (0 = no limit)
+    static size_t limit;
+
+    // The last ticket handed out
+    static uint64_t lastTicket;
+
+    // The waiting requests
+    static std::vector<Request> waiting;
+
+    // The tickets holding a slot
+    static std::vector<uint64_t> granted;
+
+    // When each guitar was last seen (monotonic nanoseconds)
+    static std::unordered_map<uint64_t, int64_t> lastSeen;
+
+    // Returns the priority of a waiting guitar (lower goes first, mutex must be held)
+    static int priorityOf(uint64_t address, int64_t now);
+
+    // Grants free slots to the best waiting requests (mutex must be held)
+    static void dispatch();
+};
+
+#endif // CONNECTSCHEDULER_H
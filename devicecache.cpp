@@ -0,0 +1,156 @@
+#include "devicecache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// The cache file header
+typedef struct DeviceCacheHeader {
+    char magic[4];        // "GHLC"
+    uint16_t version;     // The file format version
+    uint16_t recordSize;  // sizeof(DeviceCacheEntry)
+    uint32_t count;       // The number of records
+} __attribute__((packed)) DeviceCacheHeader;
+
+// The current file format version
+#define DEVICE_CACHE_VERSION 1
+
+std::string DeviceCache::path;
+std::mutex DeviceCache::mutex;
+std::vector<DeviceCacheEntry> DeviceCache::cache;
+
+void DeviceCache::setPath(const std::string& value)
+{
+    // Remember the file for the next load
+    path = value;
+}
+
+std::string DeviceCache::getPath()
+{
+    // We've been given a file
+    if (!path.empty())
+    {
+        return path;
+    }
+
+    // Follow the XDG base directory specification
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome != NULL && cacheHome[0] != '\0')
+    {
+        return std::string(cacheHome) + "/ghlble/devices.bin";
+    }
+    const char* home = getenv("HOME");
+    return std::string(home != NULL ? home : ".") + "/.cache/ghlble/devices.bin";
+}
+
+bool DeviceCache::load()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+
+    // Open the cache file
+    FILE* file = fopen(getPath().c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // Read and validate the header
+    DeviceCacheHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "GHLC", 4) == 0 && header.version == DEVICE_CACHE_VERSION && header.recordSize == sizeof(DeviceCacheEntry);
+
+    // Read the records
+    if (valid)
+    {
+        cache.resize(header.count);
+        valid = header.count == 0 || fread(cache.data(), sizeof(DeviceCacheEntry), header.count, file) == header.count;
+    }
+    fclose(file);
+
+    // Discard unreadable caches (they'll be rebuilt by discovery)
+    if (!valid)
+    {
+        printf("Ignoring the invalid device cache (%s).\n", getPath().c_str());
+        cache.clear();
+    }
+    return valid;
+}
+
+bool DeviceCache::lookup(uint64_t address, DeviceCacheEntry* entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& candidate : cache)
+    {
+        if (candidate.address == address)
+        {
+            *entry = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DeviceCache::store(const DeviceCacheEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Replace the existing entry
+    for (auto& candidate : cache)
+    {
+        if (candidate.address == entry.address)
+        {
+            candidate = entry;
+            save();
+            return;
+        }
+    }
+
+    // Add a new entry
+    cache.push_back(entry);
+    save();
+}
+
+void DeviceCache::forget(uint64_t address)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+        if (cache[i].address == address)
+        {
+            cache.erase(cache.begin() + i);
+            save();
+            return;
+        }
+    }
+}
+
+std::vector<DeviceCacheEntry> DeviceCache::entries()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return cache;
+}
+
+bool DeviceCache::save()
+{
+    // Make sure the directory exists
+    std::string file = getPath();
+    for (size_t slash = file.find('/', 1); slash != std::string::npos; slash = file.find('/', slash + 1))
+    {
+        mkdir(file.substr(0, slash).c_str(), 0700);
+    }
+
+    // Write to a temporary file first so readers never see a half-written cache
+    std::string temporary = file + ".tmp";
+    FILE* output = fopen(temporary.c_str(), "wb");
+    if (output == NULL)
+    {
+        return false;
+    }
+    DeviceCacheHeader header = { { 'G', 'H', 'L', 'C' }, DEVICE_CACHE_VERSION, sizeof(DeviceCacheEntry), (uint32_t)cache.size() };
+    bool written = fwrite(&header, sizeof(header), 1, output) == 1 && (cache.empty() || fwrite(cache.data(), sizeof(DeviceCacheEntry), cache.size(), output) == cache.size());
+    written = fclose(output) == 0 && written;
+
+    // Replace the cache file
+    return written && rename(temporary.c_str(), file.c_str()) == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef DEVICECACHE_H
+#define DEVICECACHE_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A cached guitar
+typedef struct DeviceCacheEntry {
+    uint64_t address;      // The packed MAC address
+    uint16_t handle;       // The input characteristic's declaration handle
+    uint16_t valueHandle;  // The input characteristic's value handle
+    uint8_t uuidType;      // The input characteristic's UUID type (see uuid_t)
+    uint8_t uuid[16];      // The input characteristic's UUID value (see uuid_t)
+    char profile[24];      // The name of the last used mapping profile
+    uint64_t lastSeen;     // When the characteristic was last discovered (seconds since the epoch)
+} __attribute__((packed)) DeviceCacheEntry;
+
+// Remembers known guitars across restarts so they can be connected without scanning and discovery.
+//
+// The cache is a compact binary file (a small header followed by fixed-size
+// records) that's rewritten atomically whenever an entry changes.
+class DeviceCache {
+public:
+    // Sets the file the cache is stored in
+    static void setPath(const std::string& path);
+
+    // Returns the file the cache is stored in
+    static std::string getPath();
+
+    // Loads the cache from disk
+    static bool load();
+
+    // Returns a copy of the given guitar's entry, returns false if the guitar isn't cached
+    static bool lookup(uint64_t address, DeviceCacheEntry* entry);
+
+    // Adds or replaces an entry and saves the cache
+    static void store(const DeviceCacheEntry& entry);
+
+    // Removes an entry (e.g. because its handle didn't work anymore) and saves the cache
+    static void forget(uint64_t address);
+
+    // Returns a copy of all entries
+    static std::vector<DeviceCacheEntry> entries();
+
+private:
+    // The cache file
+    static std::string path;
+
+    // Guards the entries
+    static std::mutex mutex;
+
+    // The cached guitars
+    static std::vector<DeviceCacheEntry> cache;
+
+    // Writes the cache to disk (mutex must be held)
+    static bool save();
+};
+
+#endif // DEVICECACHE_H
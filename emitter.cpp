@@ -0,0 +1,105 @@
+#include "emitter.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+Emitter::Emitter() : wakeFd(-1), pending(false), running(false)
+{
+}
+
+Emitter::~Emitter()
+{
+    // Stop the thread
+    stop();
+}
+
+bool Emitter::start()
+{
+    // Create the wake-up handle
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0)
+    {
+        return false;
+    }
+
+    // Start the thread
+    running = true;
+    thread = std::thread(&Emitter::run, this);
+    return true;
+}
+
+void Emitter::stop()
+{
+    // Stop the thread
+    if (thread.joinable())
+    {
+        running = false;
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+        thread.join();
+    }
+
+    // Close the wake-up handle
+    if (wakeFd >= 0)
+    {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+}
+
+void Emitter::attach(const void* owner, Drain drain)
+{
+    // Add the source
+    std::lock_guard<std::mutex> lock(mutex);
+    sources.push_back({ owner, std::move(drain) });
+}
+
+void Emitter::detach(const void* owner)
+{
+    // Remove the source (the lock waits for a running drain)
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = sources.begin(); it != sources.end(); ++it)
+    {
+        if (it->owner == owner)
+        {
+            sources.erase(it);
+            break;
+        }
+    }
+}
+
+void Emitter::wake()
+{
+    // Only the first producer after the emitter went to sleep has to wake it up
+    if (!pending.exchange(true, std::memory_order_acq_rel))
+    {
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void Emitter::run()
+{
+    while (running)
+    {
+        // Wait for something to drain
+        uint64_t count;
+        if (read(wakeFd, &count, sizeof(count)) != sizeof(count))
+        {
+            continue;
+        }
+
+        // Frames pushed from now on need another wake-up (the exchange makes the frames pushed so far visible)
+        pending.exchange(false, std::memory_order_acq_rel);
+
+        // Drain every source
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Source& source : sources)
+        {
+            source.drain();
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Drains the input rings of all pipelined guitars on a thread of its own.
+//
+// Producers push into their rings and call wake(), which only costs a syscall
+// when the emitter has caught up and gone to sleep. Every wake-up drains all
+// attached sources, so a burst of frames is handled in one pass.
+class Emitter {
+public:
+    // Drains a source's ring
+    typedef std::function<void()> Drain;
+
+    // Constructor
+    Emitter();
+
+    // Destructor
+    ~Emitter();
+
+    // Starts the emitter thread
+    bool start();
+
+    // Stops the emitter thread
+    void stop();
+
+    // Starts draining a source whenever the emitter wakes up
+    void attach(const void* owner, Drain drain);
+
+    // Stops draining a source, waits for its drain to finish if it's currently running
+    void detach(const void* owner);
+
+    // Lets the emitter know there's something to drain (safe to call from any thread)
+    void wake();
+
+private:
+    // An attached source
+    struct Source {
+        const void* owner;
+        Drain drain;
+    };
+
+    // Wakes the emitter thread up
+    int wakeFd;
+
+    // Whether a wake-up is already pending
+    std::atomic<bool> pending;
+
+    // Whether the thread should keep running
+    std::atomic<bool> running;
+
+    // Guards the sources (held while they're drained)
+    std::mutex mutex;
+
+    // The attached sources
+    std::vector<Source> sources;
+
+    // The emitter thread
+    std::thread thread;
+
+    // The emitter thread's main loop
+    void run();
+};
+
+#endif // EMITTER_H
@@ -0,0 +1,144 @@
+#include "epoch.h"
+
+#include <thread>
+
+std::atomic<uint64_t> Epoch::globalEpoch(1);
+Epoch::ReaderSlot Epoch::readers[Epoch::MaxReaders];
+std::mutex Epoch::retiredMutex;
+std::vector<Epoch::RetiredObject> Epoch::retired;
+
+Epoch::ThreadState::~ThreadState()
+{
+    // Give the slot back to other threads
+    if (slot != nullptr)
+    {
+        slot->epoch.store(0, std::memory_order_release);
+        slot->claimed.store(false, std::memory_order_release);
+    }
+}
+
+Epoch::ThreadState& Epoch::threadState()
+{
+    // Every thread owns its reader state
+    thread_local ThreadState state;
+    return state;
+}
+
+Epoch::ReaderSlot* Epoch::claimSlot()
+{
+    // Keep looking until another thread frees a slot (only happens with more than MaxReaders threads)
+    while (true)
+    {
+        for (size_t i = 0; i < MaxReaders; i++)
+        {
+            bool expected = false;
+            if (!readers[i].claimed.load(std::memory_order_relaxed) && readers[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            {
+                return &readers[i];
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+Epoch::Guard::Guard()
+{
+    // Only the outermost guard pins the epoch
+    ThreadState& state = threadState();
+    if (state.depth++ == 0)
+    {
+        // Claim a slot on first use
+        if (state.slot == nullptr)
+        {
+            state.slot = claimSlot();
+        }
+
+        // Publish the epoch before reading any protected pointer
+        state.slot->epoch.store(globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+}
+
+Epoch::Guard::~Guard()
+{
+    // Only the outermost guard unpins the epoch
+    ThreadState& state = threadState();
+    if (--state.depth == 0)
+    {
+        state.slot->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void Epoch::retire(std::function<void()> deleter)
+{
+    // Readers that enter after this point can't see the object anymore
+    uint64_t epoch = globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+
+    // Queue the object and free whatever has become unreachable
+    std::unique_lock<std::mutex> lock(retiredMutex);
+    retired.push_back({ epoch, std::move(deleter) });
+    reclaimLocked(lock);
+}
+
+void Epoch::reclaim()
+{
+    // Free whatever has become unreachable
+    std::unique_lock<std::mutex> lock(retiredMutex);
+    reclaimLocked(lock);
+}
+
+void Epoch::synchronize()
+{
+    // Readers that enter after this point can't see anything unpublished before it
+    uint64_t epoch = globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+
+    // Wait for the readers that entered before it
+    while (oldestPinnedEpoch() <= epoch)
+    {
+        std::this_thread::yield();
+    }
+}
+
+uint64_t Epoch::oldestPinnedEpoch()
+{
+    // Find the oldest epoch any reader is pinned to
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < MaxReaders; i++)
+    {
+        uint64_t epoch = readers[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0 && epoch < oldest)
+        {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+void Epoch::reclaimLocked(std::unique_lock<std::mutex>& lock)
+{
+    // Objects retired before the oldest pinned epoch can't be seen by anyone
+    uint64_t oldest = oldestPinnedEpoch();
+
+    // Split off the reclaimable objects
+    std::vector<RetiredObject> reclaimable;
+    for (size_t i = 0; i < retired.size();)
+    {
+        if (retired[i].epoch < oldest)
+        {
+            reclaimable.push_back(std::move(retired[i]));
+            retired[i] = std::move(retired.back());
+            retired.pop_back();
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // Run the deleters without holding the lock
+    lock.unlock();
+    for (auto& object : reclaimable)
+    {
+        object.deleter();
+    }
+    lock.lock();
+}
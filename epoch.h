@@ -0,0 +1,84 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation for objects that are published through atomic pointers.
+//
+// Readers wrap every access in an Epoch::Guard, which costs two stores to a
+// thread-private slot and never locks or allocates. Writers swap the pointer
+// and hand the old object to Epoch::retire, which frees it once no reader
+// that could still see it is inside a guard.
+class Epoch {
+public:
+    // Pins the current epoch for the lifetime of the guard (guards may nest)
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // Schedules the given deleter to run once all current readers are done
+    static void retire(std::function<void()> deleter);
+
+    // Runs the deleters of all objects that can't be seen by readers anymore
+    static void reclaim();
+
+    // Waits until every reader that's currently inside a guard has left it (must not be called inside a guard)
+    static void synchronize();
+
+private:
+    // The maximum number of threads that can be inside a guard at the same time
+    static const size_t MaxReaders = 128;
+
+    // A reader's published epoch (0 while the reader is outside of any guard)
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> claimed;
+    };
+
+    // A retired object
+    struct RetiredObject {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    // The per-thread reader state
+    struct ThreadState {
+        ReaderSlot* slot = nullptr;
+        unsigned depth = 0;
+        ~ThreadState();
+    };
+
+    // The global epoch
+    static std::atomic<uint64_t> globalEpoch;
+
+    // The reader slots
+    static ReaderSlot readers[MaxReaders];
+
+    // Guards the retired objects (writers only)
+    static std::mutex retiredMutex;
+
+    // The objects waiting to be reclaimed
+    static std::vector<RetiredObject> retired;
+
+    // Returns the calling thread's reader state
+    static ThreadState& threadState();
+
+    // Claims a reader slot for the calling thread
+    static ReaderSlot* claimSlot();
+
+    // Returns the oldest epoch a reader is currently pinned to
+    static uint64_t oldestPinnedEpoch();
+
+    // Runs the deleters of reclaimable objects (retiredMutex must be held)
+    static void reclaimLocked(std::unique_lock<std::mutex>& lock);
+};
+
+#endif // EPOCH_H
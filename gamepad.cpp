@@ -1,96 +1,260 @@
 #include "gamepad.h"
 
-Gamepad::Gamepad(const std::string& name)
+#include <ctype.h>
+
+// The range, fuzz and flat values of an axis
+typedef struct GamepadAxisSetup {
+    uint16_t code;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t fuzz;
+    int32_t flat;
+} GamepadAxisSetup;
+
+// The axes of the virtual gamepad
+static const GamepadAxisSetup g_gamepad_axes[] = {
+    { AXIS_LEFT_ANALOG_HORIZONTAL, ANALOG_VALUE_MIN, ANALOG_VALUE_MAX, ANALOG_VALUE_FUZZ, ANALOG_VALUE_FLAT }, // Left Analog X
+    { AXIS_LEFT_ANALOG_VERTICAL, ANALOG_VALUE_MIN, ANALOG_VALUE_MAX, ANALOG_VALUE_FUZZ, ANALOG_VALUE_FLAT }, // Left Analog Y
+    { AXIS_LEFT_TRIGGER, TRIGGER_VALUE_MIN, TRIGGER_VALUE_MAX, TRIGGER_VALUE_FUZZ, TRIGGER_VALUE_FLAT }, // Left Trigger
+    { AXIS_RIGHT_ANALOG_HORIZONTAL, ANALOG_VALUE_MIN, ANALOG_VALUE_MAX, ANALOG_VALUE_FUZZ, ANALOG_VALUE_FLAT }, // Right Analog X
+    { AXIS_RIGHT_ANALOG_VERTICAL, ANALOG_VALUE_MIN, ANALOG_VALUE_MAX, ANALOG_VALUE_FUZZ, ANALOG_VALUE_FLAT }, // Right Analog Y
+    { AXIS_RIGHT_TRIGGER, TRIGGER_VALUE_MIN, TRIGGER_VALUE_MAX, TRIGGER_VALUE_FUZZ, TRIGGER_VALUE_FLAT }, // Right Trigger
+    { AXIS_DPAD_HORIZONTAL, DPAD_VALUE_MIN, DPAD_VALUE_MAX, DPAD_VALUE_FUZZ, DPAD_VALUE_FLAT }, // Dpad X
+    { AXIS_DPAD_VERTICAL, DPAD_VALUE_MIN, DPAD_VALUE_MAX, DPAD_VALUE_FUZZ, DPAD_VALUE_FLAT } // Dpad Y
+};
+
+// The buttons of the virtual gamepad
+static const uint16_t g_gamepad_buttons[] = {
+    BTN_SOUTH, // A
+    BTN_EAST, // B
+    BTN_NORTH, // Y
+    BTN_WEST, // X
+    BTN_SELECT, // SELECT
+    BTN_START, // START
+    BTN_THUMBL, // L3
+    BTN_THUMBR, // R3
+    BTN_MODE, // HOME/BACK
+    BTN_TL, // L1
+    BTN_TR // R1
+};
+
+GamepadSinks Gamepad::sink = Sink_Uinput;
+std::string Gamepad::captureDirectory;
+
+void Gamepad::setSink(GamepadSinks sinkValue, const std::string& captureDirectoryValue)
 {
+    // Remember the sink for new gamepads
+    sink = sinkValue;
+    captureDirectory = captureDirectoryValue;
+}
+
+Gamepad::Gamepad(const std::string& name) : outputSink(sink), frameEventCount(0), batchEventCount(0), batching(false)
+{
+    // Nobody wants the events
+    if (outputSink == Sink_None)
+    {
+        uinputHandle = -1;
+        return;
+    }
+
+    // We're capturing events instead of feeding them into a virtual device
+    if (outputSink == Sink_Capture)
+    {
+        // Name the capture file after the gamepad
+        std::string path = "/dev/null";
+        if (!captureDirectory.empty())
+        {
+            path = captureDirectory + "/";
+            for (char c : name)
+            {
+                path += isalnum((unsigned char)c) ? c : '_';
+            }
+            path += ".events";
+        }
+
+        // Open the capture file
+        uinputHandle = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        return;
+    }
+
     // Open uinput
     uinputHandle = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
 
-    // Configure the virtual device
-    struct uinput_user_dev gamepad_configuration;
-    memset(&gamepad_configuration, 0, sizeof(gamepad_configuration)); // Initialize memory
-    snprintf(gamepad_configuration.name, UINPUT_MAX_NAME_SIZE, "%s", name.c_str()); // Gamepad name
-    gamepad_configuration.id.bustype = BUS_USB; // Connected via USB
-    gamepad_configuration.id.vendor  = 0x045e; // Microsoft
-    gamepad_configuration.id.product = 0x028e; // Xbox 360 Controller
-    gamepad_configuration.id.version = 1; // First version
-    gamepad_configuration.absmin[AXIS_LEFT_ANALOG_HORIZONTAL] = ANALOG_VALUE_MIN; // Left Analog X
-    gamepad_configuration.absmax[AXIS_LEFT_ANALOG_HORIZONTAL] = ANALOG_VALUE_MAX; // Left Analog X
-    gamepad_configuration.absfuzz[AXIS_LEFT_ANALOG_HORIZONTAL] = ANALOG_VALUE_FUZZ; // Left Analog X
-    gamepad_configuration.absflat[AXIS_LEFT_ANALOG_HORIZONTAL] = ANALOG_VALUE_FLAT; // Left Analog X
-    gamepad_configuration.absmin[AXIS_LEFT_ANALOG_VERTICAL] = ANALOG_VALUE_MIN; // Left Analog Y
-    gamepad_configuration.absmax[AXIS_LEFT_ANALOG_VERTICAL] = ANALOG_VALUE_MAX; // Left Analog Y
-    gamepad_configuration.absfuzz[AXIS_LEFT_ANALOG_VERTICAL] = ANALOG_VALUE_FUZZ; // Left Analog Y
-    gamepad_configuration.absflat[AXIS_LEFT_ANALOG_VERTICAL] = ANALOG_VALUE_FLAT; // Left Analog Y
-    gamepad_configuration.absmin[AXIS_LEFT_TRIGGER] = TRIGGER_VALUE_MIN; // Left Trigger
-    gamepad_configuration.absmax[AXIS_LEFT_TRIGGER] = TRIGGER_VALUE_MAX; // Left Trigger
-    gamepad_configuration.absfuzz[AXIS_LEFT_TRIGGER] = TRIGGER_VALUE_FUZZ; // Left Trigger
-    gamepad_configuration.absflat[AXIS_LEFT_TRIGGER] = TRIGGER_VALUE_FLAT; // Left Trigger
-    gamepad_configuration.absmin[AXIS_RIGHT_ANALOG_HORIZONTAL] = ANALOG_VALUE_MIN; // Right Analog X
-    gamepad_configuration.absmax[AXIS_RIGHT_ANALOG_HORIZONTAL] = ANALOG_VALUE_MAX; // Right Analog X
-    gamepad_configuration.absfuzz[AXIS_RIGHT_ANALOG_HORIZONTAL] = ANALOG_VALUE_FUZZ; // Right Analog X
-    gamepad_configuration.absflat[AXIS_RIGHT_ANALOG_HORIZONTAL] = ANALOG_VALUE_FLAT; // Right Analog X
-    gamepad_configuration.absmin[AXIS_RIGHT_ANALOG_VERTICAL] = ANALOG_VALUE_MIN; // Right Analog Y
-    gamepad_configuration.absmax[AXIS_RIGHT_ANALOG_VERTICAL] = ANALOG_VALUE_MAX; // Right Analog Y
-    gamepad_configuration.absfuzz[AXIS_RIGHT_ANALOG_VERTICAL] = ANALOG_VALUE_FUZZ; // Right Analog Y
-    gamepad_configuration.absflat[AXIS_RIGHT_ANALOG_VERTICAL] = ANALOG_VALUE_FLAT; // Right Analog Y
-    gamepad_configuration.absmin[AXIS_RIGHT_TRIGGER] = TRIGGER_VALUE_MIN; // Right Trigger
-    gamepad_configuration.absmax[AXIS_RIGHT_TRIGGER] = TRIGGER_VALUE_MAX; // Right Trigger
-    gamepad_configuration.absfuzz[AXIS_RIGHT_TRIGGER] = TRIGGER_VALUE_FUZZ; // Right Trigger
-    gamepad_configuration.absflat[AXIS_RIGHT_TRIGGER] = TRIGGER_VALUE_FLAT; // Right Trigger
-    gamepad_configuration.absmin[AXIS_DPAD_HORIZONTAL] = DPAD_VALUE_MIN; // Dpad X
-    gamepad_configuration.absmax[AXIS_DPAD_HORIZONTAL] = DPAD_VALUE_MAX; // Dpad X
-    gamepad_configuration.absfuzz[AXIS_DPAD_HORIZONTAL] = DPAD_VALUE_FUZZ; // Dpad X
-    gamepad_configuration.absflat[AXIS_DPAD_HORIZONTAL] = DPAD_VALUE_FLAT; // Dpad X
-    gamepad_configuration.absmin[AXIS_DPAD_VERTICAL] = DPAD_VALUE_MIN; // Dpad Y
-    gamepad_configuration.absmax[AXIS_DPAD_VERTICAL] = DPAD_VALUE_MAX; // Dpad Y
-    gamepad_configuration.absfuzz[AXIS_DPAD_VERTICAL] = DPAD_VALUE_FUZZ; // Dpad Y
-    gamepad_configuration.absflat[AXIS_DPAD_VERTICAL] = DPAD_VALUE_FLAT; // Dpad Y
+    // Announce the event types, buttons and axes
     ioctl(uinputHandle, UI_SET_EVBIT, EV_KEY); // This gamepad has buttons
     ioctl(uinputHandle, UI_SET_EVBIT, EV_ABS); // This gamepad has axes
     ioctl(uinputHandle, UI_SET_EVBIT, EV_SYN); // This gamepad sends SYN events
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_SOUTH); // A
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_EAST); // B
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_NORTH); // Y
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_WEST); // X
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_SELECT); // SELECT
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_START); // START
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_THUMBL); // L3
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_THUMBR); // R3
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_MODE); // HOME/BACK
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_TL); // L1
-    ioctl(uinputHandle, UI_SET_KEYBIT, BTN_TR); // R1
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_LEFT_ANALOG_HORIZONTAL); // Left Analog X
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_LEFT_ANALOG_VERTICAL); // Left Analog Y
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_LEFT_TRIGGER); // Left Trigger
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_RIGHT_ANALOG_HORIZONTAL); // Right Analog X
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_RIGHT_ANALOG_VERTICAL); // Right Analog Y
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_RIGHT_TRIGGER); // Right Trigger
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_DPAD_HORIZONTAL); // Dpad X
-    ioctl(uinputHandle, UI_SET_ABSBIT, AXIS_DPAD_VERTICAL); // Dpad Y
+    for (uint16_t button : g_gamepad_buttons)
+    {
+        ioctl(uinputHandle, UI_SET_KEYBIT, button);
+    }
+    for (const GamepadAxisSetup& axis : g_gamepad_axes)
+    {
+        ioctl(uinputHandle, UI_SET_ABSBIT, axis.code);
+    }
+
+    // Configure the virtual device with the setup ioctls (Linux 4.5 and newer)
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup)); // Initialize memory
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%s", name.c_str()); // Gamepad name
+    setup.id.bustype = BUS_USB; // Connected via USB
+    setup.id.vendor  = 0x045e; // Microsoft
+    setup.id.product = 0x028e; // Xbox 360 Controller
+    setup.id.version = 1; // First version
+    bool configured = ioctl(uinputHandle, UI_DEV_SETUP, &setup) == 0;
+    for (const GamepadAxisSetup& axis : g_gamepad_axes)
+    {
+        struct uinput_abs_setup absSetup;
+        memset(&absSetup, 0, sizeof(absSetup));
+        absSetup.code = axis.code;
+        absSetup.absinfo.minimum = axis.minimum;
+        absSetup.absinfo.maximum = axis.maximum;
+        absSetup.absinfo.fuzz = axis.fuzz;
+        absSetup.absinfo.flat = axis.flat;
+        configured = configured && ioctl(uinputHandle, UI_ABS_SETUP, &absSetup) == 0;
+    }
+
+    // Older kernels only take the legacy device description
+    if (!configured)
+    {
+        struct uinput_user_dev gamepad_configuration;
+        memset(&gamepad_configuration, 0, sizeof(gamepad_configuration)); // Initialize memory
+        memcpy(gamepad_configuration.name, setup.name, UINPUT_MAX_NAME_SIZE); // Gamepad name
+        gamepad_configuration.id = setup.id; // Xbox 360 Controller
+        for (const GamepadAxisSetup& axis : g_gamepad_axes)
+        {
+            gamepad_configuration.absmin[axis.code] = axis.minimum;
+            gamepad_configuration.absmax[axis.code] = axis.maximum;
+            gamepad_configuration.absfuzz[axis.code] = axis.fuzz;
+            gamepad_configuration.absflat[axis.code] = axis.flat;
+        }
+        ssize_t written = write(uinputHandle, &gamepad_configuration, sizeof(gamepad_configuration));
+        (void)written;
+    }
 
     // Create the virtual device
-    write(uinputHandle, &gamepad_configuration, sizeof(gamepad_configuration));
     ioctl(uinputHandle, UI_DEV_CREATE);
 }
 
 Gamepad::~Gamepad()
 {
     // Destroy our merged gamepad
-    ioctl(uinputHandle, UI_DEV_DESTROY);
+    if (outputSink == Sink_Uinput)
+    {
+        ioctl(uinputHandle, UI_DEV_DESTROY);
+    }
 
     // Close uinput
-    close(uinputHandle);
+    if (uinputHandle >= 0)
+    {
+        close(uinputHandle);
+    }
+}
+
+bool Gamepad::update(struct input_event * ev)
+{
+    // Send the event as a report of its own
+    beginFrame();
+    append(ev->type, ev->code, ev->value);
+    return commit();
 }
 
-void Gamepad::update(struct input_event * ev)
+void Gamepad::beginFrame()
 {
-    // Writes the event into the virtual gamepad
-    write(uinputHandle, ev, sizeof(*ev));
+    // Discard any uncommitted events
+    frameEventCount = 0;
 
-    struct input_event syn;
-    gettimeofday(&syn.time, nullptr);
+    // All events of a frame share the same timestamp
+    gettimeofday(&frameTime, nullptr);
+}
+
+void Gamepad::append(uint16_t type, uint16_t code, int32_t value)
+{
+    // The frame is full (this can't happen with the guitar's mapping)
+    if (frameEventCount >= GAMEPAD_MAX_FRAME_EVENTS)
+    {
+        return;
+    }
+
+    // Queue the event
+    struct input_event& ev = frameEvents[frameEventCount++];
+    ev.time = frameTime;
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+}
+
+bool Gamepad::commit()
+{
+    // Nothing has changed
+    if (frameEventCount == 0)
+    {
+        return true;
+    }
+
+    // Terminate the frame with a single SYN report
+    struct input_event& syn = frameEvents[frameEventCount++];
+    syn.time = frameTime;
     syn.type = EV_SYN;
     syn.code = SYN_REPORT;
     syn.value = 0;
-    write(uinputHandle, &syn, sizeof(syn));
+
+    // We're collecting a batch
+    if (batching)
+    {
+        // Make room for the frame
+        bool flushed = true;
+        if (batchEventCount + frameEventCount > GAMEPAD_BATCH_EVENTS)
+        {
+            flushed = flushBatch();
+        }
+
+        // Queue the frame behind the previous ones
+        memcpy(&batchEvents[batchEventCount], frameEvents, frameEventCount * sizeof(struct input_event));
+        batchEventCount += frameEventCount;
+        frameEventCount = 0;
+        return flushed;
+    }
+
+    // Write the whole frame into the virtual gamepad at once
+    size_t length = frameEventCount * sizeof(struct input_event);
+    ssize_t written = outputSink != Sink_None ? write(uinputHandle, frameEvents, length) : (ssize_t)length;
+
+    // Start over
+    frameEventCount = 0;
+
+    // Let the caller know whether the frame made it
+    return written == (ssize_t)length;
+}
+
+void Gamepad::beginBatch()
+{
+    // Collect the committed frames
+    batching = true;
+}
+
+bool Gamepad::endBatch()
+{
+    // Write what we've collected
+    batching = false;
+    return flushBatch();
+}
+
+bool Gamepad::flushBatch()
+{
+    // There's nothing to write
+    if (batchEventCount == 0)
+    {
+        return true;
+    }
+
+    // Write all frames of the batch at once
+    size_t length = batchEventCount * sizeof(struct input_event);
+    ssize_t written = outputSink != Sink_None ? write(uinputHandle, batchEvents, length) : (ssize_t)length;
+
+    // Start over
+    batchEventCount = 0;
+
+    // Let the caller know whether the batch made it
+    return written == (ssize_t)length;
 }
@@ -2,6 +2,7 @@
 #define GAMEPAD_H
 
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <linux/input.h>
@@ -62,11 +63,55 @@ enum GamepadAxis
 #define TRIGGER_VALUE_FUZZ 0
 #define TRIGGER_VALUE_FLAT 0
 
+// The maximum number of events a single frame can carry (excluding its SYN report)
+#define GAMEPAD_MAX_FRAME_EVENTS 32
+
+// The number of events a batch of frames can hold before it's written out early
+#define GAMEPAD_BATCH_EVENTS (4 * (GAMEPAD_MAX_FRAME_EVENTS + 1))
+
+// Where gamepads send their events
+enum GamepadSinks
+{
+    Sink_Uinput = 0,  // A virtual input device
+    Sink_Capture = 1, // A raw input_event stream in a file (or nowhere)
+    Sink_None = 2     // Nowhere (when guitars are only read through shared memory)
+};
+
 class Gamepad {
 private:
-    // The uinput handle
+    // Where new gamepads send their events
+    static GamepadSinks sink;
+
+    // The directory captured events are written to (empty = discard them)
+    static std::string captureDirectory;
+
+    // Where this gamepad sends its events
+    GamepadSinks outputSink;
+
+    // The uinput handle (or the capture file)
     int uinputHandle;
 
+    // The events of the frame that's currently being built (plus room for the SYN report)
+    struct input_event frameEvents[GAMEPAD_MAX_FRAME_EVENTS + 1];
+
+    // The number of events in the current frame
+    size_t frameEventCount;
+
+    // The timestamp shared by all events of the current frame
+    struct timeval frameTime;
+
+    // The frames committed since beginBatch() (including their SYN reports)
+    struct input_event batchEvents[GAMEPAD_BATCH_EVENTS];
+
+    // The number of events in the current batch
+    size_t batchEventCount;
+
+    // Whether committed frames are collected into a batch
+    bool batching;
+
+    // Writes the current batch, returns false if the write failed
+    bool flushBatch();
+
 public:
     // Constructor
     Gamepad(const std::string& name);
@@ -74,8 +119,32 @@ public:
     // Destructor
     ~Gamepad();
 
-    // Feeds the gamepad a new input event
-    void update(struct input_event * ev);
+    // Feeds the gamepad a new input event (as a report of its own), returns false if the write failed
+    bool update(struct input_event * ev);
+
+    // Starts a new frame
+    void beginFrame();
+
+    // Appends an event to the current frame
+    void append(uint16_t type, uint16_t code, int32_t value);
+
+    // Emits the current frame's events and a single SYN report in one write, returns false if the write failed
+    bool commit();
+
+    // Returns whether the current frame has no events yet
+    bool isFrameEmpty() const { return frameEventCount == 0; }
+
+    // Returns the number of events in the current frame (excluding its SYN report)
+    size_t getFrameEventCount() const { return frameEventCount; }
+
+    // Collects the frames committed from now on so they're written together (each keeps its own SYN report)
+    void beginBatch();
+
+    // Writes the frames committed since beginBatch() in one write, returns false if the write failed
+    bool endBatch();
+
+    // Selects where gamepads created from now on send their events (capture files are named after the gamepad)
+    static void setSink(GamepadSinks sinkValue, const std::string& captureDirectoryValue = "");
 };
 
 #endif // GAMEPAD_H
@@ -0,0 +1,145 @@
+#include "gamepadpool.h"
+
+#include <algorithm>
+
+const char* const GamepadPool::SpareName = "Guitar";
+std::mutex GamepadPool::mutex;
+std::condition_variable GamepadPool::condition;
+bool GamepadPool::running = false;
+size_t GamepadPool::spares = 0;
+std::deque<std::string> GamepadPool::requests;
+std::unordered_map<std::string, std::unique_ptr<Gamepad>> GamepadPool::prepared;
+std::vector<std::unique_ptr<Gamepad>> GamepadPool::spareGamepads;
+std::thread GamepadPool::thread;
+
+void GamepadPool::start(size_t spareCount)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The pool is already running
+    if (running)
+    {
+        return;
+    }
+
+    // Queue the spares
+    spares = spareCount;
+    for (size_t i = 0; i < spares; i++)
+    {
+        requests.push_back(SpareName);
+    }
+
+    // Start the pool thread
+    running = true;
+    thread = std::thread(&GamepadPool::run);
+}
+
+void GamepadPool::stop()
+{
+    // Stop the pool thread
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+        {
+            return;
+        }
+        running = false;
+    }
+    condition.notify_all();
+    thread.join();
+
+    // Destroy the unclaimed gamepads
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.clear();
+    prepared.clear();
+    spareGamepads.clear();
+}
+
+void GamepadPool::prepare(const std::string& name)
+{
+    // Queue the gamepad unless it's already there (or on its way)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || prepared.count(name) != 0 || std::find(requests.begin(), requests.end(), name) != requests.end())
+        {
+            return;
+        }
+        requests.push_back(name);
+    }
+    condition.notify_all();
+}
+
+std::unique_ptr<Gamepad> GamepadPool::claim(const std::string& name)
+{
+    std::unique_ptr<Gamepad> gamepad;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // The guitar's gamepad is being created right now, waiting for it beats creating another one
+        auto queued = std::find(requests.begin(), requests.end(), name);
+        if (queued == requests.begin() && queued != requests.end())
+        {
+            condition.wait(lock, [&name]() { return !running || prepared.count(name) != 0; });
+        }
+
+        // It hasn't been started yet, the caller is quicker on its own
+        else if (queued != requests.end())
+        {
+            requests.erase(queued);
+        }
+
+        // Hand out the gamepad that was prepared for this guitar
+        auto it = prepared.find(name);
+        if (it != prepared.end())
+        {
+            gamepad = std::move(it->second);
+            prepared.erase(it);
+            return gamepad;
+        }
+
+        // Hand out a spare and replace it
+        if (spareGamepads.empty())
+        {
+            return gamepad;
+        }
+        gamepad = std::move(spareGamepads.back());
+        spareGamepads.pop_back();
+        requests.push_back(SpareName);
+    }
+    condition.notify_all();
+    return gamepad;
+}
+
+void GamepadPool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        // Wait for a request
+        condition.wait(lock, []() { return !running || !requests.empty(); });
+        if (!running)
+        {
+            return;
+        }
+        std::string name = requests.front();
+
+        // Create the gamepad without holding the lock
+        lock.unlock();
+        std::unique_ptr<Gamepad> gamepad = std::make_unique<Gamepad>(name);
+        lock.lock();
+
+        // Publish it (the request stays queued until now so prepare() doesn't queue it twice)
+        requests.pop_front();
+        if (name == SpareName)
+        {
+            spareGamepads.push_back(std::move(gamepad));
+        }
+        else
+        {
+            prepared[name] = std::move(gamepad);
+        }
+
+        // Wake up a claim that's waiting for it
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef GAMEPADPOOL_H
+#define GAMEPADPOOL_H
+
+#include "gamepad.h"
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Creates virtual gamepads ahead of time so connecting guitars don't have to.
+//
+// Creating a uinput device takes a couple of syscalls and kicks off udev and
+// the games' hotplug handling, which shouldn't happen on the input path while
+// the player is already strumming. The pool creates the devices of known
+// guitars (and optionally a few anonymous spares) on a thread of its own, and
+// guitars claim them in O(1) when their first frame arrives.
+class GamepadPool {
+public:
+    // The name of the anonymous spare gamepads
+    static const char* const SpareName;
+
+    // Starts the pool thread and keeps the given number of anonymous spares around
+    static void start(size_t spareCount);
+
+    // Stops the pool thread and destroys the unclaimed gamepads
+    static void stop();
+
+    // Creates a gamepad with the given name in the background (does nothing unless the pool is running)
+    static void prepare(const std::string& name);
+
+    // Returns the prepared gamepad with the given name (or a spare), returns NULL if there's none
+    static std::unique_ptr<Gamepad> claim(const std::string& name);
+
+private:
+    // Guards everything below
+    static std::mutex mutex;
+
+    // Signaled when gamepads are requested or the pool is stopped
+    static std::condition_variable condition;
+
+    // Whether the pool thread is running
+    static bool running;
+
+    // The number of spares to keep around
+    static size_t spares;
+
+    // The names of the gamepads waiting to be created (SpareName for spares)
+    static std::deque<std::string> requests;
+
+    // The prepared named gamepads
+    static std::unordered_map<std::string, std::unique_ptr<Gamepad>> prepared;
+
+    // The prepared spares
+    static std::vector<std::unique_ptr<Gamepad>> spareGamepads;
+
+    // The pool thread
+    static std::thread thread;
+
+    // The pool thread's main loop
+    static void run();
+};
+
+#endif // GAMEPADPOOL_H
@@ -0,0 +1,260 @@
+#include "gattlibtransport.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+
+// A gattlib connection and the handlers subscribed to it
+class GattlibLink : public TransportLink
+{
+public:
+    // Constructor
+    GattlibLink(gattlib_connection_t* connectionValue) : connection(connectionValue), subscribed(false), disconnected(false) {}
+
+    // The gattlib connection
+    gattlib_connection_t* connection;
+
+    // Whether notifications are currently enabled
+    std::atomic<bool> subscribed;
+
+    // Whether the connection has been closed
+    std::atomic<bool> disconnected;
+
+    // The subscribed characteristic
+    uuid_t characteristic;
+
+    // The notification handler
+    Transport::NotificationHandler notification;
+
+    // The connection loss handler
+    Transport::DisconnectHandler lost;
+};
+
+// A pending connection attempt
+typedef struct GattlibConnectRequest {
+    Transport::ConnectHandler handler;
+} GattlibConnectRequest;
+
+GattlibTransport::GattlibTransport(const std::string& adapterNameValue) : adapterName(adapterNameValue), name(adapterNameValue.empty() ? "bluez" : "bluez:" + adapterNameValue), adapter(NULL)
+{
+}
+
+GattlibTransport::~GattlibTransport()
+{
+    // Close the adapter
+    close();
+}
+
+const char* GattlibTransport::getName() const
+{
+    return name.c_str();
+}
+
+bool GattlibTransport::open()
+{
+    // Open the Bluetooth adapter (the default one if none was given)
+    return gattlib_adapter_open(adapterName.empty() ? NULL : adapterName.c_str(), &adapter) == GATTLIB_SUCCESS;
+}
+
+void GattlibTransport::close()
+{
+    // We've got an open adapter
+    if (adapter != NULL)
+    {
+        // Close it
+        gattlib_adapter_close(adapter);
+        adapter = NULL;
+    }
+}
+
+bool GattlibTransport::scan(DiscoveryHandler handler)
+{
+    // Scan for Bluetooth devices (blocks until the scan is disabled)
+    discoveryHandler = handler;
+    bool scanned = adapter != NULL && gattlib_adapter_scan_enable(adapter, &GattlibTransport::deviceDiscovered, 0, this) == GATTLIB_SUCCESS;
+    stopScan();
+    return scanned;
+}
+
+void GattlibTransport::stopScan()
+{
+    // We've got an open adapter
+    if (adapter != NULL)
+    {
+        // Stop scanning
+        gattlib_adapter_scan_disable(adapter);
+    }
+}
+
+bool GattlibTransport::connect(const std::string& address, ConnectHandler handler)
+{
+    // The callback takes ownership of the request
+    GattlibConnectRequest* request = new GattlibConnectRequest{ std::move(handler) };
+    if (gattlib_connect(adapter, address.c_str(), GATTLIB_CONNECTION_OPTIONS_NONE, &GattlibTransport::connected, request) != GATTLIB_SUCCESS)
+    {
+        delete request;
+        return false;
+    }
+    return true;
+}
+
+void GattlibTransport::disconnect(TransportLink* link)
+{
+    // The link has already been disconnected
+    GattlibLink* gattlibLink = (GattlibLink*)link;
+    if (gattlibLink->disconnected.exchange(true))
+    {
+        return;
+    }
+
+    // Stop the notifications first so none of them outlives the connection
+    if (gattlibLink->subscribed.exchange(false))
+    {
+        gattlib_notification_stop(gattlibLink->connection, &gattlibLink->characteristic);
+    }
+
+    // Disconnect the device
+    gattlib_disconnect(gattlibLink->connection, false);
+}
+
+void GattlibTransport::release(TransportLink* link)
+{
+    // Make sure the connection is closed and free the link
+    disconnect(link);
+    delete (GattlibLink*)link;
+}
+
+bool GattlibTransport::discover(TransportLink* link, TransportCharacteristic* characteristic)
+{
+    // Whether we've found the characteristic
+    bool found = false;
+
+    // The guitar's characteristics
+    gattlib_characteristic_t* characteristics;
+
+    // The number of characteristics
+    int characteristics_count;
+
+    // Discover the guitar's characteristics
+    if (gattlib_discover_char(((GattlibLink*)link)->connection, &characteristics, &characteristics_count) == GATTLIB_SUCCESS)
+    {
+        // Iterate the characteristics
+        for (int i = 0; i < characteristics_count && !found; i++)
+        {
+            // The characteristic's UUID
+            char uuid_str[MAX_LEN_UUID_STR + 1];
+
+            // We've found the characteristic that reports guitar data
+            if (gattlib_uuid_to_string(&characteristics[i].uuid, uuid_str, sizeof(uuid_str)) == GATTLIB_SUCCESS && strcmp(uuid_str, TRANSPORT_INPUT_CHARACTERISTIC) == 0)
+            {
+                // Return it
+                characteristic->handle = characteristics[i].handle;
+                characteristic->valueHandle = characteristics[i].value_handle;
+                characteristic->uuidType = characteristics[i].uuid.type;
+                memcpy(characteristic->uuid, &characteristics[i].uuid.value, sizeof(characteristic->uuid));
+                found = true;
+            }
+        }
+
+        // Free the characteristics
+        free(characteristics);
+    }
+
+    // Let the caller know whether we've found the characteristic
+    return found;
+}
+
+bool GattlibTransport::read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size)
+{
+    // The received value
+    void* value = NULL;
+
+    // The number of bytes received
+    size_t length = 0;
+
+    // Read the characteristic
+    uuid_t uuid = toUuid(characteristic);
+    if (gattlib_read_char_by_uuid(((GattlibLink*)link)->connection, &uuid, &value, &length) != GATTLIB_SUCCESS)
+    {
+        return false;
+    }
+
+    // Hand the value to the caller
+    bool complete = length == size;
+    if (complete)
+    {
+        memcpy(buffer, value, size);
+    }
+    gattlib_characteristic_free_value(value);
+    return complete;
+}
+
+bool GattlibTransport::subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost)
+{
+    // Remember the handlers
+    GattlibLink* gattlibLink = (GattlibLink*)link;
+    gattlibLink->notification = std::move(notification);
+    gattlibLink->lost = std::move(lost);
+    gattlibLink->characteristic = toUuid(characteristic);
+
+    // Get notified about lost connections
+    gattlib_register_on_disconnect(gattlibLink->connection, &GattlibTransport::connectionLost, gattlibLink);
+
+    // Subscribe to the characteristic's notifications
+    gattlibLink->subscribed = gattlib_register_notification(gattlibLink->connection, &GattlibTransport::notified, gattlibLink) == GATTLIB_SUCCESS && gattlib_notification_start(gattlibLink->connection, &gattlibLink->characteristic) == GATTLIB_SUCCESS;
+    return gattlibLink->subscribed;
+}
+
+void GattlibTransport::unsubscribe(TransportLink* link, const TransportCharacteristic& /*characteristic*/)
+{
+    // Unsubscribe from the characteristic's notifications
+    GattlibLink* gattlibLink = (GattlibLink*)link;
+    if (gattlibLink->subscribed.exchange(false))
+    {
+        gattlib_notification_stop(gattlibLink->connection, &gattlibLink->characteristic);
+    }
+}
+
+void GattlibTransport::deviceDiscovered(gattlib_adapter_t* /*adapter*/, const char* address, const char* name, void* user_data)
+{
+    // Forward complete advertisements
+    GattlibTransport* transport = (GattlibTransport*)user_data;
+    if (address != NULL && name != NULL)
+    {
+        transport->discoveryHandler(address, name);
+    }
+}
+
+void GattlibTransport::connected(gattlib_adapter_t* /*adapter*/, const char* /*dst*/, gattlib_connection_t* connection, int error, void* user_data)
+{
+    // Hand the connection to the caller (it might block here for the whole session)
+    GattlibConnectRequest* request = (GattlibConnectRequest*)user_data;
+    request->handler(error == GATTLIB_SUCCESS ? new GattlibLink(connection) : NULL);
+    delete request;
+}
+
+void GattlibTransport::notified(const uuid_t* /*uuid*/, const uint8_t* data, size_t data_length, void* user_data)
+{
+    // Forward the notification
+    ((GattlibLink*)user_data)->notification(data, data_length);
+}
+
+void GattlibTransport::connectionLost(gattlib_connection_t* /*connection*/, void* user_data)
+{
+    // Forward the loss of the connection
+    GattlibLink* gattlibLink = (GattlibLink*)user_data;
+    if (gattlibLink->lost)
+    {
+        gattlibLink->lost();
+    }
+}
+
+uuid_t GattlibTransport::toUuid(const TransportCharacteristic& characteristic)
+{
+    // Rebuild the gattlib UUID
+    uuid_t uuid;
+    memset(&uuid, 0, sizeof(uuid));
+    uuid.type = characteristic.uuidType;
+    memcpy(&uuid.value, characteristic.uuid, sizeof(characteristic.uuid));
+    return uuid;
+}
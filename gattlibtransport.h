@@ -0,0 +1,60 @@
+#ifndef GATTLIBTRANSPORT_H
+#define GATTLIBTRANSPORT_H
+
+#include "transport.h"
+
+#include <gattlib.h>
+
+// Talks to real guitars through gattlib and BlueZ
+class GattlibTransport : public Transport
+{
+public:
+    // Constructor (an empty adapter name picks the default adapter)
+    GattlibTransport(const std::string& adapterNameValue = "");
+
+    // Destructor
+    ~GattlibTransport();
+
+    const char* getName() const override;
+    bool open() override;
+    void close() override;
+    bool scan(DiscoveryHandler handler) override;
+    void stopScan() override;
+    bool connect(const std::string& address, ConnectHandler handler) override;
+    void disconnect(TransportLink* link) override;
+    void release(TransportLink* link) override;
+    bool discover(TransportLink* link, TransportCharacteristic* characteristic) override;
+    bool read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size) override;
+    bool subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost) override;
+    void unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic) override;
+
+private:
+    // The name of the Bluetooth adapter ("hci1", ...) or empty for the default one
+    std::string adapterName;
+
+    // The transport's name ("bluez" or "bluez:hci1", ...)
+    std::string name;
+
+    // The Bluetooth adapter
+    gattlib_adapter_t* adapter;
+
+    // The handler of the running scan
+    DiscoveryHandler discoveryHandler;
+
+    // Forwards gattlib's discovery callback
+    static void deviceDiscovered(gattlib_adapter_t* adapter, const char* address, const char* name, void* user_data);
+
+    // Forwards gattlib's connection callback
+    static void connected(gattlib_adapter_t* adapter, const char* dst, gattlib_connection_t* connection, int error, void* user_data);
+
+    // Forwards gattlib's notification callback
+    static void notified(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data);
+
+    // Forwards gattlib's disconnection callback
+    static void connectionLost(gattlib_connection_t* connection, void* user_data);
+
+    // Converts a characteristic into a gattlib UUID
+    static uuid_t toUuid(const TransportCharacteristic& characteristic);
+};
+
+#endif // GATTLIBTRANSPORT_H
@@ -1,26 +1,154 @@
 #include "guitar.h"
+#include "address.h"
+#include "devicecache.h"
+#include "gamepadpool.h"
+#include "recording.h"
+#include "connectscheduler.h"
 
-Guitar::Guitar(gattlib_adapter_t* adapterValue, const std::string& addressValue) : adapter(adapterValue), address(addressValue), is_reading(false)
+#include <algorithm>
+#include <inttypes.h>
+#include <random>
+#include <string.h>
+
+// The state of an untouched guitar
+static const GuitarData g_resting_state = { 0, 0, Direction_Centered, 0x80, 0x80, 0x80, 0x80, { 0 }, 0x80 };
+
+// Reports analog inputs as they are (for synthetic frames)
+static const AnalogConditioning g_unconditioned = { 0, 0, 0 };
+
+// The analog inputs that can wait for the rate cap
+static const uint8_t g_pending_whammy = 0x1;
+static const uint8_t g_pending_tilt = 0x2;
+
+// The delay before the first retry of a failed connection attempt
+static const std::chrono::milliseconds g_backoff_base(250);
+
+// The longest delay between two connection attempts
+static const std::chrono::milliseconds g_backoff_cap(8000);
+
+// The number of failed attempts after which absent guitars wait for advertisements (while scanning)
+static const uint32_t g_backoff_attempts = 6;
+
+// How long a connection attempt may take before it's considered failed
+static const std::chrono::seconds g_connect_timeout(20);
+
+// How long a guitar may stay silent before it's disconnected
+static const std::chrono::seconds g_watchdog_timeout(10);
+
+// The number of sessions in a row a confirmed cached characteristic may fail on a live link before it's dropped
+static const uint32_t g_stale_characteristic_limit = 3;
+
+std::atomic<bool> Guitar::scanning(false);
+Guitar::ConnectionListener Guitar::connectionListener;
+std::atomic<int> Guitar::gracePeriod(30);
+std::atomic<int64_t> Guitar::analogInterval(1000000000 / 250);
+
+Guitar::Guitar(Transport* transportValue, const std::string& addressValue, GuitarInputModes inputModeValue, Reactor* reactorValue, Emitter* emitterValue) : transport(transportValue), connection(NULL), linkLost(false), address(addressValue), packedAddress(packAddress(addressValue)), reactor(reactorValue), handledGeneration(0), stateTimer(0), connectTicket(0), connectGranted(false), connectWantedAt(LatencyStats::now()), framesSinceWatchdog(0), state(State_Connecting), stateGeneration(1), failedAttempts(0), staleCharacteristicFailures(0), pendingConnects(0), inputMode(inputModeValue), watchdog(NULL), lastMappingTable(NULL), lastMapping(), pendingAxes(0), lastAnalogReport(0), analogTimer(NULL), analogTimerScheduled(false), emitter(emitterValue), backlogged(false), lastQueued(), backlogBase(), mergedFrames(0), backlogOverflows(0), connectedAt(0), discoveryStartedAt(0), lastReceivedFrame(), released(false), releasedAt(0)
 {
-    // Create the input thread
-    thread = std::make_unique<std::thread>(&Guitar::maintainConnection, this);
+    // Have the virtual gamepad ready by the time the first frame arrives
+    GamepadPool::prepare(getGamepadName());
+
+    // Keep the virtual gamepad around for a while after the guitar drops (so games don't have to look for it again)
+    if (gracePeriod > 0)
+    {
+        graceTimer = std::make_unique<ResettableTimer>(gracePeriod, [this]() { expireGamepad(); });
+    }
+
+    // Report analog values the rate cap held back even if the guitar goes quiet
+    analogTimer = TimerService::instance().add([this]() { flushAnalogInputs(); });
+
+    // Received frames are emitted on the emitter's thread
+    if (emitter != NULL)
+    {
+        // Create the ring (and room for the frames that don't fit while the emitter is behind)
+        ring = std::make_unique<SpscRing<QueuedFrame, GUITAR_RING_CAPACITY>>();
+        backlog.reserve(4 * GUITAR_RING_CAPACITY);
+        drainedBacklog.reserve(4 * GUITAR_RING_CAPACITY);
+
+        // Let the emitter drain it
+        emitter->attach(this, [this]() { drain(); });
+    }
+
+    // The event loop maintains the connection for us
+    if (reactor != NULL)
+    {
+        // Connect right away
+        notifyState();
+    }
+
+    // We need our own input thread
+    else
+    {
+        // Create the input thread
+        thread = std::make_unique<std::thread>(&Guitar::maintainConnection, this);
+    }
+}
+
+Guitar::Guitar(const std::string& addressValue) : transport(NULL), connection(NULL), linkLost(false), address(addressValue), packedAddress(packAddress(addressValue)), reactor(NULL), handledGeneration(0), stateTimer(0), connectTicket(0), connectGranted(false), connectWantedAt(0), framesSinceWatchdog(0), state(State_Idle), stateGeneration(1), failedAttempts(0), staleCharacteristicFailures(0), pendingConnects(0), inputMode(InputMode_Poll), watchdog(NULL), lastMappingTable(NULL), lastMapping(), pendingAxes(0), lastAnalogReport(0), analogTimer(NULL), analogTimerScheduled(false), emitter(NULL), backlogged(false), lastQueued(), backlogBase(), mergedFrames(0), backlogOverflows(0), connectedAt(0), discoveryStartedAt(0), lastReceivedFrame(), released(false), releasedAt(0)
+{
+    // Report analog values the rate cap held back even if no more frames are replayed
+    analogTimer = TimerService::instance().add([this]() { flushAnalogInputs(); });
 }
 
 Guitar::~Guitar()
 {
-    // Mark the object as disposed
-    disposed = true;
+    // Mark the object as disposed (under the lock so lost connections stop posting to the event loop)
+    GuitarStates previous;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        previous = state.exchange(State_Disposed);
+        stateGeneration++;
+    }
+    stateCondition.notify_all();
+    notifyConnection(previous, State_Disposed);
 
-    // We're still connected to this guitar
-    if (connection != NULL)
+    // Take the grace and analog timers away from a session that's still releasing inputs or emitting
+    std::unique_ptr<ResettableTimer> grace;
+    TimerService::Timer* timer;
     {
-        // Disconnect the guitar
-        gattlib_disconnect(connection, false);
+        std::lock_guard<std::mutex> lock(gamepadMutex);
+        grace = std::move(graceTimer);
+        timer = analogTimer;
+        analogTimer = NULL;
+        analogTimerScheduled = false;
+    }
+
+    // Stop them outside the lock (waits for a running check or flush, which takes the lock)
+    grace.reset();
+    TimerService::instance().remove(timer);
+
+    // We're pipelined
+    if (emitter != NULL)
+    {
+        // Stop draining our ring (waits for a running drain)
+        emitter->detach(this);
+
+        // Log the queueing counters
+        GuitarPipelineStats stats = getPipelineStats();
+        printf("Guitar (%s) pipeline: %" PRIu64 " overflow(s), high-water mark %u/%u, %" PRIu64 " merged frame(s).\n", address.c_str(), stats.overflows, stats.highWaterMark, stats.capacity, stats.merged);
+    }
+
+    // The event loop drives this guitar
+    if (reactor != NULL)
+    {
+        // Drop all pending connection attempts and timers, then our connection slot (its grant can't post anymore)
+        reactor->purge(this);
+        ConnectScheduler::release(connectTicket);
 
-        // Reset the connection pointer
-        connection = NULL;
+        // Wait for the connection callbacks to return (they don't block in this engine)
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            stateCondition.wait(lock, [this]() { return pendingConnects == 0; });
+        }
+
+        // Disconnect the guitar
+        disconnect();
+        return;
     }
 
+    // Disconnect the guitar (this ends the running session)
+    disconnect();
+
     // The thread hasn't finished yet
     if (thread && thread->joinable())
     {
@@ -29,11 +157,8 @@ Guitar::~Guitar()
     }
 
     // Wait for the receiveData function to exit
-    while (is_reading)
-    {
-        // We're not in a rush to clean up
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
+    std::unique_lock<std::mutex> lock(stateMutex);
+    stateCondition.wait(lock, [this]() { return pendingConnects == 0; });
 }
 
 std::string Guitar::getAddress() const
@@ -42,308 +167,1298 @@ std::string Guitar::getAddress() const
     return address;
 }
 
+std::string Guitar::getGamepadName() const
+{
+    // Name the virtual gamepad after the guitar
+    return "Guitar (" + address + ")";
+}
+
 bool Guitar::isConnected()
 {
     // Return the connection status
     return connection != NULL;
 }
 
+GuitarStates Guitar::getState() const
+{
+    // Return the connection state
+    return state;
+}
+
+const LatencyStats& Guitar::getLatency() const
+{
+    // Return the input latency statistics
+    return latency;
+}
+
+const GuitarCounters& Guitar::getCounters() const
+{
+    // Return the throughput and health counters
+    return counters;
+}
+
+GuitarPipelineStats Guitar::getPipelineStats() const
+{
+    // Collect the counters (all zero unless we're pipelined)
+    GuitarPipelineStats stats = { 0, 0, 0, mergedFrames };
+    if (ring)
+    {
+        stats.overflows = ring->getOverflows() + backlogOverflows.load(std::memory_order_relaxed);
+        stats.highWaterMark = ring->getHighWaterMark();
+        stats.capacity = (uint32_t)ring->capacity();
+    }
+    return stats;
+}
+
+void Guitar::setScanning(bool enabled)
+{
+    // Remember whether advertisements can wake up idle guitars
+    scanning = enabled;
+}
+
+void Guitar::setGracePeriod(int seconds)
+{
+    // Remember how long virtual gamepads outlive dropped connections
+    gracePeriod = std::max(seconds, 0);
+}
+
+void Guitar::setConnectionListener(const ConnectionListener& listener)
+{
+    // Remember who to tell about connection changes
+    connectionListener = listener;
+}
+
+void Guitar::setAnalogRate(int hertz)
+{
+    // Remember how often analog changes may be reported on their own (0 = whenever they change)
+    analogInterval = hertz > 0 ? 1000000000 / hertz : 0;
+}
+
+void Guitar::reconnect()
+{
+    // Skip the rest of the backoff (or leave the idle state)
+    if (setState(State_Idle, State_Connecting) || setState(State_Backoff, State_Connecting))
+    {
+        // Start timing the connection unless an earlier attempt already did
+        int64_t unset = 0;
+        connectWantedAt.compare_exchange_strong(unset, LatencyStats::now());
+
+        // Log the reconnect
+        printf("Reconnecting Guitar (%s).\n", address.c_str());
+    }
+}
+
+void Guitar::replay(const GuitarData& data, int64_t arrival)
+{
+    // Take the same path as a received frame
+    receiveFrame(data, arrival);
+}
+
+bool Guitar::setState(GuitarStates next)
+{
+    // Change the state unless we're being disposed
+    GuitarStates current = state;
+    while (current != State_Disposed)
+    {
+        if (state.compare_exchange_weak(current, next))
+        {
+            notifyState();
+            notifyConnection(current, next);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Guitar::setState(GuitarStates expected, GuitarStates next)
+{
+    // Change the state if nobody beat us to it
+    if (state.compare_exchange_strong(expected, next))
+    {
+        notifyState();
+        notifyConnection(expected, next);
+        return true;
+    }
+    return false;
+}
+
+void Guitar::notifyState()
+{
+    // Let the waiters know something changed
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stateGeneration++;
+
+        // Let the event loop act upon the new state
+        if (reactor != NULL && state != State_Disposed)
+        {
+            reactor->post(this, [this]() { driveState(); });
+        }
+    }
+    stateCondition.notify_all();
+}
+
+void Guitar::notifyConnection(GuitarStates previous, GuitarStates next)
+{
+    // The guitar started or stopped streaming
+    if ((previous == State_Streaming) != (next == State_Streaming) && connectionListener)
+    {
+        connectionListener(address, next == State_Streaming);
+    }
+}
+
+bool Guitar::connectionFailed(GuitarStates expected)
+{
+    // Count the failed attempt
+    uint32_t attempts = failedAttempts + 1;
+
+    // The guitar seems to be gone for good, wait for it to advertise again
+    if (attempts > g_backoff_attempts && scanning)
+    {
+        connectWantedAt = 0;
+        return setState(expected, State_Idle);
+    }
+
+    // Back off exponentially (but not forever), somewhere in the upper half so guitars that failed together don't retry together
+    static thread_local std::minstd_rand random(std::random_device{}());
+    std::chrono::milliseconds delay = std::min(g_backoff_base * (1 << std::min<uint32_t>(attempts - 1, 16)), g_backoff_cap);
+    delay = delay / 2 + std::chrono::milliseconds(random() % (delay.count() / 2 + 1));
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        backoffDeadline = std::chrono::steady_clock::now() + delay;
+    }
+
+    // Nobody beat us to it
+    if (setState(expected, State_Backoff))
+    {
+        failedAttempts = attempts;
+        return true;
+    }
+    return false;
+}
+
+bool Guitar::sessionEnded()
+{
+    // The guitar was just here, try again right away
+    failedAttempts = 0;
+    if (!setState(State_Streaming, State_Connecting))
+    {
+        return false;
+    }
+    counters.add(Counter_Reconnects);
+
+    // Let it jump the queue for a connection slot and time the reconnect
+    ConnectScheduler::markSeen(packedAddress);
+    connectWantedAt = LatencyStats::now();
+
+    // Don't leave anything pressed while the guitar is gone
+    releaseInputs();
+    return true;
+}
+
+bool Guitar::connect(uint64_t ticket)
+{
+    // Start receiving data from the guitar (the destructor waits for the callback)
+    pendingConnects++;
+    if (transport->connect(address, [this, ticket](TransportLink* link) {
+        // The attempt has resolved, let the next guitar try
+        ConnectScheduler::release(ticket);
+        receiveData(link);
+    }))
+    {
+        return true;
+    }
+
+    // The callback won't come
+    ConnectScheduler::release(ticket);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        pendingConnects--;
+    }
+    stateCondition.notify_all();
+    return false;
+}
+
 void Guitar::maintainConnection()
 {
     // Maintain the guitar connection
-    while (!disposed)
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (state != State_Disposed)
     {
+        // The state we're acting upon
+        GuitarStates current = state;
+        uint32_t generation = stateGeneration;
+
         // We need to setup a new reader
-        if (!is_reading)
+        if (current == State_Connecting)
         {
-            // Start receiving data from the guitar
-            gattlib_connect(adapter, address.c_str(), GATTLIB_CONNECTION_OPTIONS_NONE, &Guitar::receiveData, this);
+            // Wait for a connection slot (or a state change, e.g. because we're being disposed)
+            connectGranted = false;
+            lock.unlock();
+            uint64_t ticket = ConnectScheduler::request(packedAddress, [this]() {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                connectGranted = true;
+                stateCondition.notify_all();
+            });
+            lock.lock();
+            stateCondition.wait(lock, [this, generation]() { return connectGranted || stateGeneration != generation; });
+
+            // We're not connecting anymore
+            if (!connectGranted || state != State_Connecting)
+            {
+                lock.unlock();
+                ConnectScheduler::release(ticket);
+                lock.lock();
+                continue;
+            }
+
+            // Start the connection attempt (receiveData moves the state on)
+            lock.unlock();
+            bool started = connect(ticket);
+            lock.lock();
+
+            // The attempt failed or didn't resolve in time
+            if (!started || !stateCondition.wait_for(lock, g_connect_timeout, [this, generation]() { return stateGeneration != generation; }))
+            {
+                lock.unlock();
+                ConnectScheduler::release(ticket);
+                connectionFailed(State_Connecting);
+                lock.lock();
+            }
         }
 
-        // Give the library a second to setup the reader
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        // We're waiting for the next connection attempt
+        else if (current == State_Backoff)
+        {
+            // Sleep until the backoff ends or someone wakes us up
+            if (!stateCondition.wait_until(lock, backoffDeadline, [this, generation]() { return stateGeneration != generation; }))
+            {
+                lock.unlock();
+                setState(State_Backoff, State_Connecting);
+                lock.lock();
+            }
+        }
+
+        // We're idle or a session is running, wait for a state change
+        else
+        {
+            stateCondition.wait(lock, [this, generation]() { return stateGeneration != generation; });
+        }
     }
 }
 
-void Guitar::receiveData(gattlib_adapter_t* adapter, const char *dst, gattlib_connection_t* connection, int error, void* user_data)
+void Guitar::driveState()
 {
-    // Cast the guitar object
-    Guitar* guitar = (Guitar*)user_data;
+    // We've already acted upon this state
+    uint32_t generation = stateGeneration;
+    if (generation == handledGeneration)
+    {
+        return;
+    }
+    handledGeneration = generation;
 
-    // Set the reading flag
-    guitar->is_reading = true;
+    // The previous state's timer and connection slot are obsolete
+    reactor->cancel(stateTimer);
+    stateTimer = 0;
+    ConnectScheduler::release(connectTicket);
+    connectTicket = 0;
 
-    // The guitar's characteristics
-    gattlib_characteristic_t* characteristics;
+    // Act upon the new state
+    switch (state)
+    {
+        case State_Connecting:
+            // Connect once we've got a connection slot (the grant may come right away)
+            connectTicket = ConnectScheduler::request(packedAddress, [this, generation]() {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (state != State_Disposed)
+                {
+                    reactor->post(this, [this, generation]() { startConnect(generation); });
+                }
+            });
+            break;
+
+        case State_Backoff:
+        {
+            // Wait for the backoff to end
+            std::chrono::steady_clock::time_point deadline;
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                deadline = backoffDeadline;
+            }
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            stateTimer = reactor->schedule(this, std::max(delay, std::chrono::milliseconds(0)), [this]() {
+                setState(State_Backoff, State_Connecting);
+            });
+            break;
+        }
 
-    // The number of characteristics
-    int characteristics_count;
+        case State_Streaming:
+            // Watch the session
+            framesSinceWatchdog = 0;
+            stateTimer = reactor->schedule(this, g_watchdog_timeout, [this]() { checkWatchdog(); });
+            break;
 
-    // Discover the guitar's characteristics
-    if (gattlib_discover_char(connection, &characteristics, &characteristics_count) == GATTLIB_SUCCESS)
+        default:
+            // Idle guitars wait for advertisements, everything else is driven by the transport's callbacks
+            break;
+    }
+}
+
+void Guitar::startConnect(uint32_t generation)
+{
+    // The state moved on while we waited for the slot (which has been released already)
+    if (generation != handledGeneration)
     {
-        // Iterate the characteristics
-        for (int i = 0; i < characteristics_count; i++)
+        return;
+    }
+
+    // Connect from a worker (starting a connection may block)
+    uint64_t ticket = connectTicket;
+    reactor->offload(this, [this, ticket]() {
+        if (state != State_Connecting)
+        {
+            ConnectScheduler::release(ticket);
+        }
+        else if (!connect(ticket))
         {
-            // The characteristic's UUID
-            char uuid_str[MAX_LEN_UUID_STR + 1];
+            connectionFailed(State_Connecting);
+        }
+    });
 
-            // We've found the characteristic that reports guitar data
-            if (gattlib_uuid_to_string(&characteristics[i].uuid, uuid_str, sizeof(uuid_str)) == GATTLIB_SUCCESS && strcmp(uuid_str, "533e1524-3abe-f33f-cd00-594e8b0a8ea3") == 0)
+    // Give up if the attempt doesn't resolve in time
+    stateTimer = reactor->schedule(this, g_connect_timeout, [this, ticket]() {
+        ConnectScheduler::release(ticket);
+        connectionFailed(State_Connecting);
+    });
+}
+
+void Guitar::sessionStarted()
+{
+    // Time the discovery
+    int64_t now = LatencyStats::now();
+    counters.add(Counter_Discoveries);
+    counters.add(Counter_DiscoveryTime, now - discoveryStartedAt);
+
+    // And the whole way from wanting a connection to streaming
+    int64_t wanted = connectWantedAt.exchange(0);
+    if (wanted != 0)
+    {
+        latency.record(Latency_Connect, now - wanted);
+    }
+}
+
+void Guitar::receiveData(TransportLink* link)
+{
+    // We've connected and are looking for the input characteristic
+    if (link != NULL && setState(State_Connecting, State_Discovering))
+    {
+        // Keep track of the connection object so the guitar can be disconnected from the destructor (the attempt is still ours)
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            connection = link;
+            linkLost = false;
+            connectedAt = LatencyStats::now();
+            discoveryStartedAt = connectedAt;
+        }
+
+        // The event loop drives this guitar
+        if (reactor != NULL)
+        {
+            // Start streaming on the event loop (so only its thread ever frees the link)
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (state != State_Disposed)
             {
-                // The received guitar input data
-                GuitarData* receivedData = NULL;
+                reactor->post(this, [this, link]() { startStreaming(link); });
+            }
+        }
 
-                // The number of bytes received
-                size_t numberOfBytesReceived = 0;
+        // We've got a thread to block
+        else
+        {
+            // The characteristic that reports guitar data
+            TransportCharacteristic characteristic;
+
+            // Whether the characteristic came from the device cache
+            bool cached = false;
 
-                // Keep track of the connection object so the guitar can be disconnected from the destructor
-                guitar->connection = connection;
+            // We've found the characteristic that reports guitar data
+            if (findInputCharacteristic(link, &characteristic, &cached) && setState(State_Discovering, State_Streaming))
+            {
+                // Count and time the session
+                sessionStarted();
 
                 // Define the timeout callback
-                ResettableTimer disconnectTimer(10, [&]() {
-                    // The guitar hasn't been disconnected yet
-                    if (guitar->connection != NULL)
+                ResettableTimer disconnectTimer(g_watchdog_timeout.count(), [this]() {
+                    // Disconnect the guitar (the timer keeps firing until the session is over)
+                    if (disconnect())
                     {
-                        // Disconnect the guitar
-                        gattlib_disconnect(guitar->connection, false);
-
-                        // Reset the connection pointer
-                        guitar->connection = NULL;
+                        counters.add(Counter_WatchdogExpiries);
                     }
                 });
 
-                // The guitar is still connected
-                if (guitar->connection != NULL)
-                {
-                    // Log the newly connected guitar
-                    printf("Connected Guitar (%s).\n", guitar->address.c_str());
+                // Log the newly connected guitar
+                printf("Connected Guitar (%s).\n", address.c_str());
 
-                    // Keep receiving guitar input data
-                    while (gattlib_read_char_by_uuid(guitar->connection, &characteristics[i].uuid, (void **)&receivedData, &numberOfBytesReceived) == GATTLIB_SUCCESS && numberOfBytesReceived == sizeof(GuitarData))
-                    {
-                        // Update the guitar's input state
-                        guitar->update(*receivedData);
+                // Whether the characteristic could be used
+                bool streamed;
 
-                        // Free the guitar input data
-                        gattlib_characteristic_free_value(receivedData);
+                // The guitar pushes its input data to us
+                if (inputMode == InputMode_Notify)
+                {
+                    // Receive guitar input data notifications
+                    streamed = subscribeData(link, characteristic, disconnectTimer);
+                }
 
-                        // Buy the guitar another 10 seconds of time
-                        disconnectTimer.reset();
-                    }
+                // We need to ask the guitar for its input data
+                else
+                {
+                    // Keep reading guitar input data
+                    streamed = pollData(link, characteristic, disconnectTimer);
+                }
 
-                    // Log the now disconnected guitar
-                    printf("Disconnected Guitar (%s).\n", guitar->address.c_str());
+                // The cached characteristic didn't work, check it against the guitar (the next connection picks up a changed one)
+                if (!streamed && cached && state != State_Disposed)
+                {
+                    revalidateInputCharacteristic(link, &characteristic);
+                }
+
+                // The characteristic is fine
+                else if (streamed)
+                {
+                    staleCharacteristicFailures = 0;
                 }
 
-                // No need to iterate the other characteristics
-                break;
+                // Log the now disconnected guitar
+                printf("Disconnected Guitar (%s).\n", address.c_str());
+
+                // Disconnect the guitar and reconnect right away
+                disconnect();
+                sessionEnded();
+            }
+
+            // The guitar isn't usable
+            else
+            {
+                // Disconnect the guitar and back off
+                disconnect();
+                connectionFailed(State_Discovering);
             }
         }
+    }
+
+    // The connection attempt failed (or timed out already)
+    else
+    {
+        // Disconnect the late link on its own (the guitar's connection may belong to a newer attempt by now)
+        if (link != NULL)
+        {
+            std::lock_guard<std::mutex> lock(linkMutex);
+            transport->disconnect(link);
 
-        // Free the characteristics
-        free(characteristics);
+            // The event loop is done with it (the thread engine frees it below)
+            if (reactor != NULL)
+            {
+                transport->release(link);
+            }
+        }
+
+        // Back off unless the timeout already did
+        connectionFailed(State_Connecting);
     }
 
-    // The guitar hasn't been disconnected yet
-    if (guitar->connection != NULL)
+    // The session is over, free the link (the reactor engine frees it when it disconnects)
+    if (link != NULL && reactor == NULL)
     {
-        // Disconnect the guitar
-        gattlib_disconnect(guitar->connection, false);
+        std::lock_guard<std::mutex> lock(linkMutex);
+        transport->release(link);
+    }
 
-        // Reset the connection pointer
-        guitar->connection = NULL;
+    // Let the destructor know we're done (notify under the lock, the guitar may be gone once it's released)
+    std::lock_guard<std::mutex> lock(stateMutex);
+    pendingConnects--;
+    stateCondition.notify_all();
+}
+
+bool Guitar::findInputCharacteristic(TransportLink* link, TransportCharacteristic* characteristic, bool* cached)
+{
+    // We already know the characteristic from an earlier connection
+    DeviceCacheEntry entry;
+    if (DeviceCache::lookup(packedAddress, &entry))
+    {
+        // Skip the discovery
+        characteristic->handle = entry.handle;
+        characteristic->valueHandle = entry.valueHandle;
+        characteristic->uuidType = entry.uuidType;
+        memcpy(characteristic->uuid, entry.uuid, sizeof(characteristic->uuid));
+        *cached = true;
+        return true;
     }
+    *cached = false;
 
-    // Reset the reading flag
-    guitar->is_reading = false;
+    // Discover the guitar's characteristics
+    if (!transport->discover(link, characteristic))
+    {
+        return false;
+    }
+
+    // Remember the characteristic for the next connection
+    rememberInputCharacteristic(*characteristic);
+    return true;
 }
 
-void Guitar::update(const GuitarData& data)
+void Guitar::rememberInputCharacteristic(const TransportCharacteristic& characteristic)
 {
-    // The virtual gamepad hasn't been created yet'
-    if (!gamepad)
+    DeviceCacheEntry entry = {};
+    entry.address = packedAddress;
+    entry.handle = characteristic.handle;
+    entry.valueHandle = characteristic.valueHandle;
+    entry.uuidType = characteristic.uuidType;
+    memcpy(entry.uuid, characteristic.uuid, sizeof(entry.uuid));
+    snprintf(entry.profile, sizeof(entry.profile), "%s", Profiles::name(packedAddress).c_str());
+    entry.lastSeen = (uint64_t)time(NULL);
+    DeviceCache::store(entry);
+}
+
+bool Guitar::revalidateInputCharacteristic(TransportLink* link, TransportCharacteristic* characteristic)
+{
+    // The link is gone (e.g. the guitar was switched off right after connecting), that says nothing about the cached characteristic
+    TransportCharacteristic discovered;
+    if (!transport->discover(link, &discovered))
     {
-        // Create a new virtual gamepad for this guitar
-        gamepad = std::make_unique<Gamepad>("Guitar (" + address + ")");
+        return false;
+    }
 
-        // Use the first frame as a baseline
-        lastInputState = data;
+    // The guitar has a different characteristic now, replace the cached one
+    if (discovered.handle != characteristic->handle || discovered.valueHandle != characteristic->valueHandle || discovered.uuidType != characteristic->uuidType || memcmp(discovered.uuid, characteristic->uuid, sizeof(discovered.uuid)) != 0)
+    {
+        printf("Updating the cached characteristic of Guitar (%s).\n", address.c_str());
+        rememberInputCharacteristic(discovered);
+        *characteristic = discovered;
+        staleCharacteristicFailures = 0;
+        return true;
     }
 
-    // The virtual gamepad exists
-    if (gamepad)
+    // The characteristic is right, but keeps failing on a live link (drop it so the next connection starts from scratch)
+    if (++staleCharacteristicFailures >= g_stale_characteristic_limit)
     {
-        // The input event
-        struct input_event ev;
+        printf("Discarding the cached characteristic of Guitar (%s).\n", address.c_str());
+        DeviceCache::forget(packedAddress);
+        staleCharacteristicFailures = 0;
+    }
+    return false;
+}
 
-        // W1 -> X
-        if ((lastInputState.frets & Fret_W1) != (data.frets & Fret_W1))
+void Guitar::startStreaming(TransportLink* link)
+{
+    // Whether the characteristic came from the device cache
+    bool cached = false;
+
+    // The handlers of the notification session
+    auto notification = [this](const uint8_t* data, size_t length) { receiveNotification(data, length); };
+    auto lost = [this]() { connectionLost(); };
+
+    // We've found the characteristic that reports guitar data
+    if (connection == link && findInputCharacteristic(link, &inputCharacteristic, &cached))
+    {
+        // Subscribe to the guitar's input data notifications
+        bool subscribed = transport->subscribe(link, inputCharacteristic, notification, lost);
+
+        // The cached characteristic didn't work, try again on this connection if the guitar has a different one now
+        if (!subscribed && cached && revalidateInputCharacteristic(link, &inputCharacteristic))
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_X;
-            ev.value = data.frets & Fret_W1 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("W1 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            subscribed = transport->subscribe(link, inputCharacteristic, notification, lost);
         }
 
-        // W2 -> BTN_TL (aka. L1)
-        if ((lastInputState.frets & Fret_W2) != (data.frets & Fret_W2))
+        // We're streaming now
+        if (subscribed && setState(State_Discovering, State_Streaming))
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_TL;
-            ev.value = data.frets & Fret_W2 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("W2 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            // The characteristic is fine
+            staleCharacteristicFailures = 0;
+
+            // Count and time the session
+            sessionStarted();
+
+            // Log the newly connected guitar
+            printf("Connected Guitar (%s).\n", address.c_str());
+            return;
         }
+    }
+
+    // Disconnect the guitar and back off
+    disconnect();
+    connectionFailed(State_Discovering);
+}
+
+void Guitar::checkWatchdog()
+{
+    // The guitar went silent
+    if (framesSinceWatchdog.exchange(0) == 0)
+    {
+        // Disconnect the guitar and reconnect right away
+        if (sessionEnded())
+        {
+            counters.add(Counter_WatchdogExpiries);
+            printf("Disconnected Guitar (%s).\n", address.c_str());
+            disconnect();
+        }
+    }
+
+    // The guitar is alive
+    else
+    {
+        // Check again later
+        stateTimer = reactor->schedule(this, g_watchdog_timeout, [this]() { checkWatchdog(); });
+    }
+}
+
+bool Guitar::pollData(TransportLink* link, const TransportCharacteristic& characteristic, ResettableTimer& disconnectTimer)
+{
+    // The received guitar input data
+    GuitarData receivedData;
+
+    // Whether we've read at least one frame
+    bool streamed = false;
+
+    // When the current read was requested
+    int64_t requested = LatencyStats::now();
+
+    // Keep receiving guitar input data
+    while (transport->read(link, characteristic, &receivedData, sizeof(receivedData)))
+    {
+        // Time the read
+        int64_t arrival = LatencyStats::now();
+        latency.record(Latency_Read, arrival - requested);
+
+        // Update the guitar's input state
+        receiveFrame(receivedData, arrival);
+
+        // Buy the guitar another 10 seconds of time
+        disconnectTimer.reset();
+        streamed = true;
+
+        // Request the next frame
+        requested = LatencyStats::now();
+    }
+
+    // Let the caller know whether the characteristic worked
+    return streamed;
+}
+
+bool Guitar::subscribeData(TransportLink* link, const TransportCharacteristic& characteristic, ResettableTimer& disconnectTimer)
+{
+    // Let the notification handler buy the guitar more time
+    {
+        std::lock_guard<std::mutex> lock(watchdogMutex);
+        watchdog = &disconnectTimer;
+    }
+
+    // Subscribe to the guitar's input data notifications (and get notified about lost connections)
+    bool subscribed = transport->subscribe(link, characteristic, [this](const uint8_t* data, size_t length) { receiveNotification(data, length); }, [this]() { connectionLost(); });
+    if (subscribed)
+    {
+        // Wait for the connection to be lost (the timer disconnects silent guitars)
+        std::unique_lock<std::mutex> lock(stateMutex);
+        stateCondition.wait(lock, [this]() { return linkLost || connection == NULL || state == State_Disposed; });
+        lock.unlock();
+
+        // Unsubscribe from the guitar's input data notifications (fails harmlessly if the link is already gone)
+        transport->unsubscribe(link, characteristic);
+    }
+
+    // The timer is about to go out of scope (waits for a notification that's still resetting it)
+    {
+        std::lock_guard<std::mutex> lock(watchdogMutex);
+        watchdog = NULL;
+    }
+
+    // Let the caller know whether the characteristic worked
+    return subscribed;
+}
+
+void Guitar::receiveNotification(const uint8_t* data, size_t length)
+{
+    // We've received a complete input frame
+    if (length == sizeof(GuitarData))
+    {
+        // Update the guitar's input state
+        receiveFrame(*(const GuitarData*)data, LatencyStats::now());
+
+        // Keep the event loop's watchdog happy
+        framesSinceWatchdog.fetch_add(1, std::memory_order_relaxed);
+
+        // The notification session is still active (the lock is uncontended unless the session is ending)
+        std::lock_guard<std::mutex> lock(watchdogMutex);
+        if (watchdog != NULL)
+        {
+            // Buy the guitar another 10 seconds of time
+            watchdog->reset();
+        }
+    }
+}
+
+void Guitar::connectionLost()
+{
+    // Wake up the notification session
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        linkLost = true;
+
+        // Free the link on the event loop (queued ahead of the reconnect, which can't be posted before the state changes)
+        if (reactor != NULL && state == State_Streaming)
+        {
+            reactor->post(this, [this]() { disconnect(); });
+        }
+    }
+    stateCondition.notify_all();
+
+    // The event loop drives this guitar
+    if (reactor != NULL && sessionEnded())
+    {
+        // Log the now disconnected guitar
+        printf("Disconnected Guitar (%s).\n", address.c_str());
+    }
+}
+
+bool Guitar::disconnect()
+{
+    // Take the connection (so only one caller disconnects it)
+    std::unique_lock<std::mutex> linkLock(linkMutex);
+    TransportLink* current = connection.exchange(NULL);
+
+    // The guitar hasn't been disconnected yet
+    if (current != NULL)
+    {
+        // Disconnect the guitar
+        transport->disconnect(current);
 
-        // W3 -> BTN_TR (aka. R1)
-        if ((lastInputState.frets & Fret_W3) != (data.frets & Fret_W3))
+        // The event loop is done with the link (the thread engine frees it when its session is over)
+        if (reactor != NULL)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_TR;
-            ev.value = data.frets & Fret_W3 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("W3 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            transport->release(current);
         }
+        linkLock.unlock();
 
-        // B1 -> A
-        if ((lastInputState.frets & Fret_B1) != (data.frets & Fret_B1))
+        // Wake up the notification session
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_A;
-            ev.value = data.frets & Fret_B1 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("B1 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            std::lock_guard<std::mutex> lock(stateMutex);
         }
+        stateCondition.notify_all();
+        return true;
+    }
+    return false;
+}
+
+// Returns whether two frames have the same buttons, frets, directional pad and strum bar
+static inline bool same_digital_state(const GuitarData& a, const GuitarData& b)
+{
+    return a.frets == b.frets && a.buttons == b.buttons && a.directionalPad == b.directionalPad && a.strum == b.strum;
+}
 
-        // B2 -> B
-        if ((lastInputState.frets & Fret_B2) != (data.frets & Fret_B2))
+void Guitar::receiveFrame(const GuitarData& data, int64_t arrival)
+{
+    // Record the raw frame (if we've been asked to)
+    Recorder::record(packedAddress, arrival, data);
+
+    // Track the frame interval
+    latency.recordArrival(arrival);
+
+    // Count the frame (guitars keep sending the same frame while nothing moves)
+    counters.add(Counter_FramesReceived);
+    if (memcmp(&lastReceivedFrame, &data, sizeof(data)) == 0)
+    {
+        counters.add(Counter_FramesRepeated);
+    }
+    lastReceivedFrame = data;
+
+    // Hand the frame to the emitter
+    if (ring)
+    {
+        enqueue(data, arrival);
+    }
+
+    // Emit it ourselves
+    else
+    {
+        std::lock_guard<std::mutex> lock(gamepadMutex);
+        update(data, arrival);
+    }
+}
+
+void Guitar::enqueue(const GuitarData& data, int64_t arrival)
+{
+    // The ring has room and no older frames are held back
+    QueuedFrame frame = { data, arrival };
+    if (!backlogged.load(std::memory_order_acquire) && ring->push(frame))
+    {
+        lastQueued = data;
+        emitter->wake();
+        return;
+    }
+
+    // Hold on to the frame until the emitter catches up
+    {
+        std::lock_guard<std::mutex> lock(backlogMutex);
+        appendBacklog(frame);
+        backlogged.store(true, std::memory_order_release);
+        lastQueued = data;
+    }
+
+    // Let the emitter know (it picks up the backlog even if no other frame comes along)
+    emitter->wake();
+}
+
+void Guitar::appendBacklog(const QueuedFrame& frame)
+{
+    // The backlog starts right after the last frame that went through the ring
+    if (backlog.empty())
+    {
+        backlogBase = lastQueued;
+        backlog.push_back(frame);
+        return;
+    }
+
+    // Fold the frame into the last held one if the buttons didn't change (the latest axes win)
+    if (same_digital_state(backlog.back().data, frame.data))
+    {
+        backlog.back() = frame;
+        mergedFrames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // The backlog is full, drop its oldest frame if it only moved the axes (every other frame carries a button change)
+    if (backlog.size() == backlog.capacity())
+    {
+        if (same_digital_state(backlogBase, backlog.front().data))
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_B;
-            ev.value = data.frets & Fret_B2 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("B2 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            backlog.erase(backlog.begin());
+            mergedFrames.fetch_add(1, std::memory_order_relaxed);
         }
 
-        // B3 -> Y
-        if ((lastInputState.frets & Fret_B3) != (data.frets & Fret_B3))
+        // There's no room without losing a button change, drop the last held one (so the latest buttons still win)
+        else
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_Y;
-            ev.value = data.frets & Fret_B3 ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("B3 %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            backlog.pop_back();
+            backlogOverflows.fetch_add(1, std::memory_order_relaxed);
+
+            // The frame undoes the dropped change, fold it into the one before
+            if (!backlog.empty() && same_digital_state(backlog.back().data, frame.data))
+            {
+                backlog.back() = frame;
+                return;
+            }
         }
+    }
+
+    // Hold on to the frame
+    backlog.push_back(frame);
+}
+
+void Guitar::drain()
+{
+    std::lock_guard<std::mutex> lock(gamepadMutex);
 
-        // Pause -> BTN_START
-        if ((lastInputState.buttons & Button_Pause) != (data.buttons & Button_Pause))
+    // Fold frames into the next one unless the buttons changed in between (the latest axes win, edges are kept)
+    QueuedFrame current;
+    bool holding = false;
+    auto take = [this, &current, &holding](const QueuedFrame& next) {
+        // Write all reports of this pass at once
+        if (!holding)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_START;
-            ev.value = data.buttons & Button_Pause ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("Pause %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            if (gamepad)
+            {
+                gamepad->beginBatch();
+            }
+            holding = true;
+        }
+        else if (same_digital_state(current.data, next.data))
+        {
+            mergedFrames.fetch_add(1, std::memory_order_relaxed);
         }
+        else
+        {
+            latency.record(Latency_Queue, LatencyStats::now() - current.arrival);
+            update(current.data, current.arrival);
+        }
+        current = next;
+    };
+    QueuedFrame next;
+    while (ring->pop(&next))
+    {
+        take(next);
+    }
 
-        // HeroPower -> BTN_SELECT
-        if ((lastInputState.buttons & Button_HeroPower) != (data.buttons & Button_HeroPower))
+    // Frames that didn't fit are waiting behind the ring
+    if (backlogged.load(std::memory_order_acquire))
+    {
+        // Take them over (the receive path can't push while we hold the lock, so what's left in the ring is older)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_SELECT;
-            ev.value = data.buttons & Button_HeroPower ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("HeroPower %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            std::lock_guard<std::mutex> backlogLock(backlogMutex);
+            while (ring->pop(&next))
+            {
+                take(next);
+            }
+            drainedBacklog.swap(backlog);
+            backlogged.store(false, std::memory_order_release);
         }
+        for (const QueuedFrame& frame : drainedBacklog)
+        {
+            take(frame);
+        }
+        drainedBacklog.clear();
+    }
+
+    // There's nothing to emit
+    if (!holding)
+    {
+        return;
+    }
+    latency.record(Latency_Queue, LatencyStats::now() - current.arrival);
+    update(current.data, current.arrival);
+
+    // Write the batch
+    if (gamepad && !gamepad->endBatch())
+    {
+        counters.add(Counter_WriteErrors);
+    }
+}
+
+void Guitar::appendAnalogInputs(const MappingTable& mapping, int64_t now)
+{
+    // Whammy -> Right Analog Y (by default)
+    if ((pendingAxes & g_pending_whammy) != 0)
+    {
+        int32_t whammy = analogAxisValue(mapping.whammyAxis, whammyInput.value);
+        // printf("Whammy %d\n", whammy);
+        gamepad->append(EV_ABS, mapping.whammyAxis, whammy);
+    }
+
+    // Tilt -> Right Analog X (by default)
+    if ((pendingAxes & g_pending_tilt) != 0)
+    {
+        int32_t tilt = analogAxisValue(mapping.tiltAxis, tiltInput.value);
+        // printf("Tilt %d\n", tilt);
+        gamepad->append(EV_ABS, mapping.tiltAxis, tilt);
+    }
+    pendingAxes = 0;
+    lastAnalogReport = now;
 
-        // GHTV -> BTN_THUMBL
-        if ((lastInputState.buttons & Button_GHTV) != (data.buttons & Button_GHTV))
+    // Nothing is held back anymore
+    if (analogTimerScheduled)
+    {
+        TimerService::disarm(analogTimer);
+        analogTimerScheduled = false;
+    }
+}
+
+void Guitar::switchMapping(const MappingTable& mapping)
+{
+    // The last frame was emitted with this table (or nothing has been emitted yet)
+    if (&mapping == lastMappingTable)
+    {
+        return;
+    }
+    if (lastMappingTable == NULL)
+    {
+        lastMappingTable = &mapping;
+        lastMapping = mapping;
+        return;
+    }
+    const MappingTable& previous = lastMapping;
+
+    // Release the keys only the previous table holds, press the ones only the new table holds (keys both hold stay pressed)
+    uint16_t held = packDigitalInput(lastInputState.frets, lastInputState.buttons);
+    uint16_t heldBefore = held & previous.buttons.mask;
+    uint16_t heldAfter = held & mapping.buttons.mask;
+    auto holds = [](const ButtonLookupTable& table, uint16_t bits, uint16_t code) {
+        for (; bits != 0; bits &= bits - 1)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            ev.code = BTN_THUMBL;
-            ev.value = data.buttons & Button_GHTV ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("GHTV %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            if (table.codes[__builtin_ctz(bits)] == code)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (uint16_t bits = heldBefore; bits != 0; bits &= bits - 1)
+    {
+        uint16_t code = previous.buttons.codes[__builtin_ctz(bits)];
+        if (!holds(mapping.buttons, heldAfter, code))
+        {
+            gamepad->append(EV_KEY, code, BTN_RELEASED);
         }
+    }
+    for (uint16_t bits = heldAfter; bits != 0; bits &= bits - 1)
+    {
+        uint16_t code = mapping.buttons.codes[__builtin_ctz(bits)];
+        if (!holds(previous.buttons, heldBefore, code))
+        {
+            gamepad->append(EV_KEY, code, BTN_PRESSED);
+        }
+    }
+
+    // Center the axes the previous table drove and the new one doesn't (before any new value goes out, the tables may trade axes)
+    bool strumMoved = previous.strumAxis != mapping.strumAxis || previous.strumUp != mapping.strumUp || previous.strumDown != mapping.strumDown;
+    bool strumming = lastInputState.strum == 0xff || lastInputState.strum == 0;
+    if (strumMoved && strumming && previous.strumAxis != MAPPING_UNMAPPED)
+    {
+        gamepad->append(EV_ABS, previous.strumAxis, 0);
+    }
+    if (previous.whammyAxis != mapping.whammyAxis && previous.whammyAxis != MAPPING_UNMAPPED)
+    {
+        gamepad->append(EV_ABS, previous.whammyAxis, analogAxisValue(previous.whammyAxis, g_resting_state.whammy));
+    }
+    if (previous.tiltAxis != mapping.tiltAxis && previous.tiltAxis != MAPPING_UNMAPPED)
+    {
+        gamepad->append(EV_ABS, previous.tiltAxis, analogAxisValue(previous.tiltAxis, g_resting_state.tilt));
+    }
+
+    // Report the strum bar on its new axis, the analog inputs' latest values go out on theirs along with this frame
+    if (strumMoved && mapping.strumAxis != MAPPING_UNMAPPED)
+    {
+        gamepad->append(EV_ABS, mapping.strumAxis, lastInputState.strum == 0xff ? mapping.strumUp : lastInputState.strum == 0 ? mapping.strumDown : 0);
+    }
+    if (previous.whammyAxis != mapping.whammyAxis)
+    {
+        pendingAxes = mapping.whammyAxis != MAPPING_UNMAPPED ? pendingAxes | g_pending_whammy : pendingAxes & ~g_pending_whammy;
+    }
+    if (previous.tiltAxis != mapping.tiltAxis)
+    {
+        pendingAxes = mapping.tiltAxis != MAPPING_UNMAPPED ? pendingAxes | g_pending_tilt : pendingAxes & ~g_pending_tilt;
+    }
+
+    // Diff the following frames against the new table
+    lastMappingTable = &mapping;
+    lastMapping = mapping;
+}
+
+void Guitar::flushAnalogInputs()
+{
+    std::lock_guard<std::mutex> lock(gamepadMutex);
+    analogTimerScheduled = false;
+
+    // A frame has carried the values in the meantime (or the virtual gamepad is gone)
+    if (pendingAxes == 0 || !gamepad || analogTimer == NULL)
+    {
+        return;
+    }
+
+    // The values went out recently after all, try again once the cap allows it
+    int64_t now = LatencyStats::now();
+    int64_t interval = analogInterval.load(std::memory_order_relaxed);
+    if (now - lastAnalogReport < interval)
+    {
+        TimerService::instance().schedule(analogTimer, std::chrono::nanoseconds(lastAnalogReport + interval - now));
+        analogTimerScheduled = true;
+        return;
+    }
+
+    // Report the values on their own (on the table's axes, even if the profiles were reloaded since the last frame)
+    Epoch::Guard guard;
+    const MappingTable& mapping = Profiles::lookup(packedAddress);
+    gamepad->beginFrame();
+    switchMapping(mapping);
+    appendAnalogInputs(mapping, now);
+    size_t events = gamepad->getFrameEventCount();
+    bool written = gamepad->commit();
+
+    // Count the report
+    counters.add(Counter_EventsEmitted, events);
+    counters.add(Counter_SynReports);
+    if (!written)
+    {
+        counters.add(Counter_WriteErrors);
+    }
+}
+
+void Guitar::releaseInputs()
+{
+    std::lock_guard<std::mutex> lock(gamepadMutex);
+
+    // Frames of the dropped session that are still on their way are stale
+    releasedAt = LatencyStats::now();
+
+    // Nothing has been emitted yet
+    if (!gamepad)
+    {
+        return;
+    }
+
+    // Report the resting state (the first frame of the next session is diffed against it)
+    update(g_resting_state, 0);
+    released = true;
+
+    // Nobody wants to keep the gamepad around
+    if (gracePeriod <= 0)
+    {
+        gamepad.reset();
+        released = false;
+    }
+
+    // Keep it until the grace period is over
+    else if (graceTimer)
+    {
+        graceTimer->reset();
+    }
+}
 
-        // Sync -> BTN_MODE
-        if ((lastInputState.buttons & Button_Sync) != (data.buttons & Button_Sync))
+void Guitar::expireGamepad()
+{
+    std::lock_guard<std::mutex> lock(gamepadMutex);
+
+    // The guitar came back (or hasn't left)
+    if (!released || LatencyStats::now() - releasedAt < (int64_t)gracePeriod * 1000000000)
+    {
+        return;
+    }
+
+    // Remove the virtual gamepad
+    gamepad.reset();
+    released = false;
+    printf("Removed the virtual gamepad of Guitar (%s).\n", address.c_str());
+}
+
+void Guitar::update(const GuitarData& data, int64_t arrival)
+{
+    // The frame belongs to a session that has ended since (its inputs have already been released)
+    if (arrival != 0 && arrival <= releasedAt)
+    {
+        return;
+    }
+
+    // The virtual gamepad hasn't been created yet'
+    if (!gamepad)
+    {
+        // Claim the virtual gamepad the pool has prepared for this guitar, create one if there's none
+        gamepad = GamepadPool::claim(getGamepadName());
+        if (!gamepad)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_KEY;
-            //ev.code = BTN_MODE;
-            ev.code = BTN_A;
-            ev.value = data.buttons & Button_Sync ? BTN_PRESSED : BTN_RELEASED;
-            gamepad->update(&ev);
-            // printf("Sync %s\n", ev.value == BTN_PRESSED ? "pressed" : "released");
+            gamepad = std::make_unique<Gamepad>(getGamepadName());
         }
 
+        // Start from the resting state so whatever is held during the first frame gets reported
+        lastInputState = g_resting_state;
+        lastMappingTable = NULL;
+        whammyInput = { g_resting_state.whammy << 8, g_resting_state.whammy };
+        tiltInput = { g_resting_state.tilt << 8, g_resting_state.tilt };
+        pendingAxes = 0;
+    }
+
+    // The virtual gamepad exists
+    if (gamepad)
+    {
+        // Pin the active profiles for the duration of this frame
+        Epoch::Guard guard;
+        const MappingTable& mapping = Profiles::lookup(packedAddress);
+
+        // Collect all changes of this frame into a single report
+        gamepad->beginFrame();
+
+        // The profiles were reloaded, let go of what the previous table is holding first
+        switchMapping(mapping);
+
+        // Frets and buttons
+        mapButtons(mapping.buttons, packDigitalInput(lastInputState.frets, lastInputState.buttons), packDigitalInput(data.frets, data.buttons), [this](uint16_t code, int32_t value) {
+            gamepad->append(EV_KEY, code, value);
+            // printf("Key %d %s\n", code, value == BTN_PRESSED ? "pressed" : "released");
+        });
+
         // The directional pad
         if (lastInputState.directionalPad != data.directionalPad)
         {
-            int dpadX = (data.directionalPad == Direction_SouthEast || data.directionalPad == Direction_East || data.directionalPad == Direction_NorthEast) ? DPAD_VALUE_MAX : (data.directionalPad == Direction_SouthWest || data.directionalPad == Direction_West || data.directionalPad == Direction_NorthWest) ? DPAD_VALUE_MIN : 0;
-            int dpadY = (data.directionalPad == Direction_SouthEast || data.directionalPad == Direction_South || data.directionalPad == Direction_SouthWest) ? DPAD_VALUE_MIN : (data.directionalPad == Direction_NorthEast || data.directionalPad == Direction_North || data.directionalPad == Direction_NorthWest) ? DPAD_VALUE_MAX : 0;
+            const DirectionalPadValue& dpad = directionalPadValue(data.directionalPad);
+            gamepad->append(EV_ABS, AXIS_DPAD_HORIZONTAL, dpad.x);
+            gamepad->append(EV_ABS, AXIS_DPAD_VERTICAL, dpad.y);
+            // printf("Dpad %d/%d\n", dpad.x, dpad.y);
+        }
+
+        // Strum -> Dpad Y (by default)
+        if (lastInputState.strum != data.strum && mapping.strumAxis != MAPPING_UNMAPPED)
+        {
+            int32_t strum = data.strum == 0xff ? mapping.strumUp : data.strum == 0 ? mapping.strumDown : 0;
+            // printf("Strum %d\n", strum);
+            gamepad->append(EV_ABS, mapping.strumAxis, strum);
+        }
 
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_ABS;
-            ev.code = AXIS_DPAD_HORIZONTAL;
-            ev.value = dpadX;
-            gamepad->update(&ev);
+        // Filter the analog inputs' jitter (synthetic frames are reported as they are)
+        if (conditionAnalogInput(arrival != 0 ? mapping.whammyConditioning : g_unconditioned, g_resting_state.whammy, whammyInput, data.whammy) && mapping.whammyAxis != MAPPING_UNMAPPED)
+        {
+            pendingAxes |= g_pending_whammy;
+        }
+        if (conditionAnalogInput(arrival != 0 ? mapping.tiltConditioning : g_unconditioned, g_resting_state.tilt, tiltInput, data.tilt) && mapping.tiltAxis != MAPPING_UNMAPPED)
+        {
+            pendingAxes |= g_pending_tilt;
+        }
 
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_ABS;
-            ev.code = AXIS_DPAD_VERTICAL;
-            ev.value = dpadY;
-            gamepad->update(&ev);
+        // Report the latest analog values along with digital changes, on their own only as often as the rate cap allows
+        int64_t interval = analogInterval.load(std::memory_order_relaxed);
+        if (pendingAxes != 0 && (!gamepad->isFrameEmpty() || arrival == 0 || arrival - lastAnalogReport >= interval))
+        {
+            appendAnalogInputs(mapping, arrival);
+        }
 
-            // printf("Dpad %d/%d\n", dpadX, dpadY);
+        // Report the held back values once the cap allows it, in case no frame comes along to carry them
+        else if (pendingAxes != 0 && !analogTimerScheduled && analogTimer != NULL)
+        {
+            TimerService::instance().schedule(analogTimer, std::chrono::nanoseconds(lastAnalogReport + interval - arrival));
+            analogTimerScheduled = true;
         }
 
-        // Whammy -> Right Analog Y
-        if (lastInputState.whammy != data.whammy)
+        // Emit the frame as a single report (if anything changed)
+        if (!gamepad->isFrameEmpty())
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_ABS;
-            ev.code = AXIS_RIGHT_ANALOG_VERTICAL;
-            ev.value = (short)((data.whammy * 0x101) - ANALOG_VALUE_MAX);
-            // printf("Whammy %d\n", ev.value);
-            gamepad->update(&ev);
+            size_t events = gamepad->getFrameEventCount();
+            int64_t decoded = LatencyStats::now();
+            bool written = gamepad->commit();
+            int64_t emitted = LatencyStats::now();
+
+            // Count the report
+            counters.add(Counter_EventsEmitted, events);
+            counters.add(Counter_SynReports);
+            if (!written)
+            {
+                counters.add(Counter_WriteErrors);
+            }
+
+            // Record where the time went (unless we made the frame up)
+            if (arrival != 0)
+            {
+                latency.record(Latency_Decode, decoded - arrival);
+                latency.record(Latency_Emit, emitted - decoded);
+                latency.record(Latency_Total, emitted - arrival);
+            }
         }
 
-        // Tilt -> Right Analog X
-        if (lastInputState.tilt != data.tilt)
+        // Publish every frame's decoded state to shared memory readers (made up frames are the resting state of a released guitar)
+        if (StateSink::isOpen())
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_ABS;
-            ev.code = AXIS_RIGHT_ANALOG_HORIZONTAL;
-            ev.value = (short)((data.tilt * 0x101) - ANALOG_VALUE_MAX);
-            // printf("Tilt %d\n", ev.value);
-            gamepad->update(&ev);
+            const DirectionalPadValue& dpad = directionalPadValue(data.directionalPad);
+            GhlbleGuitarState state;
+            state.timestamp = arrival != 0 ? arrival : LatencyStats::now();
+            state.frets = data.frets;
+            state.buttons = data.buttons;
+            state.dpadX = (int8_t)dpad.x;
+            state.dpadY = (int8_t)dpad.y;
+            state.strum = data.strum == 0xff ? 1 : data.strum == 0 ? -1 : 0;
+            state.whammy = whammyInput.value;
+            state.tilt = tiltInput.value;
+            state.flags = arrival != 0 ? GHLBLE_STATE_STREAMING : 0;
+            sharedState.publish(packedAddress, state);
         }
+    }
 
-        // Strum -> Left Analog Y
-        if (lastInputState.strum != data.strum)
+    // The guitar is back, keep its virtual gamepad
+    if (arrival != 0)
+    {
+        released = false;
+    }
+
+    // Time the first frame of the session
+    if (arrival != 0 && connectedAt.load(std::memory_order_relaxed) != 0)
+    {
+        int64_t connected = connectedAt.exchange(0, std::memory_order_relaxed);
+        if (connected != 0)
         {
-            gettimeofday(&ev.time, nullptr);
-            ev.type = EV_ABS;
-            /*
-            ev.code = AXIS_LEFT_ANALOG_VERTICAL;
-            ev.value = data.strum == 0xff ? ANALOG_VALUE_MAX : data.strum == 0 ? ANALOG_VALUE_MIN : 0;
-            */
-            ev.code = AXIS_DPAD_VERTICAL;
-            ev.value = data.strum == 0xff ? DPAD_VALUE_MAX : data.strum == 0 ? DPAD_VALUE_MIN : 0;
-            // printf("Strum %d\n", ev.value);
-            gamepad->update(&ev);
+            latency.record(Latency_FirstFrame, LatencyStats::now() - connected);
         }
     }
 
@@ -1,15 +1,28 @@
 #ifndef GUITAR_H
 #define GUITAR_H
 
+#include "emitter.h"
 #include "gamepad.h"
+#include "latency.h"
+#include "mapping.h"
+#include "profile.h"
+#include "reactor.h"
+#include "spscring.h"
+#include "stats.h"
+#include "statesink.h"
+#include "transport.h"
 #include "ResettableTimer.h"
 
 #include <string>
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <vector>
 #include <pthread.h>
-#include <gattlib.h>
 
 enum GuitarFrets {
     Fret_W1 = 0x1,
@@ -39,6 +52,22 @@ enum GuitarDirectionalPadDirections {
     Direction_Centered = 0xf
 };
 
+// The ways guitar input data can be received
+enum GuitarInputModes {
+    InputMode_Poll = 0,   // Read the input characteristic in a loop
+    InputMode_Notify = 1  // Subscribe to input characteristic notifications
+};
+
+// The connection states of a guitar
+enum GuitarStates {
+    State_Idle = 0,         // Absent, waiting for the guitar to advertise again
+    State_Connecting = 1,   // A connection attempt is in flight
+    State_Discovering = 2,  // Connected, looking for the input characteristic
+    State_Streaming = 3,    // Receiving input data
+    State_Backoff = 4,      // Waiting before the next connection attempt
+    State_Disposed = 5      // Shutting down
+};
+
 // 20 bytes long
 typedef struct GuitarData {
     uint8_t frets;          // 1 byte
@@ -52,54 +81,338 @@ typedef struct GuitarData {
     uint8_t tilt;           // 1 byte, 0x00 ~ 0xFF
 } __attribute__((packed)) GuitarData;
 
+// The number of frames a pipelined guitar can queue for the emitter
+#define GUITAR_RING_CAPACITY 64
+
+// A received frame waiting for the emitter
+typedef struct QueuedFrame {
+    GuitarData data;  // The raw frame
+    int64_t arrival;  // The monotonic arrival time in nanoseconds
+} QueuedFrame;
+
+// The queueing counters of a pipelined guitar
+typedef struct GuitarPipelineStats {
+    uint64_t overflows;      // Frames that didn't fit into the ring right away, plus button changes lost to a full backlog
+    uint32_t highWaterMark;  // The most frames the consumer found waiting
+    uint32_t capacity;       // The ring's capacity
+    uint64_t merged;         // Frames folded into a later one with the same buttons (latest axes win)
+} GuitarPipelineStats;
+
 class Guitar {
+public:
+    // Called with the guitar's address whenever it starts or stops streaming (on whatever thread changed its state)
+    typedef std::function<void(const std::string& address, bool connected)> ConnectionListener;
+
 private:
     // The virtual gamepad
     std::unique_ptr<Gamepad> gamepad;
 
-    // The Bluetooth adapter
-    gattlib_adapter_t* adapter;
+    // The transport the guitar is reached through
+    Transport* transport;
 
     // The connection to the guitar
-    gattlib_connection_t* connection;
+    std::atomic<TransportLink*> connection;
+
+    // Serializes dropping the connection with freeing it
+    std::mutex linkMutex;
+
+    // Whether the transport reported the loss of the current connection
+    bool linkLost;
 
     // The MAC address of the guitar
     std::string address;
 
-    // The guitar's input thread
+    // The MAC address of the guitar as a 48-bit integer
+    uint64_t packedAddress;
+
+    // The guitar's input thread (thread engine only)
     std::unique_ptr<std::thread> thread;
 
-    // Whether we're currently reading guitar data
-    bool is_reading;
+    // The event loop driving this guitar (reactor engine only)
+    Reactor* reactor;
+
+    // The input characteristic of the current session (reactor engine only)
+    TransportCharacteristic inputCharacteristic;
+
+    // The state generation the event loop has acted upon (reactor thread only)
+    uint32_t handledGeneration;
+
+    // The pending backoff, connect timeout or watchdog timer (reactor thread only)
+    uint64_t stateTimer;
+
+    // The connection slot ticket of the current connecting state (reactor thread only)
+    uint64_t connectTicket;
+
+    // Whether the thread engine's connection slot has been granted (stateMutex must be held)
+    bool connectGranted;
+
+    // When the guitar started wanting a connection (0 while it's streaming or waiting for advertisements)
+    std::atomic<int64_t> connectWantedAt;
+
+    // The number of frames received since the last watchdog check
+    std::atomic<uint32_t> framesSinceWatchdog;
+
+    // The connection state
+    std::atomic<GuitarStates> state;
+
+    // Incremented on every state change
+    std::atomic<uint32_t> stateGeneration;
+
+    // The number of failed connection attempts since the last session
+    std::atomic<uint32_t> failedAttempts;
+
+    // The number of sessions in a row the cached characteristic failed on a live link although discovery confirmed it (session thread or reactor thread only)
+    uint32_t staleCharacteristicFailures;
+
+    // When the current backoff ends
+    std::chrono::steady_clock::time_point backoffDeadline;
+
+    // The number of connection callbacks that haven't returned yet
+    std::atomic<uint32_t> pendingConnects;
+
+    // The way we receive guitar input data
+    GuitarInputModes inputMode;
+
+    // The watchdog of the current notification session (NULL outside of one)
+    ResettableTimer* watchdog;
+
+    // Guards the watchdog (so a notification can't reset it while its session ends and destroys it)
+    std::mutex watchdogMutex;
+
+    // Guards state changes for waiters
+    std::mutex stateMutex;
+
+    // Signaled on every state change and when the connection or the pending callbacks change
+    std::condition_variable stateCondition;
 
     // The last input state
     GuitarData lastInputState;
 
+    // The mapping table the last frame was emitted with (its address and a copy, a reload may reclaim the original, gamepadMutex must be held)
+    const MappingTable* lastMappingTable;
+    MappingTable lastMapping;
+
+    // The conditioning state of the whammy bar and the tilt sensor
+    AnalogInputState whammyInput;
+    AnalogInputState tiltInput;
+
+    // The analog inputs whose latest values haven't been reported yet (gamepadMutex must be held)
+    uint8_t pendingAxes;
+
+    // When analog values were last reported (gamepadMutex must be held)
+    int64_t lastAnalogReport;
+
+    // Reports held back analog values once no frame has come along to carry them
+    TimerService::Timer* analogTimer;
+
+    // Whether the analog timer is scheduled (gamepadMutex must be held)
+    bool analogTimerScheduled;
+
+    // Where the decoded state is published for shared memory readers (gamepadMutex must be held)
+    StateSinkSlot sharedState;
+
     // Last input timestamp
     std::chrono::time_point<std::chrono::system_clock> lastInputTimestamp;
 
-    // The disposed flag
-    bool disposed;
+    // The per-stage input latencies
+    LatencyStats latency;
+
+    // The emitter draining the frame ring (pipelined mode only)
+    Emitter* emitter;
+
+    // The frames waiting for the emitter (pipelined mode only, pushed by the receive path, popped by the emitter)
+    std::unique_ptr<SpscRing<QueuedFrame, GUITAR_RING_CAPACITY>> ring;
+
+    // Guards the backlog (the emitter takes it over once it has caught up with the ring)
+    std::mutex backlogMutex;
+
+    // Whether frames are waiting in the backlog (the receive path stops pushing into the ring until the emitter took them)
+    std::atomic<bool> backlogged;
+
+    // The frames that didn't fit into the ring (backlogMutex must be held)
+    std::vector<QueuedFrame> backlog;
+
+    // The backlog the emitter took over (emitter thread only)
+    std::vector<QueuedFrame> drainedBacklog;
+
+    // The last frame queued and the one queued right before the backlog's oldest (receive path only)
+    GuitarData lastQueued;
+    GuitarData backlogBase;
+
+    // The number of frames folded into a later one
+    std::atomic<uint64_t> mergedFrames;
+
+    // The number of button changes lost because the backlog was full of them
+    std::atomic<uint64_t> backlogOverflows;
+
+    // When the current session's connection was established (0 once its first frame has been handled)
+    std::atomic<int64_t> connectedAt;
 
-    // Maintains a connection to the guitar
+    // When the current session's connection was established (for timing the discovery)
+    int64_t discoveryStartedAt;
+
+    // The last received frame (receive path only)
+    GuitarData lastReceivedFrame;
+
+    // The throughput and health counters
+    GuitarCounters counters;
+
+    // Serializes the virtual gamepad between the input path, releases and the grace timer
+    std::mutex gamepadMutex;
+
+    // Whether everything has been released since the last session ended (gamepadMutex must be held)
+    bool released;
+
+    // When the last session ended, frames that arrived earlier are stale (gamepadMutex must be held)
+    int64_t releasedAt;
+
+    // Removes the virtual gamepad once a disconnected guitar hasn't come back in time
+    std::unique_ptr<ResettableTimer> graceTimer;
+
+    // How long the virtual gamepad outlives a dropped connection in seconds
+    static std::atomic<int> gracePeriod;
+
+    // The shortest time between two reports that only carry analog changes in nanoseconds
+    static std::atomic<int64_t> analogInterval;
+
+    // Whether absent guitars can wait for advertisements instead of retrying
+    static std::atomic<bool> scanning;
+
+    // Told about guitars starting and stopping to stream
+    static ConnectionListener connectionListener;
+
+    // Maintains a connection to the guitar (thread engine only)
     void maintainConnection();
 
+    // Acts upon the current state (reactor thread only)
+    void driveState();
+
+    // Changes the state unless the guitar has been disposed, returns false if it has
+    bool setState(GuitarStates next);
+
+    // Changes the state if it's still the expected one
+    bool setState(GuitarStates expected, GuitarStates next);
+
+    // Wakes up whoever drives the state machine
+    void notifyState();
+
+    // Tells the connection listener if the guitar started or stopped streaming
+    void notifyConnection(GuitarStates previous, GuitarStates next);
+
+    // Schedules the next connection attempt after a failed one, returns false if the state isn't the expected one anymore
+    bool connectionFailed(GuitarStates expected);
+
+    // Reconnects right away after a streaming session has ended and releases its inputs, returns false if the guitar wasn't streaming
+    bool sessionEnded();
+
+    // Starts a connection attempt holding the given connection slot (released once the attempt resolves), returns false if it couldn't be started
+    bool connect(uint64_t ticket);
+
+    // Starts a connection attempt once the event loop's connection slot has been granted (reactor thread only)
+    void startConnect(uint32_t generation);
+
+    // Counts and times a session that just started streaming
+    void sessionStarted();
+
     // Receives guitar data
-    static void receiveData(gattlib_adapter_t* adapter, const char *dst, gattlib_connection_t* connection, int error, void* user_data);
+    void receiveData(TransportLink* link);
+
+    // Receives guitar data notifications
+    void receiveNotification(const uint8_t* data, size_t length);
+
+    // Handles the loss of the connection while receiving notifications
+    void connectionLost();
+
+    // Reads guitar data until the connection is lost, returns false if the characteristic couldn't be read at all
+    bool pollData(TransportLink* link, const TransportCharacteristic& characteristic, ResettableTimer& disconnectTimer);
 
-    // Updates guitar data and the last input timestamp
-    void update(const GuitarData& data);
+    // Subscribes to guitar data notifications and waits until the connection is lost, returns false if the subscription failed
+    bool subscribeData(TransportLink* link, const TransportCharacteristic& characteristic, ResettableTimer& disconnectTimer);
+
+    // Disconnects the guitar and wakes up the notification session (the reactor engine frees the link right away, the thread engine once the session is over), returns false if it was already disconnected
+    bool disconnect();
+
+    // Finds the characteristic that reports guitar data (in the device cache if possible, cached tells which)
+    bool findInputCharacteristic(TransportLink* link, TransportCharacteristic* characteristic, bool* cached);
+
+    // Stores a discovered input characteristic in the device cache
+    void rememberInputCharacteristic(const TransportCharacteristic& characteristic);
+
+    // Checks a cached characteristic that couldn't be used against a fresh discovery, returns true (and the new characteristic, now cached) if it changed
+    bool revalidateInputCharacteristic(TransportLink* link, TransportCharacteristic* characteristic);
+
+    // Starts a non-blocking notification session (reactor engine only)
+    void startStreaming(TransportLink* link);
+
+    // Disconnects the guitar if it didn't send any data since the last check (reactor thread only)
+    void checkWatchdog();
+
+    // Handles a received frame (records it, then updates the gamepad right away or queues it for the emitter)
+    void receiveFrame(const GuitarData& data, int64_t arrival);
+
+    // Queues a frame for the emitter, holding on to it if the ring is full (receive path only)
+    void enqueue(const GuitarData& data, int64_t arrival);
+
+    // Adds a frame to the backlog, making room without losing button changes if possible (receive path only, backlogMutex must be held)
+    void appendBacklog(const QueuedFrame& frame);
+
+    // Emits the queued frames as one batch (emitter thread only)
+    void drain();
+
+    // Updates guitar data and the last input timestamp (arrival is the frame's monotonic arrival time, 0 for synthetic frames, gamepadMutex must be held)
+    void update(const GuitarData& data, int64_t arrival);
+
+    // Appends the analog values that haven't been reported yet to the current frame (gamepadMutex must be held)
+    void appendAnalogInputs(const MappingTable& mapping, int64_t now);
+
+    // Moves the last frame's inputs over to the mapping table if the profiles changed since, appending releases and rest values to the current frame (gamepadMutex must be held)
+    void switchMapping(const MappingTable& mapping);
+
+    // Reports the analog values the rate cap held back (analog timer callback)
+    void flushAnalogInputs();
+
+    // Releases every key and centers every axis of the virtual gamepad after a session has ended
+    void releaseInputs();
+
+    // Removes the virtual gamepad if the guitar hasn't come back within the grace period (timer thread only)
+    void expireGamepad();
 
 public:
     // Constructor
-    Guitar(gattlib_adapter_t* adapterValue, const std::string& addressValue);
+    Guitar(Transport* transportValue, const std::string& addressValue, GuitarInputModes inputModeValue = InputMode_Poll, Reactor* reactorValue = NULL, Emitter* emitterValue = NULL);
+
+    // Creates a guitar that never connects and is only fed through replay()
+    explicit Guitar(const std::string& addressValue);
 
     // Destructor
     ~Guitar();
 
     // Getter
     std::string getAddress() const;
+    std::string getGamepadName() const;
     bool isConnected();
+    GuitarStates getState() const;
+    const LatencyStats& getLatency() const;
+    GuitarPipelineStats getPipelineStats() const;
+    const GuitarCounters& getCounters() const;
+
+    // Connects right away if the guitar is idle or backing off (e.g. because it advertised again)
+    void reconnect();
+
+    // Feeds a recorded frame through the input pipeline (arrival is its monotonic arrival time)
+    void replay(const GuitarData& data, int64_t arrival);
+
+    // Lets absent guitars wait for advertisements while scanning (instead of retrying forever)
+    static void setScanning(bool enabled);
+
+    // Sets how long virtual gamepads outlive dropped connections in seconds (0 removes them right away)
+    static void setGracePeriod(int seconds);
+
+    // Sets who's told about guitars starting and stopping to stream (set it before creating guitars)
+    static void setConnectionListener(const ConnectionListener& listener);
+
+    // Caps how often per second a guitar reports analog changes on their own (0 = no cap, digital changes always go out at once)
+    static void setAnalogRate(int hertz);
 
 };
 
@@ -0,0 +1,175 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "guitar.h"
+#include "hidrawtransport.h"
+
+// The number of reports played back and the length of one
+static const int g_report_count = 500;
+static const size_t g_report_length = 27;
+
+// Waits up to a second for a condition, returns whether it came true
+template <typename Condition>
+static bool wait_for(Condition condition)
+{
+    for (int i = 0; i < 1000 && !condition(); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return condition();
+}
+
+// Writes all of a buffer, returns false if the pty refused it
+static bool write_all(int fd, const uint8_t* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0)
+        {
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// The entry point
+int main()
+{
+    // Capture the events
+    char directory[] = "/tmp/ghlble_hidraw_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    Gamepad::setSink(Sink_Capture, directory);
+
+    // A pty stands in for the dongle (raw, so the reports pass through untouched)
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    std::string device = ptsname(master);
+    int slave = open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    struct termios settings;
+    if (slave < 0 || tcgetattr(slave, &settings) != 0)
+    {
+        perror(device.c_str());
+        return 1;
+    }
+    cfmakeraw(&settings);
+    tcsetattr(slave, TCSANOW, &settings);
+
+    // Play it through the transport (without keep-alives, nobody reads them off the pty)
+    HidrawTransport transport;
+    if (!transport.configure("device=" + device + ",keepalive=0") || !transport.open())
+    {
+        printf("The transport didn't take the pty.\n");
+        return 1;
+    }
+    int result = 0;
+    std::string capture;
+    {
+        Guitar guitar(&transport, "6A:00:00:00:01:00", InputMode_Notify);
+        capture = std::string(directory) + "/" + guitar.getGamepadName() + ".events";
+        for (size_t i = std::string(directory).size() + 1; i < capture.size() - 7; i++)
+        {
+            capture[i] = isalnum((unsigned char)capture[i]) ? capture[i] : '_';
+        }
+        if (!wait_for([&guitar]() { return guitar.getState() == State_Streaming; }))
+        {
+            printf("The guitar never started streaming (state %d).\n", guitar.getState());
+            result = 1;
+        }
+
+        // Every report toggles a fret and is split across two writes (now and then with a pause in between, so the reads see the halves)
+        GuitarData frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.directionalPad = Direction_Centered;
+        frame.strum = 0x80;
+        frame.whammy = 0x80;
+        frame.tilt = 0x80;
+        for (int i = 0; i < g_report_count && result == 0; i++)
+        {
+            frame.frets ^= (uint8_t)(1 << (i % 6));
+            uint8_t report[g_report_length];
+            memset(report, 0, sizeof(report));
+            memcpy(report, &frame, sizeof(frame));
+            bool written = write_all(master, report, 11);
+            if (i % 4 == 0)
+            {
+                usleep(1000);
+            }
+            if (!written || !write_all(master, report + 11, sizeof(report) - 11))
+            {
+                perror("write");
+                result = 1;
+            }
+        }
+
+        // Every report arrived once and in one piece (a misaligned one repeats or garbles its neighbours)
+        if (result == 0 && !wait_for([&guitar]() { return guitar.getCounters().get(Counter_FramesReceived) >= (uint64_t)g_report_count; }))
+        {
+            printf("%llu of %d reports arrived.\n", (unsigned long long)guitar.getCounters().get(Counter_FramesReceived), g_report_count);
+            result = 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        uint64_t received = guitar.getCounters().get(Counter_FramesReceived);
+        uint64_t repeated = guitar.getCounters().get(Counter_FramesRepeated);
+        if (result == 0 && (received != (uint64_t)g_report_count || repeated != 0))
+        {
+            printf("%llu reports arrived (%llu repeated), %d were played.\n", (unsigned long long)received, (unsigned long long)repeated, g_report_count);
+            result = 1;
+        }
+
+        // Each report pressed or released exactly one key
+        int fd = open(capture.c_str(), O_RDONLY | O_CLOEXEC);
+        int keyEvents = 0;
+        struct input_event ev;
+        while (fd >= 0 && read(fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+        {
+            keyEvents += ev.type == EV_KEY ? 1 : 0;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (result == 0 && keyEvents != g_report_count)
+        {
+            printf("%d key events for %d fret changes.\n", keyEvents, g_report_count);
+            result = 1;
+        }
+
+        // Unplugging the dongle (EOF or EIO on the pty) drops the link and the guitar goes back to reconnecting
+        close(slave);
+        close(master);
+        if (result == 0 && !wait_for([&guitar]() { return guitar.getState() != State_Streaming && guitar.getCounters().get(Counter_Reconnects) > 0; }))
+        {
+            printf("The guitar didn't notice the unplug (state %d).\n", guitar.getState());
+            result = 1;
+        }
+    }
+    transport.close();
+    if (result == 0)
+    {
+        printf("%d split reports, unplug noticed.\n", g_report_count);
+    }
+
+    // Clean up
+    unlink(capture.c_str());
+    rmdir(directory);
+    return result;
+}
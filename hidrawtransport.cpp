@@ -0,0 +1,515 @@
+#include "hidrawtransport.h"
+#include "guitar.h"
+#include "address.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include <sstream>
+#include <thread>
+
+// The dongles we know (the keep-alives are the ones the kernel's hid-sony driver pokes them with)
+static const HidrawDongle g_hidraw_dongles[] = {
+    { 0x12ba, 0x074b, "PS3/Wii U", 0, { 0x02, 0x08, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 }, 8 },
+    { 0x1430, 0x07bb, "PS4", 1, { 0x30, 0x02, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00 }, 9 },
+};
+
+// Dongle addresses count up from 6A:00:00:00:00:00 (detected) and 6A:00:00:00:01:00 (given devices)
+#define HIDRAW_ADDRESS_PREFIX 0x6a0000000000ull
+#define HIDRAW_ADDRESS_DETECTED 0x00
+#define HIDRAW_ADDRESS_EXTRA 0x01
+
+// A connection to a dongle
+class HidrawLink : public TransportLink
+{
+public:
+    // Constructor
+    HidrawLink(int fdValue, const HidrawDongle* dongleValue, size_t reportLengthValue) : fd(fdValue), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), dongle(dongleValue), reportLength(reportLengthValue), connected(true), subscribed(false), lostReported(false)
+    {
+    }
+
+    // Destructor
+    ~HidrawLink()
+    {
+        ::close(fd);
+        ::close(wakeFd);
+    }
+
+    // The device
+    int fd;
+
+    // Wakes up a blocked read when the link is disconnected
+    int wakeFd;
+
+    // The dongle behind the device
+    const HidrawDongle* dongle;
+
+    // The input report length of a byte stream device (0 for hidraw devices, they hand out one report per read)
+    size_t reportLength;
+
+    // The received bytes of a byte stream device that don't make up a whole report yet
+    std::vector<uint8_t> pending;
+
+    // Whether the link is still up
+    std::atomic<bool> connected;
+
+    // Whether notifications are enabled
+    std::atomic<bool> subscribed;
+
+    // Whether the subscriber has been told about the loss of the link
+    std::atomic<bool> lostReported;
+
+    // The notification handler
+    Transport::NotificationHandler notification;
+
+    // The connection loss handler
+    Transport::DisconnectHandler lost;
+
+    // Tags the keep-alive timers on the event loop (the link itself tags its watcher)
+    char keepAliveOwner;
+};
+
+// Tells a link's subscriber that the link is gone (once, a disconnect and a lost dongle can race)
+static void report_lost(HidrawLink* link)
+{
+    if (link->subscribed && link->lost && !link->lostReported.exchange(true))
+    {
+        link->lost();
+    }
+}
+
+// Takes the next input report off a link, returns false if there's none yet (lost tells whether the link is gone)
+static bool take_report(HidrawLink* link, GuitarData* frame, bool* lost)
+{
+    *lost = false;
+    uint8_t report[256];
+    while (true)
+    {
+        // A byte stream device has buffered a whole report
+        if (link->reportLength > 0 && link->pending.size() >= link->reportLength)
+        {
+            memcpy(frame, link->pending.data() + link->dongle->reportOffset, sizeof(GuitarData));
+            link->pending.erase(link->pending.begin(), link->pending.begin() + link->reportLength);
+            return true;
+        }
+
+        // Read what's there
+        ssize_t length = ::read(link->fd, report, sizeof(report));
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return false;
+        }
+
+        // The dongle was unplugged (ENODEV) or the stand-in went away (EOF, or EIO on a pty)
+        if (length <= 0)
+        {
+            *lost = true;
+            return false;
+        }
+
+        // A hidraw device hands out one report per read (skip reports too short to hold the guitar data, e.g. other report IDs)
+        if (link->reportLength == 0)
+        {
+            if ((size_t)length >= link->dongle->reportOffset + sizeof(GuitarData))
+            {
+                memcpy(frame, report + link->dongle->reportOffset, sizeof(GuitarData));
+                return true;
+            }
+            continue;
+        }
+
+        // A byte stream device can split and merge reports
+        link->pending.insert(link->pending.end(), report, report + length);
+    }
+}
+
+HidrawTransport::HidrawTransport() : extraReportLength(27), keepAliveInterval(8000), opened(false), scanning(false), pendingCallbacks(0)
+{
+}
+
+HidrawTransport::~HidrawTransport()
+{
+    // Wait for the connection callbacks and stop the event loop
+    close();
+}
+
+bool HidrawTransport::configure(const std::string& options)
+{
+    // Parse the "option=value" pairs
+    std::stringstream stream(options);
+    std::string option;
+    while (std::getline(stream, option, ','))
+    {
+        // Split the pair
+        size_t separator = option.find('=');
+        if (separator == std::string::npos || separator + 1 == option.size())
+        {
+            printf("Invalid hidraw option \"%s\".\n", option.c_str());
+            return false;
+        }
+        std::string name = option.substr(0, separator);
+        std::string text = option.substr(separator + 1);
+
+        // Devices are paths, everything else is a number
+        if (name == "device" && extraDevices.size() < 256)
+        {
+            extraDevices.push_back(text);
+            continue;
+        }
+        char* end;
+        unsigned long value = strtoul(text.c_str(), &end, 10);
+        if (*end != '\0')
+        {
+            printf("Invalid hidraw option \"%s\".\n", option.c_str());
+            return false;
+        }
+
+        // Apply it
+        if (name == "report" && value >= sizeof(GuitarData) && value <= 256)
+        {
+            extraReportLength = value;
+        }
+        else if (name == "keepalive")
+        {
+            keepAliveInterval = std::chrono::milliseconds(value);
+        }
+        else
+        {
+            printf("Invalid hidraw option \"%s\".\n", option.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* HidrawTransport::getName() const
+{
+    return "hidraw";
+}
+
+bool HidrawTransport::open()
+{
+    // Start the event loop the reads and keep-alives run on
+    opened = loop.start();
+    return opened;
+}
+
+void HidrawTransport::close()
+{
+    // Stop scanning and wait for the connection callbacks to return
+    stopScan();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return pendingCallbacks == 0; });
+    }
+
+    // Stop the event loop
+    if (opened)
+    {
+        loop.stop();
+        opened = false;
+    }
+}
+
+bool HidrawTransport::scan(DiscoveryHandler handler)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    scanning = true;
+    while (scanning)
+    {
+        lock.unlock();
+
+        // Advertise the plugged in dongles
+        DIR* directory = opendir("/dev");
+        struct dirent* entry;
+        while (directory != NULL && (entry = readdir(directory)) != NULL)
+        {
+            // Only look at hidraw devices
+            char* end;
+            unsigned long number = strncmp(entry->d_name, "hidraw", 6) == 0 ? strtoul(entry->d_name + 6, &end, 10) : 256;
+            if (number > 255 || entry->d_name[6] == '\0' || *end != '\0')
+            {
+                continue;
+            }
+
+            // Ask the device what it is
+            std::string path = std::string("/dev/") + entry->d_name;
+            int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            const HidrawDongle* dongle = fd >= 0 ? identify(fd) : NULL;
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            if (dongle != NULL)
+            {
+                handler(unpackAddress(HIDRAW_ADDRESS_PREFIX | HIDRAW_ADDRESS_DETECTED << 8 | number), TRANSPORT_GUITAR_NAME);
+            }
+        }
+        if (directory != NULL)
+        {
+            closedir(directory);
+        }
+
+        // Advertise the given devices that exist
+        for (size_t i = 0; i < extraDevices.size(); i++)
+        {
+            if (access(extraDevices[i].c_str(), F_OK) == 0)
+            {
+                handler(unpackAddress(HIDRAW_ADDRESS_PREFIX | HIDRAW_ADDRESS_EXTRA << 8 | i), TRANSPORT_GUITAR_NAME);
+            }
+        }
+
+        // Look again a second later
+        lock.lock();
+        condition.wait_for(lock, std::chrono::seconds(1), [this]() { return !scanning; });
+    }
+    return true;
+}
+
+void HidrawTransport::stopScan()
+{
+    // Wake up the scan
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        scanning = false;
+    }
+    condition.notify_all();
+}
+
+bool HidrawTransport::connect(const std::string& address, ConnectHandler handler)
+{
+    // There's no such dongle
+    std::string path = pathOf(address);
+    if (path.empty())
+    {
+        return false;
+    }
+    bool extra = (packAddress(address) >> 8 & 0xff) == HIDRAW_ADDRESS_EXTRA;
+
+    // Call back from a thread of our own like gattlib does (the callback may block for the whole session)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingCallbacks++;
+    }
+    std::thread([this, path, extra, handler]() {
+        // Open the device (detected devices have to be a dongle we know, given ones count as a PS3 dongle)
+        HidrawLink* link = NULL;
+        int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+        const HidrawDongle* dongle = fd >= 0 ? identify(fd) : NULL;
+        if (fd >= 0 && (dongle != NULL || extra))
+        {
+            link = new HidrawLink(fd, dongle != NULL ? dongle : &g_hidraw_dongles[0], dongle != NULL ? 0 : extraReportLength);
+        }
+        else if (fd >= 0)
+        {
+            ::close(fd);
+        }
+
+        // Keep the dongle streaming
+        if (link != NULL && keepAliveInterval.count() > 0)
+        {
+            loop.post(&link->keepAliveOwner, [this, link]() { keepAlive(link); });
+        }
+        handler(link);
+
+        // Let close() know we're done
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingCallbacks--;
+        condition.notify_all();
+    }).detach();
+    return true;
+}
+
+void HidrawTransport::disconnect(TransportLink* link)
+{
+    // Wake up a blocked read
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    hidrawLink->connected = false;
+    uint64_t value = 1;
+    ssize_t written = write(hidrawLink->wakeFd, &value, sizeof(value));
+    (void)written;
+
+    // Let a subscriber know on the event loop like a lost dongle
+    loop.post(link, [hidrawLink]() { report_lost(hidrawLink); });
+}
+
+void HidrawTransport::release(TransportLink* link)
+{
+    // Stop the notifications and keep-alives and free the link
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    hidrawLink->connected = false;
+    unsubscribe(link, TransportCharacteristic());
+    loop.purge(&hidrawLink->keepAliveOwner);
+    delete hidrawLink;
+}
+
+bool HidrawTransport::discover(TransportLink* link, TransportCharacteristic* characteristic)
+{
+    // The link is gone
+    if (!((HidrawLink*)link)->connected)
+    {
+        return false;
+    }
+
+    // There's no GATT over HID, hand out the characteristic the guitars report on over BLE
+    static const uint8_t uuid[16] = { 0x53, 0x3e, 0x15, 0x24, 0x3a, 0xbe, 0xf3, 0x3f, 0xcd, 0x00, 0x59, 0x4e, 0x8b, 0x0a, 0x8e, 0xa3 };
+    characteristic->handle = 0x0010;
+    characteristic->valueHandle = 0x0011;
+    characteristic->uuidType = 0;
+    memcpy(characteristic->uuid, uuid, sizeof(uuid));
+    return true;
+}
+
+bool HidrawTransport::read(TransportLink* link, const TransportCharacteristic& /*characteristic*/, void* buffer, size_t size)
+{
+    // Only whole frames can be read
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    if (size != sizeof(GuitarData))
+    {
+        return false;
+    }
+
+    // Wait for the next report
+    while (hidrawLink->connected)
+    {
+        // Hand out a report that's already there
+        bool lost;
+        if (take_report(hidrawLink, (GuitarData*)buffer, &lost))
+        {
+            return true;
+        }
+        if (lost)
+        {
+            hidrawLink->connected = false;
+            return false;
+        }
+
+        // Sleep until there's more or the link is disconnected
+        struct pollfd fds[2] = { { hidrawLink->fd, POLLIN, 0 }, { hidrawLink->wakeFd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool HidrawTransport::subscribe(TransportLink* link, const TransportCharacteristic& /*characteristic*/, NotificationHandler notification, DisconnectHandler lost)
+{
+    // The link is gone
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    if (!hidrawLink->connected)
+    {
+        return false;
+    }
+
+    // Read on the event loop whenever there's something to read
+    hidrawLink->notification = std::move(notification);
+    hidrawLink->lost = std::move(lost);
+    hidrawLink->subscribed = true;
+    if (!loop.watch(link, hidrawLink->fd, EPOLLIN, [this, link](uint32_t events) { receive(link, events); }))
+    {
+        hidrawLink->subscribed = false;
+        return false;
+    }
+    return true;
+}
+
+void HidrawTransport::unsubscribe(TransportLink* link, const TransportCharacteristic& /*characteristic*/)
+{
+    // Stop reading and wait for a running notification (unless we're called from it)
+    ((HidrawLink*)link)->subscribed = false;
+    loop.purge(link);
+}
+
+std::string HidrawTransport::pathOf(const std::string& address) const
+{
+    // It's not one of our addresses
+    uint64_t packed = packAddress(address);
+    if ((packed & ~0xffffull) != HIDRAW_ADDRESS_PREFIX)
+    {
+        return "";
+    }
+
+    // A detected dongle
+    uint32_t index = (uint32_t)(packed & 0xff);
+    if ((packed >> 8 & 0xff) == HIDRAW_ADDRESS_DETECTED)
+    {
+        return "/dev/hidraw" + std::to_string(index);
+    }
+
+    // A given device
+    if ((packed >> 8 & 0xff) == HIDRAW_ADDRESS_EXTRA && index < extraDevices.size())
+    {
+        return extraDevices[index];
+    }
+    return "";
+}
+
+const HidrawDongle* HidrawTransport::identify(int fd)
+{
+    // Ask for the USB IDs (this fails on anything but a hidraw device)
+    struct hidraw_devinfo info;
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0)
+    {
+        return NULL;
+    }
+
+    // Look them up
+    for (const HidrawDongle& dongle : g_hidraw_dongles)
+    {
+        if ((uint16_t)info.vendor == dongle.vendor && (uint16_t)info.product == dongle.product)
+        {
+            return &dongle;
+        }
+    }
+    return NULL;
+}
+
+void HidrawTransport::keepAlive(TransportLink* link)
+{
+    // The link is gone
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    if (!hidrawLink->connected)
+    {
+        return;
+    }
+
+    // Poke the dongle (a failure shows up on the reads soon enough) and do it again later
+    ssize_t written = write(hidrawLink->fd, hidrawLink->dongle->keepAlive, hidrawLink->dongle->keepAliveLength);
+    (void)written;
+    loop.schedule(&hidrawLink->keepAliveOwner, keepAliveInterval, [this, link]() { keepAlive(link); });
+}
+
+void HidrawTransport::receive(TransportLink* link, uint32_t /*events*/)
+{
+    // Hand out everything that's there
+    HidrawLink* hidrawLink = (HidrawLink*)link;
+    GuitarData frame;
+    bool lost = false;
+    while (hidrawLink->subscribed && take_report(hidrawLink, &frame, &lost))
+    {
+        hidrawLink->notification((const uint8_t*)&frame, sizeof(frame));
+    }
+
+    // The dongle is gone, stop watching it and let the subscriber know (unless it's the one who dropped the link)
+    if (lost)
+    {
+        hidrawLink->connected = false;
+        loop.unwatch(hidrawLink->fd);
+        report_lost(hidrawLink);
+    }
+}
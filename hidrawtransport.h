@@ -0,0 +1,103 @@
+#ifndef HIDRAWTRANSPORT_H
+#define HIDRAWTRANSPORT_H
+
+#include "transport.h"
+#include "reactor.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A USB dongle the hidraw transport knows how to talk to
+typedef struct HidrawDongle {
+    uint16_t vendor;             // The USB vendor ID
+    uint16_t product;            // The USB product ID
+    const char* name;            // The console the dongle belongs to
+    uint8_t reportOffset;        // Where the guitar data starts in an input report (after the report ID, if any)
+    uint8_t keepAlive[9];        // The output report that keeps the dongle streaming
+    uint8_t keepAliveLength;     // The length of the output report
+} HidrawDongle;
+
+// Talks to guitars through the USB dongles of the console versions.
+//
+// The PS3, Wii U and PS4 dongles report the same layout over HID as the
+// guitars do over BLE, with lower and steadier latency. Dongles are found on
+// /dev/hidraw* by their USB IDs and advertised like guitars on
+// 6A:00:00:00:00:NN (NN being the hidraw number). They stop streaming unless
+// they're sent a keep-alive output report every few seconds. Reads are
+// non-blocking and driven by an event loop of the transport's own. The
+// options are given as "option=value" pairs:
+//
+//     device=PATH    Also uses PATH, e.g. a pty playing back recorded reports, as a PS3 dongle (repeatable, 6A:00:00:00:01:NN in order)
+//     report=BYTES   Input report length of the extra devices (default: 27)
+//     keepalive=MS   Keep-alive interval (default: 8000, 0 = don't send any)
+class HidrawTransport : public Transport
+{
+public:
+    // Constructor
+    HidrawTransport();
+
+    // Destructor
+    ~HidrawTransport();
+
+    // Applies a comma separated option list, returns false if it contained errors
+    bool configure(const std::string& options);
+
+    const char* getName() const override;
+    bool open() override;
+    void close() override;
+    bool scan(DiscoveryHandler handler) override;
+    void stopScan() override;
+    bool connect(const std::string& address, ConnectHandler handler) override;
+    void disconnect(TransportLink* link) override;
+    void release(TransportLink* link) override;
+    bool discover(TransportLink* link, TransportCharacteristic* characteristic) override;
+    bool read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size) override;
+    bool subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost) override;
+    void unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic) override;
+
+private:
+    // The devices given on top of the detected dongles
+    std::vector<std::string> extraDevices;
+
+    // The input report length of the extra devices
+    size_t extraReportLength;
+
+    // The keep-alive interval
+    std::chrono::milliseconds keepAliveInterval;
+
+    // Runs the reads and keep-alives of all links
+    Reactor loop;
+
+    // Whether the event loop is running
+    bool opened;
+
+    // Guards the scan state and the connection callbacks
+    std::mutex mutex;
+
+    // Wakes up the scan and waits for connection callbacks
+    std::condition_variable condition;
+
+    // Whether a scan is running
+    bool scanning;
+
+    // The number of connection callbacks that haven't returned yet
+    uint32_t pendingCallbacks;
+
+    // Returns the device behind an address (empty if it's none of ours)
+    std::string pathOf(const std::string& address) const;
+
+    // Returns the dongle behind an open hidraw device (NULL if it's not a known dongle or not a hidraw device at all)
+    static const HidrawDongle* identify(int fd);
+
+    // Sends a link's keep-alive and schedules the next one
+    void keepAlive(TransportLink* link);
+
+    // Handles a link's readiness on the event loop
+    void receive(TransportLink* link, uint32_t events);
+};
+
+#endif // HIDRAWTRANSPORT_H
@@ -0,0 +1,107 @@
+#include "latency.h"
+
+LatencyHistogram::LatencyHistogram() : total(0), maximum(0)
+{
+    // Start out empty
+    for (auto& bucket : buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    // There's nothing to report
+    uint64_t samples = count();
+    if (samples == 0)
+    {
+        return 0;
+    }
+
+    // The number of samples at or below the percentile
+    uint64_t rank = (uint64_t)(percent / 100.0 * samples + 0.5);
+    rank = rank < 1 ? 1 : rank > samples ? samples : rank;
+
+    // Walk the buckets until we've seen enough samples
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            // Never report more than the exact maximum
+            uint64_t limit = bucketLimit(i);
+            uint64_t largest = max();
+            return limit < largest ? limit : largest;
+        }
+    }
+
+    // The buckets were being recorded into while we walked them
+    return max();
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    return maximum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::bucketLimit(size_t index)
+{
+    // Small values get a bucket each
+    if (index < LATENCY_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    // Reverse the exponent / sub-bucket split
+    int shift = (int)(index / LATENCY_SUB_BUCKETS) - 1;
+    uint64_t lowest = (uint64_t)(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+LatencyStats::LatencyStats() : lastArrival(0), lastInterval(0), smoothedJitter(0)
+{
+}
+
+void LatencyStats::recordArrival(int64_t arrival)
+{
+    // We've got a previous frame to compare to
+    if (lastArrival != 0)
+    {
+        // Record the frame interval
+        int64_t interval = arrival - lastArrival;
+        histograms[Latency_Interval].record(interval);
+
+        // Smooth the interval variation like RFC 3550 does (J += (|D| - J) / 16)
+        if (lastInterval != 0)
+        {
+            int64_t deviation = interval > lastInterval ? interval - lastInterval : lastInterval - interval;
+            int64_t current = (int64_t)smoothedJitter.load(std::memory_order_relaxed);
+            smoothedJitter.store((uint64_t)(current + (deviation - current) / 16), std::memory_order_relaxed);
+        }
+        lastInterval = interval;
+    }
+    lastArrival = arrival;
+}
+
+const LatencyHistogram& LatencyStats::get(LatencyStages stage) const
+{
+    return histograms[stage];
+}
+
+uint64_t LatencyStats::jitter() const
+{
+    return smoothedJitter.load(std::memory_order_relaxed);
+}
+
+const char* LatencyStats::stageName(LatencyStages stage)
+{
+    // The names used on the D-Bus interface
+    static const char* const names[Latency_StageCount] = { "read", "decode", "emit", "total", "interval", "queue", "first", "connect" };
+    return names[stage];
+}
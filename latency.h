@@ -0,0 +1,146 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+
+// The number of linear sub-buckets per power of two (as bits, 4 bits = 6.25% precision)
+#define LATENCY_SUB_BUCKET_BITS 4
+
+// The number of linear sub-buckets per power of two
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+
+// The number of buckets needed to cover all 64-bit values
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+// The measured stages of an input frame
+enum LatencyStages
+{
+    Latency_Read,        // GATT read request -> read completion (polling only)
+    Latency_Decode,      // Frame arrival -> mapped events ready
+    Latency_Emit,        // Mapped events ready -> uinput write done
+    Latency_Total,       // Frame arrival -> uinput write done
+    Latency_Interval,    // Frame arrival -> next frame arrival
+    Latency_Queue,       // Frame arrival -> picked up by the emitter (pipelined mode only)
+    Latency_FirstFrame,  // Connection established -> first frame handled by the virtual gamepad
+    Latency_Connect,     // Connection wanted -> streaming (including waiting for a slot, retries and discovery)
+    Latency_StageCount
+};
+
+// A log-linear (HDR-style) histogram of nanosecond durations with a fixed memory footprint.
+//
+// Recording is a couple of relaxed loads and stores and never allocates. Each
+// histogram must only be recorded into by one thread at a time, but can be
+// read from any thread while it's being recorded into.
+class LatencyHistogram
+{
+public:
+    // Creates an empty histogram
+    LatencyHistogram();
+
+    // Records a duration
+    inline void record(int64_t nanoseconds)
+    {
+        // Negative durations only happen if the clock was misused
+        uint64_t value = nanoseconds < 0 ? 0 : (uint64_t)nanoseconds;
+
+        // Count the sample (we're the only writer, so there's no need for a locked read-modify-write)
+        std::atomic<uint32_t>& bucket = buckets[bucketOf(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        // Track the exact maximum
+        if (value > maximum.load(std::memory_order_relaxed))
+        {
+            maximum.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the number of recorded samples
+    uint64_t count() const;
+
+    // Returns the (upper bound of the) given percentile (0 - 100) in nanoseconds
+    uint64_t percentile(double percent) const;
+
+    // Returns the largest recorded duration in nanoseconds
+    uint64_t max() const;
+
+private:
+    // Returns the bucket a value falls into
+    static inline size_t bucketOf(uint64_t value)
+    {
+        // Small values get a bucket each
+        if (value < LATENCY_SUB_BUCKETS)
+        {
+            return (size_t)value;
+        }
+
+        // Everything else is split into linear sub-buckets per power of two
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - LATENCY_SUB_BUCKET_BITS;
+        return (size_t)(exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + (size_t)((value >> shift) & (LATENCY_SUB_BUCKETS - 1));
+    }
+
+    // Returns the largest value that falls into a bucket
+    static uint64_t bucketLimit(size_t index);
+
+    // The number of samples per bucket
+    std::atomic<uint32_t> buckets[LATENCY_BUCKETS];
+
+    // The number of samples
+    std::atomic<uint64_t> total;
+
+    // The largest sample
+    std::atomic<uint64_t> maximum;
+};
+
+// The latency histograms of a single guitar
+class LatencyStats
+{
+public:
+    // Creates empty statistics
+    LatencyStats();
+
+    // Returns the monotonic clock in nanoseconds
+    static inline int64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // Records the arrival of a frame (updates the frame interval and jitter)
+    void recordArrival(int64_t arrival);
+
+    // Records the duration of a stage
+    inline void record(LatencyStages stage, int64_t nanoseconds)
+    {
+        histograms[stage].record(nanoseconds);
+    }
+
+    // Returns the histogram of a stage
+    const LatencyHistogram& get(LatencyStages stage) const;
+
+    // Returns the frame interval jitter (RFC 3550 style smoothed mean deviation) in nanoseconds
+    uint64_t jitter() const;
+
+    // Returns the name of a stage
+    static const char* stageName(LatencyStages stage);
+
+private:
+    // The per-stage histograms
+    LatencyHistogram histograms[Latency_StageCount];
+
+    // The arrival time of the previous frame (0 = none yet)
+    int64_t lastArrival;
+
+    // The interval between the previous two frames (0 = none yet)
+    int64_t lastInterval;
+
+    // The smoothed frame interval jitter
+    std::atomic<uint64_t> smoothedJitter;
+};
+
+#endif // LATENCY_H
@@ -2,17 +2,39 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <errno.h>
 #include <getopt.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gprintf.h>
-#include <gattlib.h>
+#include <glib-unix.h>
+#include <algorithm>
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
 #include <csignal>
 
 #include "guitar.h"
+#include "address.h"
+#include "devicecache.h"
+#include "transport.h"
+#include "multitransport.h"
+#include "recording.h"
+#include "registry.h"
+#include "gamepadpool.h"
+#include "connectscheduler.h"
+#include "stats.h"
+#include "scanner.h"
+#include "statesink.h"
 
 // Reference code taken from:
 // https://github.com/joprietoe/gdbus/blob/master/gdbus-example-server.c
@@ -26,6 +48,9 @@ static const gchar g_introspection_xml[] =
 "<node>"
 "  <interface name='com.blackseraph.ghlble'>"
 "    <method name='StartScan'/>"
+"    <method name='StartScanWithPolicy'>"
+"      <arg type='a{sv}' name='policy' direction='in'/>"
+"    </method>"
 "    <method name='StopScan'/>"
 "    <method name='GetScanStatus'>"
 "      <arg type='b' name='status' direction='out'/>"
@@ -33,6 +58,29 @@ static const gchar g_introspection_xml[] =
 "    <method name='GetConnectedDevices'>"
 "      <arg type='as' name='mac_addresses' direction='out'/>"
 "    </method>"
+"    <method name='ReloadProfiles'>"
+"      <arg type='b' name='valid' direction='out'/>"
+"    </method>"
+"    <method name='GetLatencyStats'>"
+"      <arg type='s' name='mac_address' direction='in'/>"
+"      <arg type='a{s(ttttt)}' name='stages' direction='out'/>"
+"      <arg type='t' name='jitter' direction='out'/>"
+"    </method>"
+"    <method name='GetStats'>"
+"      <arg type='a{st}' name='daemon' direction='out'/>"
+"      <arg type='a{sa{st}}' name='guitars' direction='out'/>"
+"    </method>"
+"    <signal name='GuitarConnected'>"
+"      <arg type='s' name='mac_address'/>"
+"    </signal>"
+"    <signal name='GuitarDisconnected'>"
+"      <arg type='s' name='mac_address'/>"
+"    </signal>"
+"    <signal name='ScanStatusChanged'>"
+"      <arg type='b' name='status'/>"
+"    </signal>"
+"    <property type='b' name='ScanStatus' access='read'/>"
+"    <property type='as' name='ConnectedDevices' access='read'/>"
 "  </interface>"
 "</node>";
 
@@ -45,89 +93,472 @@ static GMainLoop * g_main_loop;
 // The control object registration ID
 static guint g_control_object_registration_id;
 
-// The Bluetooth scanning state
+// The connection the control object is exported on (signals are emitted on it)
+static GDBusConnection* g_dbus_connection;
+
+// The addresses of the streaming guitars in connection order (main loop only)
+static std::vector<std::string> g_connected_addresses;
+
+// The ConnectedDevices property, rebuilt whenever a guitar connects or disconnects (main loop only)
+static GVariant* g_connected_devices;
+
+// The guitars whose connection changed since the main loop last looked (and whether they connected)
+static std::vector<std::pair<uint64_t, bool>> g_connection_changes;
+
+// Guards the connection changes
+static std::mutex g_connection_changes_mutex;
+
+// The Bluetooth scanning state (main loop only)
 static gboolean g_is_scanning;
 
-// The Bluetooth adapter
-static gattlib_adapter_t* g_adapter;
+// The subscription to the daemon's signals (watch client only)
+static guint g_signal_subscription_id;
+
+// The transport guitars are reached through (NULL unless it's open)
+static std::unique_ptr<Transport> g_transport;
+
+// The transport specification (see Transport::create)
+#ifdef GHLBLE_WITH_BLUEZ
+static std::string g_transport_specification = "bluez";
+#else
+static std::string g_transport_specification = "sim";
+#endif
 
-// The Bluetooth scanning thread
-std::unique_ptr<std::thread> g_bluetooth_scanning_thread;
+// How guitars are spread over several adapters (see MultiTransport)
+static std::string g_balance_options;
 
-// The connected guitars
-static std::vector<std::unique_ptr<Guitar>> g_guitars;
+// The scan policy used unless StartScanWithPolicy asks for another one
+static ScanPolicy g_scan_policy = g_default_scan_policy;
+
+// The known guitars
+static GuitarRegistry g_guitars;
 
 // The invoke result
 static int g_invoke_result;
 
+// The way guitars deliver their input data
+static GuitarInputModes g_input_mode = InputMode_Poll;
+
+// Whether all guitars are driven from a single event loop instead of a thread each
+static bool g_use_reactor = false;
+
+// The number of worker threads for blocking GATT operations (reactor engine only)
+static size_t g_worker_count = 0;
+
+// The event loop driving all guitars (reactor engine only)
+static std::unique_ptr<Reactor> g_reactor;
+
+// Whether received frames are handed to a separate emitter thread
+static bool g_use_pipeline = false;
+
+// The thread emitting the received frames of all guitars (pipelined mode only)
+static std::unique_ptr<Emitter> g_emitter;
+
+// The number of anonymous virtual gamepads to keep ready for guitars we haven't seen yet
+static size_t g_spare_gamepads = 0;
+
+// The Unix socket metrics are served on (empty = don't serve them)
+static std::string g_metrics_path;
+
+// The listening metrics socket
+static int g_metrics_socket = -1;
+
+// The main loop source accepting metrics clients
+static guint g_metrics_source_id;
+
+// The file raw guitar input is recorded to (empty = don't record)
+static std::string g_record_path;
+
+// The shared memory object guitar states are published to (empty = don't publish them)
+static std::string g_shm_name;
+
+// The replay speed (0 = as fast as possible)
+static double g_replay_speed = 1.0;
+
+// Whether the replay has been interrupted
+static volatile sig_atomic_t g_replay_interrupted = 0;
+
+// Emits a signal of the control object (main loop only)
+static void emit_signal(const gchar* signal_name, GVariant* parameters)
+{
+    // Nobody can listen before the object is exported
+    if (g_dbus_connection == NULL || g_control_object_registration_id == 0)
+    {
+        g_variant_unref(g_variant_ref_sink(parameters));
+        return;
+    }
+
+    // Broadcast the signal
+    g_dbus_connection_emit_signal(g_dbus_connection, NULL, "/com/blackseraph/ghlble/control", "com.blackseraph.ghlble", signal_name, parameters, NULL);
+}
+
+// Announces the new value of a property (main loop only)
+static void emit_property_changed(const gchar* property_name, GVariant* value)
+{
+    // Build the change set
+    GVariantBuilder changed;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", property_name, value);
+    const gchar* const invalidated[] = { NULL };
+
+    // Emit the standard PropertiesChanged signal
+    if (g_dbus_connection != NULL && g_control_object_registration_id != 0)
+    {
+        g_dbus_connection_emit_signal(g_dbus_connection, NULL, "/com/blackseraph/ghlble/control", "org.freedesktop.DBus.Properties", "PropertiesChanged", g_variant_new("(sa{sv}^as)", "com.blackseraph.ghlble", &changed, invalidated), NULL);
+    }
+    else
+    {
+        g_variant_builder_clear(&changed);
+    }
+}
+
+// Rebuilds the ConnectedDevices property (main loop only)
+static void rebuild_connected_devices()
+{
+    // Build the new array
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+    for (const std::string& address : g_connected_addresses)
+    {
+        g_variant_builder_add(&builder, "s", address.c_str());
+    }
+
+    // Swap it in
+    if (g_connected_devices != NULL)
+    {
+        g_variant_unref(g_connected_devices);
+    }
+    g_connected_devices = g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+// Publishes the connection changes of the guitars (main loop only)
+static gboolean handle_connection_changes(gpointer /*user_data*/)
+{
+    // Take the changed guitars
+    std::vector<std::pair<uint64_t, bool>> changes;
+    {
+        std::lock_guard<std::mutex> lock(g_connection_changes_mutex);
+        changes.swap(g_connection_changes);
+    }
+
+    // Compare every guitar's current state with what the clients know (posted changes can overtake each other)
+    bool changed = false;
+    for (const auto& change : changes)
+    {
+        // Trust the posted state only for guitars that aren't (or aren't anymore) in the registry
+        bool connected = change.second;
+        {
+            Epoch::Guard guard;
+            Guitar* guitar = g_guitars.find(change.first);
+            if (guitar != NULL)
+            {
+                connected = guitar->getState() == State_Streaming;
+            }
+        }
+        std::string mac_address = unpackAddress(change.first);
+        auto known = std::find(g_connected_addresses.begin(), g_connected_addresses.end(), mac_address);
+        if (connected == (known != g_connected_addresses.end()))
+        {
+            continue;
+        }
+
+        // Update the connected guitars and let the clients know
+        if (connected)
+        {
+            g_connected_addresses.push_back(mac_address);
+        }
+        else
+        {
+            g_connected_addresses.erase(known);
+        }
+        emit_signal(connected ? "GuitarConnected" : "GuitarDisconnected", g_variant_new("(s)", mac_address.c_str()));
+        changed = true;
+    }
+
+    // Rebuild the property once for all changes and let the scan session know how many guitars are streaming
+    if (changed)
+    {
+        rebuild_connected_devices();
+        emit_property_changed("ConnectedDevices", g_connected_devices);
+        Scanner::setStreamingGuitars(g_connected_addresses.size());
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Queues a guitar's connection change for the main loop (any thread)
+static void post_connection_change(const std::string& address, bool connected)
+{
+    // Wake up the main loop unless it's already been woken up
+    std::lock_guard<std::mutex> lock(g_connection_changes_mutex);
+    if (g_connection_changes.empty())
+    {
+        g_idle_add(handle_connection_changes, NULL);
+    }
+    g_connection_changes.emplace_back(packAddress(address), connected);
+}
+
+// Applies a scan status change and publishes it (main loop only)
+static gboolean handle_scan_status_change(gpointer user_data)
+{
+    // Nothing changed
+    gboolean scanning = GPOINTER_TO_INT(user_data);
+    if (g_is_scanning == scanning)
+    {
+        return G_SOURCE_REMOVE;
+    }
+    g_is_scanning = scanning;
+
+    // Let the clients know
+    emit_signal("ScanStatusChanged", g_variant_new("(b)", scanning));
+    emit_property_changed("ScanStatus", g_variant_new_boolean(scanning));
+    return G_SOURCE_REMOVE;
+}
+
+// Hands the scanning state to the main loop, which tells the clients about it (any thread)
+static void set_scanning(gboolean scanning)
+{
+    g_idle_add(handle_scan_status_change, GINT_TO_POINTER(scanning));
+}
+
+// Takes a snapshot of the counters of all guitars
+static std::vector<GuitarSnapshot> collect_guitar_snapshots()
+{
+    std::vector<GuitarSnapshot> snapshots;
+    Epoch::Guard guard;
+    g_guitars.forEach([&snapshots](Guitar* guitar) {
+        snapshots.push_back(Stats::snapshot(guitar->getAddress(), guitar->getState() == State_Streaming, guitar->getCounters()));
+    });
+    return snapshots;
+}
+
+// Answers a metrics client (main loop only)
+static gboolean serve_metrics_client(gint fd, GIOCondition /*condition*/, gpointer /*user_data*/)
+{
+    // Read the request (all we care about is whether it's an HTTP one, plain clients get the bare metrics)
+    char request[512];
+    ssize_t length = read(fd, request, sizeof(request));
+    bool http = length >= 4 && memcmp(request, "GET ", 4) == 0;
+
+    // Render the metrics
+    std::string body = Stats::renderPrometheus(Stats::sample(), collect_guitar_snapshots());
+    std::string response;
+    if (http)
+    {
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    }
+    response += body;
+
+    // Send them (the send timeout keeps a stalled client from blocking the main loop for long)
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        ssize_t written = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            break;
+        }
+        sent += (size_t)written;
+    }
+
+    // One request per connection
+    close(fd);
+    return G_SOURCE_REMOVE;
+}
+
+// Accepts a metrics client (main loop only)
+static gboolean accept_metrics_client(gint fd, GIOCondition /*condition*/, gpointer /*user_data*/)
+{
+    // Answer the client once it has sent its request (or hung up)
+    int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client >= 0)
+    {
+        struct timeval timeout = { 1, 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        g_unix_fd_add(client, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), serve_metrics_client, NULL);
+    }
+
+    // Keep accepting clients
+    return G_SOURCE_CONTINUE;
+}
+
+// Starts serving metrics on the given Unix socket, returns false if the socket couldn't be created
+static bool open_metrics_socket(const std::string& path)
+{
+    // The path has to fit into the socket address
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // Replace the socket a previous run left behind (but nothing else)
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+    {
+        unlink(path.c_str());
+    }
+
+    // Listen for clients
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 8) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    // Accept them on the main loop
+    g_metrics_socket = fd;
+    g_metrics_source_id = g_unix_fd_add(fd, G_IO_IN, accept_metrics_client, NULL);
+    return true;
+}
+
+// Stops serving metrics
+static void close_metrics_socket()
+{
+    // We're not serving metrics
+    if (g_metrics_socket < 0)
+    {
+        return;
+    }
+
+    // Stop accepting clients and remove the socket
+    g_source_remove(g_metrics_source_id);
+    g_metrics_source_id = 0;
+    close(g_metrics_socket);
+    g_metrics_socket = -1;
+    unlink(g_metrics_path.c_str());
+}
+
 // The Bluetooth device discovery callback
-static void ble_discovered_device(gattlib_adapter_t* adapter, const char* addr, const char* name, void *user_data)
+static void ble_discovered_device(const std::string& addr, const std::string& name)
 {
     // We've discovered a new guitar
-    if (name != NULL && addr != NULL && strcmp(name, "Ble Guitar") == 0)
+    uint64_t address = name == TRANSPORT_GUITAR_NAME ? packAddress(addr) : 0;
+    if (address != 0)
     {
-        // Iterate the cached guitars
-        for (const auto& guitar : g_guitars)
+        // It's in range and switched on, so it gets the next free connection slot
+        ConnectScheduler::markSeen(address);
+
+        // We already know the guitar
         {
-            // We've found an already known guitar
-            if (guitar->getAddress() == addr)
+            Epoch::Guard guard;
+            Guitar* guitar = g_guitars.find(address);
+            if (guitar != NULL)
             {
-                // Log the known guitar
-                g_print("Ignoring the already known Guitar (%s).", addr);
-
-                // Ignore known guitars
+                // It's advertising, so connect right away if it's been absent
+                guitar->reconnect();
                 return;
             }
         }
 
-        // Guitar doesn't exist yet, create and add it
-        g_guitars.push_back(std::make_unique<Guitar>(adapter, addr));
+        // Guitar doesn't exist yet, create and add it (outside of the guard, clearing the registry waits for readers)
+        g_guitars.add(address, [&addr]() { return std::make_unique<Guitar>(g_transport.get(), addr, g_input_mode, g_reactor.get(), g_emitter.get()); });
     }
 }
 
-// The Bluetooth scanning thread
-static void bluetooth_scanning_thread()
+// The scan session state listener (on the scan thread)
+static void handle_scan_state(ScanStates state)
 {
-    // We've got an open adapter
-    if (g_adapter != NULL)
+    // A session is running (a suspended one resumes as soon as a guitar drops)
+    if (state != Scan_Off)
     {
-        // Set the scanning state
-        g_is_scanning = TRUE;
+        // Log the event
+        g_print(state == Scan_Active ? "Scanning\n" : "Scan suspended\n");
 
-        // Log the call
-        g_print("Starting scan\n");
+        // Absent guitars can wait for advertisements now
+        Guitar::setScanning(true);
 
-        // Scan for Bluetooth devices
-        gattlib_adapter_scan_enable(g_adapter, ble_discovered_device, 0, NULL);
+        // Set the scanning state
+        set_scanning(TRUE);
+    }
 
-        // Log the call
+    // The session has ended
+    else
+    {
+        // Log the event
         g_print("Scan has ended\n");
 
-        // Stop scanning
-        gattlib_adapter_scan_disable(g_adapter);
+        // Absent guitars won't be woken up by advertisements anymore, let them retry on their own
+        Guitar::setScanning(false);
+        g_guitars.forEach([](Guitar* guitar) { guitar->reconnect(); });
 
         // Set the scanning state
-        g_is_scanning = FALSE;
+        set_scanning(FALSE);
+    }
+}
+
+// Reads a scan policy from StartScanWithPolicy's options, returns false if they contained errors
+static bool parse_scan_policy(GVariant* options, ScanPolicy* policy)
+{
+    // Start out with the daemon's policy
+    *policy = g_scan_policy;
+
+    // Apply the options
+    GVariantIter iter;
+    const gchar* key;
+    GVariant* value;
+    bool valid = true;
+    g_variant_iter_init(&iter, options);
+    while (valid && g_variant_iter_next(&iter, "{&sv}", &key, &value))
+    {
+        if (g_strcmp0(key, "window") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+        {
+            policy->window = g_variant_get_uint32(value);
+        }
+        else if (g_strcmp0(key, "interval") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+        {
+            policy->interval = g_variant_get_uint32(value);
+        }
+        else if (g_strcmp0(key, "expected") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32))
+        {
+            policy->expectedGuitars = g_variant_get_uint32(value);
+        }
+        else if (g_strcmp0(key, "resume") == 0 && g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+        {
+            policy->resume = g_variant_get_boolean(value);
+        }
+        else
+        {
+            valid = false;
+        }
+        g_variant_unref(value);
     }
+    return valid && Scanner::isValidPolicy(*policy);
 }
 
 // Executes methods
 static void handle_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *method_name, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data)
 {
-    if (g_strcmp0(method_name, "StartScan") == 0)
+    if (g_strcmp0(method_name, "StartScan") == 0 || g_strcmp0(method_name, "StartScanWithPolicy") == 0)
     {
-        // We've got an open adapter and aren't scanning yet
-        if (g_adapter != NULL && !g_is_scanning)
+        // Read the policy (plain StartScan uses the daemon's)
+        ScanPolicy policy = g_scan_policy;
+        if (g_strcmp0(method_name, "StartScanWithPolicy") == 0)
         {
-            // We've got a live Bluetooth scanning thread
-            if (g_bluetooth_scanning_thread != NULL && g_bluetooth_scanning_thread->joinable())
+            GVariant* options = g_variant_get_child_value(parameters, 0);
+            bool valid = parse_scan_policy(options, &policy);
+            g_variant_unref(options);
+            if (!valid)
             {
-                // Wait for the thread to finish
-                g_bluetooth_scanning_thread->join();
+                g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid scan policy");
+                return;
             }
+        }
 
-            // Create the Bluetooth scanning thread
-            g_bluetooth_scanning_thread = std::make_unique<std::thread>(bluetooth_scanning_thread);
+        // We've got an open adapter, (re)start the scan session with the policy
+        if (g_transport)
+        {
+            Scanner::start(g_transport.get(), ble_discovered_device, policy);
         }
 
         // Let the caller know his request was received
@@ -135,19 +566,9 @@ static void handle_method_call(GDBusConnection *connection, const gchar *sender,
     }
     else if (g_strcmp0(method_name, "StopScan") == 0)
     {
-        // We've got an open adapter and are currently scanning
-        if (g_adapter != NULL && g_is_scanning)
+        // We've got an open adapter and a scan session is running or starting (the main loop may not have heard of it yet)
+        if (g_transport && Scanner::stop())
         {
-            // Stop scanning
-            gattlib_adapter_scan_disable(g_adapter);
-
-            // We've got a live Bluetooth scanning thread
-            if (g_bluetooth_scanning_thread != NULL && g_bluetooth_scanning_thread->joinable())
-            {
-                // Wait for the thread to finish
-                g_bluetooth_scanning_thread->join();
-            }
-
             // Log the call
             g_print("Disabled scanning\n");
         }
@@ -162,16 +583,79 @@ static void handle_method_call(GDBusConnection *connection, const gchar *sender,
     }
     else if (g_strcmp0(method_name, "GetConnectedDevices") == 0)
     {
-        // Return the connected guitars
+        // Return the connected guitars (the cached array, not a copy)
+        g_dbus_method_invocation_return_value(invocation, g_variant_new_tuple(&g_connected_devices, 1));
+    }
+    else if (g_strcmp0(method_name, "ReloadProfiles") == 0)
+    {
+        // Recompile and publish the mapping profiles
+        gboolean valid = Profiles::reload();
+
+        // Let the caller know whether all profiles were valid
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(b)", valid));
+    }
+    else if (g_strcmp0(method_name, "GetLatencyStats") == 0)
+    {
+        // Find the requested guitar
+        const gchar* mac_address;
+        g_variant_get(parameters, "(&s)", &mac_address);
+        uint64_t address = packAddress(mac_address);
+        Epoch::Guard guard;
+        Guitar* guitar = address != 0 ? g_guitars.find(address) : NULL;
+        if (guitar != NULL)
+        {
+            // Return the count, p50, p90, p99 and max (in nanoseconds) of every stage
+            const LatencyStats& latency = guitar->getLatency();
+            GVariantBuilder builder;
+            g_variant_builder_init(&builder, G_VARIANT_TYPE("(a{s(ttttt)}t)"));
+            g_variant_builder_open(&builder, G_VARIANT_TYPE("a{s(ttttt)}"));
+            for (int stage = 0; stage < Latency_StageCount; stage++)
+            {
+                const LatencyHistogram& histogram = latency.get((LatencyStages)stage);
+                g_variant_builder_add(&builder, "{s(ttttt)}", LatencyStats::stageName((LatencyStages)stage), (guint64)histogram.count(), (guint64)histogram.percentile(50), (guint64)histogram.percentile(90), (guint64)histogram.percentile(99), (guint64)histogram.max());
+            }
+            g_variant_builder_close(&builder);
+            g_variant_builder_add(&builder, "t", (guint64)latency.jitter());
+            g_dbus_method_invocation_return_value(invocation, g_variant_builder_end(&builder));
+            return;
+        }
+
+        // We don't know that guitar
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Unknown guitar %s", mac_address);
+    }
+    else if (g_strcmp0(method_name, "GetStats") == 0)
+    {
+        // Take a snapshot of the daemon and all guitars
+        ProcessStats process = Stats::sample();
+        std::vector<GuitarSnapshot> guitars = collect_guitar_snapshots();
+        guint64 streaming = (guint64)std::count_if(guitars.begin(), guitars.end(), [](const GuitarSnapshot& guitar) { return guitar.streaming; });
+
+        // Return the daemon's resource usage
         GVariantBuilder builder;
-        g_variant_builder_init(&builder, G_VARIANT_TYPE("(as)"));
-        g_variant_builder_open(&builder, G_VARIANT_TYPE("as"));
-        for (const auto& guitar : g_guitars)
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("(a{st}a{sa{st}})"));
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("a{st}"));
+        g_variant_builder_add(&builder, "{st}", "threads", (guint64)process.threads);
+        g_variant_builder_add(&builder, "{st}", "resident_bytes", (guint64)process.residentBytes);
+        g_variant_builder_add(&builder, "{st}", "cpu_time_ns", (guint64)process.cpuNanoseconds);
+        g_variant_builder_add(&builder, "{st}", "uptime_ns", (guint64)process.uptimeNanoseconds);
+        g_variant_builder_add(&builder, "{st}", "guitars", (guint64)guitars.size());
+        g_variant_builder_add(&builder, "{st}", "streaming_guitars", streaming);
+        g_variant_builder_close(&builder);
+
+        // And the counters of every guitar
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("a{sa{st}}"));
+        for (const GuitarSnapshot& guitar : guitars)
         {
-            if (guitar->isConnected())
+            g_variant_builder_open(&builder, G_VARIANT_TYPE("{sa{st}}"));
+            g_variant_builder_add(&builder, "s", guitar.address.c_str());
+            g_variant_builder_open(&builder, G_VARIANT_TYPE("a{st}"));
+            g_variant_builder_add(&builder, "{st}", "streaming", (guint64)(guitar.streaming ? 1 : 0));
+            for (int counter = 0; counter < Counter_Count; counter++)
             {
-                g_variant_builder_add(&builder, "s", guitar->getAddress().c_str());
+                g_variant_builder_add(&builder, "{st}", GuitarCounters::counterName((GuitarCounterIds)counter), (guint64)guitar.counters[counter]);
             }
+            g_variant_builder_close(&builder);
+            g_variant_builder_close(&builder);
         }
         g_variant_builder_close(&builder);
         g_dbus_method_invocation_return_value(invocation, g_variant_builder_end(&builder));
@@ -191,6 +675,19 @@ static GVariant * handle_get_property(GDBusConnection *connection, const gchar *
         ret = g_variant_new_boolean(g_is_scanning);
     }
 
+    // The caller wants to know the connected guitars
+    else if (g_strcmp0(property_name, "ConnectedDevices") == 0)
+    {
+        // Return the cached array (GDBus drops the reference we hand out)
+        ret = g_variant_ref(g_connected_devices);
+    }
+
+    // We don't know that property (GDBus rejects undeclared ones before asking us)
+    else
+    {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "Unknown property %s", property_name);
+    }
+
     // Return the property
     return ret;
 }
@@ -198,8 +695,9 @@ static GVariant * handle_get_property(GDBusConnection *connection, const gchar *
 // Sets object properties
 static gboolean handle_set_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *property_name, GVariant *value, GError **error, gpointer user_data)
 {
-    // We don't support setting properties yet
-    return TRUE;
+    // All properties are read-only (GDBus rejects writes to them before asking us)
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY, "Property %s is read-only", property_name);
+    return FALSE;
 }
 
 // The DBus interface's virtual function table
@@ -213,19 +711,8 @@ static const GDBusInterfaceVTable interface_vtable =
 // Quits the main loop
 static void quitMainLoop()
 {
-    // We've got an open adapter
-    if (g_adapter != NULL)
-    {
-        // Stop scanning
-        gattlib_adapter_scan_disable(g_adapter);
-    }
-
-    // We've got a live Bluetooth scanning thread
-    if (g_bluetooth_scanning_thread != NULL && g_bluetooth_scanning_thread->joinable())
-    {
-        // Wait for the thread to finish
-        g_bluetooth_scanning_thread->join();
-    }
+    // End the scan session
+    Scanner::stop();
 
     // Disconnect all guitars
     g_guitars.clear();
@@ -241,6 +728,9 @@ static void quitMainLoop()
 // The bus acquired callback
 static void on_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
 {
+    // Remember the connection for signals
+    g_dbus_connection = connection;
+
     // Register the control object
     g_control_object_registration_id = g_dbus_connection_register_object(connection, "/com/blackseraph/ghlble/control", g_introspection_data->interfaces[0], &interface_vtable, NULL /* user_data */, NULL /* user_data_free_func */, NULL /* GError** */);
 
@@ -267,8 +757,8 @@ static void on_name_acquired(GDBusConnection *connection, const gchar *name, gpo
     // Log the event
     g_print("Aquired the name\n");
 
-    // Create the Bluetooth scanning thread
-    g_bluetooth_scanning_thread = std::make_unique<std::thread>(bluetooth_scanning_thread);
+    // Start the scan session
+    Scanner::start(g_transport.get(), ble_discovered_device, g_scan_policy);
 }
 
 static void on_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data)
@@ -282,11 +772,43 @@ static void on_name_lost(GDBusConnection *connection, const gchar *name, gpointe
 
 static void toggle_scanning(GDBusConnection *connection, const gchar *name, const gchar *name_owner, gpointer user_data)
 {
-    // Check if pairing should be enabled or disabled
-    bool enabled = (bool)user_data;
+    // Check if scanning should be enabled or disabled ("on" can carry a policy, "on:window=200,interval=1000")
+    std::string argument = (const char*)user_data;
+    bool enabled = argument == "on" || argument.compare(0, 3, "on:") == 0;
+    bool withPolicy = argument.compare(0, 3, "on:") == 0;
 
     // Prepare the method name based on the desired state
-    const gchar* method_name = enabled ? "StartScan" : "StopScan";
+    const gchar* method_name = withPolicy ? "StartScanWithPolicy" : enabled ? "StartScan" : "StopScan";
+
+    // Turn the policy options into StartScanWithPolicy's parameters (the daemon checks them and fills in what's missing)
+    GVariant* parameters = NULL;
+    if (withPolicy)
+    {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        std::stringstream stream(argument.substr(3));
+        std::string option;
+        while (std::getline(stream, option, ','))
+        {
+            // Split the pair
+            size_t separator = option.find('=');
+            char* end = NULL;
+            unsigned long value = separator != std::string::npos ? strtoul(option.c_str() + separator + 1, &end, 10) : 0;
+            if (end == NULL || *end != '\0' || end == option.c_str() + separator + 1 || value > UINT32_MAX)
+            {
+                g_printerr("Invalid scan option \"%s\"\n", option.c_str());
+                g_variant_builder_clear(&builder);
+                g_invoke_result = 1;
+                quitMainLoop();
+                return;
+            }
+
+            // The resume option is a flag, everything else a number
+            std::string key = option.substr(0, separator);
+            g_variant_builder_add(&builder, "{sv}", key.c_str(), key == "resume" ? g_variant_new_boolean(value != 0) : g_variant_new_uint32((guint32)value));
+        }
+        parameters = g_variant_new("(a{sv})", &builder);
+    }
 
     // Invoke the method on the daemon
     GError* error = NULL;
@@ -296,7 +818,7 @@ static void toggle_scanning(GDBusConnection *connection, const gchar *name, cons
         "/com/blackseraph/ghlble/control",  // Object path
         "com.blackseraph.ghlble",           // Interface name
         method_name,                        // Method name
-        NULL,                               // Parameters
+        parameters,                         // Parameters
         NULL,                               // Expected reply type
         G_DBUS_CALL_FLAGS_NONE,
         -1,                                 // Timeout (default)
@@ -405,6 +927,145 @@ static void get_connected_devices(GDBusConnection *connection, const gchar *name
     quitMainLoop();
 }
 
+// Prints a signal of the daemon
+static void print_signal(GDBusConnection * /*connection*/, const gchar * /*sender_name*/, const gchar * /*object_path*/, const gchar * /*interface_name*/, const gchar *signal_name, GVariant *parameters, gpointer /*user_data*/)
+{
+    // Print the signal and its arguments
+    gchar* arguments = g_variant_print(parameters, FALSE);
+    g_print("%s %s\n", signal_name, arguments);
+    g_free(arguments);
+}
+
+static void watch_signals(GDBusConnection *connection, const gchar *name, const gchar *name_owner, gpointer /*user_data*/)
+{
+    // The daemon was restarted, drop the subscription to its previous instance
+    if (g_signal_subscription_id != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(connection, g_signal_subscription_id);
+    }
+
+    // Subscribe to the daemon's signals (we keep running until we're interrupted)
+    g_signal_subscription_id = g_dbus_connection_signal_subscribe(connection, name_owner, NULL, NULL, "/com/blackseraph/ghlble/control", NULL, G_DBUS_SIGNAL_FLAGS_NONE, print_signal, NULL, NULL);
+    g_print("Watching %s (press Ctrl+C to stop)\n", name);
+    g_invoke_result = 0;
+}
+
+static void get_latency_stats(GDBusConnection *connection, const gchar * /*name*/, const gchar * /*name_owner*/, gpointer user_data)
+{
+    // Invoke the method on the daemon
+    GError* error = NULL;
+    GVariant* result = g_dbus_connection_call_sync(
+        connection,
+        "com.blackseraph.ghlble",           // Name of the service
+        "/com/blackseraph/ghlble/control",  // Object path
+        "com.blackseraph.ghlble",           // Interface name
+        "GetLatencyStats",                  // Method name
+        g_variant_new("(s)", (const gchar*)user_data),  // Parameters
+        G_VARIANT_TYPE("(a{s(ttttt)}t)"),   // Expected return type (stage statistics and jitter)
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,                                 // Timeout (default)
+        NULL,                               // GCancellable
+        &error                              // GError
+    );
+
+    // Check for errors
+    if (error != NULL)
+    {
+        g_printerr("Error calling GetLatencyStats: %s\n", error->message);
+        g_error_free(error);
+        g_invoke_result = 1;  // Indicate failure
+    }
+    else
+    {
+        GVariant *stages = g_variant_get_child_value(result, 0);
+        GVariant *jitter = g_variant_get_child_value(result, 1);
+        gchar *stage;
+        guint64 count, p50, p90, p99, max;
+        GVariantIter iter;
+        g_variant_iter_init(&iter, stages);
+        g_print("%-10s %10s %10s %10s %10s %10s\n", "stage", "count", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+        while (g_variant_iter_next(&iter, "{s(ttttt)}", &stage, &count, &p50, &p90, &p99, &max))
+        {
+            g_print("%-10s %10" G_GUINT64_FORMAT " %10.1f %10.1f %10.1f %10.1f\n", stage, count, p50 / 1000.0, p90 / 1000.0, p99 / 1000.0, max / 1000.0);
+            g_free(stage);  // Free each string after use
+        }
+        g_print("Frame interval jitter: %.1f us\n", g_variant_get_uint64(jitter) / 1000.0);
+        g_variant_unref(jitter);
+        g_variant_unref(stages);
+        g_variant_unref(result);
+        g_invoke_result = 0;  // Indicate success
+    }
+
+    // Quit the main loop
+    quitMainLoop();
+}
+
+// Prints a dictionary of counters
+static void print_counters(GVariant* counters)
+{
+    gchar *name;
+    guint64 value;
+    GVariantIter iter;
+    g_variant_iter_init(&iter, counters);
+    while (g_variant_iter_next(&iter, "{st}", &name, &value))
+    {
+        g_print("  %-20s %" G_GUINT64_FORMAT "\n", name, value);
+        g_free(name);  // Free each string after use
+    }
+}
+
+static void get_stats(GDBusConnection *connection, const gchar * /*name*/, const gchar * /*name_owner*/, gpointer /*user_data*/)
+{
+    // Invoke the method on the daemon
+    GError* error = NULL;
+    GVariant* result = g_dbus_connection_call_sync(
+        connection,
+        "com.blackseraph.ghlble",           // Name of the service
+        "/com/blackseraph/ghlble/control",  // Object path
+        "com.blackseraph.ghlble",           // Interface name
+        "GetStats",                         // Method name
+        NULL,                               // Parameters
+        G_VARIANT_TYPE("(a{st}a{sa{st}})"), // Expected return type (daemon and per-guitar counters)
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,                                 // Timeout (default)
+        NULL,                               // GCancellable
+        &error                              // GError
+    );
+
+    // Check for errors
+    if (error != NULL)
+    {
+        g_printerr("Error calling GetStats: %s\n", error->message);
+        g_error_free(error);
+        g_invoke_result = 1;  // Indicate failure
+    }
+    else
+    {
+        GVariant *daemon = g_variant_get_child_value(result, 0);
+        GVariant *guitars = g_variant_get_child_value(result, 1);
+        g_print("Daemon:\n");
+        print_counters(daemon);
+        gchar *mac_address;
+        GVariant *counters;
+        GVariantIter iter;
+        g_variant_iter_init(&iter, guitars);
+        while (g_variant_iter_next(&iter, "{s@a{st}}", &mac_address, &counters))
+        {
+            g_print("Guitar (%s):\n", mac_address);
+            print_counters(counters);
+            g_variant_unref(counters);
+            g_free(mac_address);
+        }
+        g_variant_unref(guitars);
+        g_variant_unref(daemon);
+        g_variant_unref(result);
+        g_invoke_result = 0;  // Indicate success
+    }
+
+    // Quit the main loop
+    quitMainLoop();
+}
+
 static void on_name_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data)
 {
     // Print the error
@@ -417,15 +1078,31 @@ static void on_name_vanished(GDBusConnection *connection, const gchar *name, gpo
     quitMainLoop();
 }
 
-// The signal handler function
-static void handleSignal(int signal)
+// The profile reload signal handler (runs on the main loop)
+static gboolean handle_reload_signal(gpointer /*user_data*/)
 {
-    // We're being asked to stop
-    if (signal == SIGTERM || signal == SIGINT)
-    {
-        // Quit the main loop
-        quitMainLoop();
-    }
+    // Recompile and publish the mapping profiles
+    Profiles::reload();
+
+    // Keep listening for the signal
+    return G_SOURCE_CONTINUE;
+}
+
+// The termination signal handler (runs on the main loop, so it may join threads and destroy guitars)
+static gboolean handle_quit_signal(gpointer /*user_data*/)
+{
+    // Quit the main loop
+    quitMainLoop();
+
+    // Keep listening for the signal until the loop ends
+    return G_SOURCE_CONTINUE;
+}
+
+// The replay's signal handler function
+static void handle_replay_signal(int /*signal*/)
+{
+    // Stop after the current frame
+    g_replay_interrupted = 1;
 }
 
 // Prints the usage
@@ -435,17 +1112,39 @@ void print_usage()
     g_print(
         "Usage:\n"
         "\t--daemon\tRuns the Guitar Hero Live daemon\n"
-        "\t--scan=[on|off]\tToggles guitar scanning on or off or reads the current setting\n"
+        "\t--scan=[on[:OPTIONS]|off]\tToggles guitar scanning on or off or reads the current setting, OPTIONS override the daemon's scan policy, e.g. on:window=200,interval=1000,expected=4\n"
         "\t--guitars\tShows connected guitars\n"
+        "\t--latency=MAC\tShows the input latency statistics of a guitar\n"
+        "\t--watch\tPrints guitars connecting and disconnecting and scan status changes as they happen\n"
+        "\t--stats\tShows the daemon's resource usage and the throughput and health counters of all guitars\n"
+        "\t--input=[poll|notify]\tReads guitar input by polling (default) or via GATT notifications (daemon only)\n"
+        "\t--profiles=DIR\tLoads mapping profiles from DIR (default: $XDG_CONFIG_HOME/ghlble, daemon only)\n"
+        "\t--engine=[threads|reactor]\tDrives each guitar from its own thread (default) or all guitars from one event loop (daemon only, implies --input=notify)\n"
+        "\t--workers=N\tRuns blocking GATT operations on N worker threads (reactor engine only, default: 0)\n"
+        "\t--cache=FILE\tRemembers known guitars in FILE (default: $XDG_CACHE_HOME/ghlble/devices.bin, daemon only)\n"
+        "\t--transport=bluez|sim|hidraw[:OPTIONS]\tTalks to real guitars (default), simulated ones, e.g. sim:guitars=4,rate=125,jitter=500, or the USB dongles of the console versions, e.g. hidraw:keepalive=8000, several joined by + spread the guitars over them, e.g. bluez:hci0+bluez:hci1 or bluez:all (daemon only)\n"
+        "\t--balance=OPTIONS\tAssigns guitars to the adapter with the fewest links or the lowest jitter (balance=links|latency) and moves guitars whose jitter stays above degraded=US for patience=S to another adapter, avoiding the old one for avoid=S (default: balance=links,degraded=2000,patience=5,avoid=60, daemon only)\n"
+        "\t--sink=uinput|capture[:DIR]|none\tFeeds virtual gamepads (default), captures their raw events in DIR (discards them without DIR) or creates none, e.g. along with --shm (daemon only)\n"
+        "\t--shm[=NAME]\tPublishes every guitar's decoded state to the shared memory object NAME for lock-free readers, see sharedstate.h (default: /ghlble, daemon only)\n"
+        "\t--analog-rate=HZ\tReports whammy and tilt changes on their own at most HZ times per second per guitar, buttons always go out at once (0 = no cap, default: 250)\n"
+        "\t--gamepad-grace=SECONDS\tKeeps the virtual gamepad of a dropped guitar for SECONDS so it can reconnect unnoticed (0 removes it right away, default: 30)\n"
+        "\t--scan-policy=OPTIONS\tScans in windows of window=MS every interval=MS, stops once expected=N guitars are streaming and resumes when one drops unless resume=0 (default: scans continuously, daemon only)\n"
+        "\t--connect-limit=N\tLets at most N guitars connect at the same time, recently seen and cached ones first (0 = no limit, default: 2, daemon only)\n"
+        "\t--spare-gamepads=N\tKeeps N virtual gamepads ready for guitars that haven't been seen before (daemon only, default: 0)\n"
+        "\t--pipeline\tHands received frames to a separate emitter thread that writes them in batches (daemon only)\n"
+        "\t--metrics=PATH\tServes the stats as Prometheus metrics on the Unix socket PATH, e.g. for curl --unix-socket PATH http://localhost/metrics (daemon only)\n"
+        "\t--record=FILE\tAppends the raw input of all guitars to FILE (daemon only)\n"
+        "\t--replay=FILE\tFeeds the input recorded in FILE to virtual gamepads\n"
+        "\t--speed=N|max\tReplays N times faster than recorded (default: 1) or as fast as possible\n"
     );
 }
 
 // Executes the given callback upon the appearance of the name
 int execute_with_callbacks(GBusNameAppearedCallback appeared_callback, gpointer user_data)
 {
-    // Install signal handlers
-    std::signal(SIGTERM, handleSignal);
-    std::signal(SIGINT, handleSignal);
+    // Quit on SIGTERM and SIGINT (handled on the main loop)
+    g_unix_signal_add(SIGTERM, handle_quit_signal, NULL);
+    g_unix_signal_add(SIGINT, handle_quit_signal, NULL);
 
     // Watch the name
     guint watcher_id = g_bus_watch_name(
@@ -473,18 +1172,118 @@ int execute_with_callbacks(GBusNameAppearedCallback appeared_callback, gpointer
 // Runs the daemon
 int run_daemon()
 {
-    // Install signal handlers
-    std::signal(SIGTERM, handleSignal);
-    std::signal(SIGINT, handleSignal);
+    // Quit on SIGTERM and SIGINT (handled on the main loop)
+    g_unix_signal_add(SIGTERM, handle_quit_signal, NULL);
+    g_unix_signal_add(SIGINT, handle_quit_signal, NULL);
+
+    // Reload the mapping profiles on SIGHUP
+    g_unix_signal_add(SIGHUP, handle_reload_signal, NULL);
+
+    // Start the uptime clock
+    Stats::start();
+
+    // Load the mapping profiles
+    Profiles::reload();
+
+    // We've been asked to drive all guitars from a single event loop
+    if (g_use_reactor)
+    {
+        // The event loop can't block on polling reads
+        if (g_input_mode != InputMode_Notify)
+        {
+            g_print("The reactor engine requires notifications, switching to --input=notify\n");
+            g_input_mode = InputMode_Notify;
+        }
+
+        // Start the event loop
+        g_reactor = std::make_unique<Reactor>();
+        if (!g_reactor->start(g_worker_count))
+        {
+            g_print("Failed to start the event loop\n");
+            return errno;
+        }
+    }
+
+    // We've been asked to emit the received frames on a thread of their own
+    if (g_use_pipeline)
+    {
+        // Start the emitter
+        g_emitter = std::make_unique<Emitter>();
+        if (!g_emitter->start())
+        {
+            g_print("Failed to start the emitter\n");
+            return errno;
+        }
+    }
 
-    // Open the Bluetooth adapter
-    int result = gattlib_adapter_open(NULL, &g_adapter);
+    // Open the Bluetooth adapter (or whatever stands in for it)
+    int result = ENODEV;
+    g_transport = Transport::create(g_transport_specification);
+    MultiTransport* adapters = dynamic_cast<MultiTransport*>(g_transport.get());
+    if (adapters != NULL && !adapters->configure(g_balance_options))
+    {
+        g_transport.reset();
+    }
+    if (g_transport && g_transport->open())
+    {
+        result = 0;
+    }
+    else
+    {
+        g_transport.reset();
+    }
 
     // We managed to open the Bluetooth adapter
-    if (result == GATTLIB_SUCCESS)
+    if (result == 0)
     {
         // Log the event
-        g_print("Opened the Bluetooth adapter\n");
+        g_print("Opened the Bluetooth adapter (%s)\n", g_transport->getName());
+
+        // Tell D-Bus clients about guitars connecting and disconnecting (nothing's connected yet)
+        rebuild_connected_devices();
+        Guitar::setConnectionListener(post_connection_change);
+
+        // Follow the scan session (it suspends and resumes itself depending on the policy)
+        Scanner::setStateListener(handle_scan_state);
+
+        // Create the virtual gamepads of known guitars (and the spares) ahead of time
+        GamepadPool::start(g_spare_gamepads);
+
+        // Record the raw guitar input
+        if (!g_record_path.empty())
+        {
+            Recorder::open(g_record_path);
+        }
+
+        // Publish the guitar states to shared memory readers
+        if (!g_shm_name.empty())
+        {
+            StateSink::open(g_shm_name);
+        }
+
+        // Connect to the guitars we already know without waiting for a scan
+        DeviceCache::load();
+        for (const auto& entry : DeviceCache::entries())
+        {
+            g_guitars.add(entry.address, [&entry]() { return std::make_unique<Guitar>(g_transport.get(), unpackAddress(entry.address), g_input_mode, g_reactor.get(), g_emitter.get()); });
+        }
+        if (g_guitars.size() > 0)
+        {
+            g_print("Connecting to %zu cached guitar(s)\n", g_guitars.size());
+        }
+
+        // Serve the metrics to local scrapers
+        if (!g_metrics_path.empty())
+        {
+            if (open_metrics_socket(g_metrics_path))
+            {
+                g_print("Serving metrics on %s\n", g_metrics_path.c_str());
+            }
+            else
+            {
+                g_print("Failed to serve metrics on %s\n", g_metrics_path.c_str());
+            }
+        }
 
         // Parse the DBus introspection data
         g_introspection_data = g_dbus_node_info_new_for_xml(g_introspection_xml, NULL);
@@ -521,8 +1320,32 @@ int run_daemon()
             result = ENOMEM;
         }
 
+        // Stop serving metrics
+        close_metrics_socket();
+
+        // Disconnect all guitars and stop the event loop and the emitter
+        g_guitars.clear();
+        g_reactor.reset();
+        g_emitter.reset();
+
+        // Destroy the unclaimed virtual gamepads
+        GamepadPool::stop();
+
+        // Drop the connection changes nobody will publish anymore and the cached device list
+        {
+            std::lock_guard<std::mutex> lock(g_connection_changes_mutex);
+            g_connection_changes.clear();
+        }
+        g_variant_unref(g_connected_devices);
+        g_connected_devices = NULL;
+
+        // Finish the recording and stop publishing guitar states
+        Recorder::close();
+        StateSink::close();
+
         // Close the adapter
-        gattlib_adapter_close(g_adapter);
+        g_transport->close();
+        g_transport.reset();
 
         // Log the event
         g_print("Closed the Bluetooth adapter\n");
@@ -539,34 +1362,118 @@ int run_daemon()
     return result;
 }
 
+// Replays a recording
+int run_replay(const std::string& path)
+{
+    // Stop early on SIGTERM or SIGINT
+    std::signal(SIGTERM, handle_replay_signal);
+    std::signal(SIGINT, handle_replay_signal);
+
+    // Map the recording
+    Recording recording;
+    if (!recording.open(path))
+    {
+        g_print("Failed to open the recording (%s)\n", path.c_str());
+        return EINVAL;
+    }
+
+    // Load the mapping profiles
+    Profiles::reload();
+
+    // The replayed guitars
+    std::map<uint64_t, std::unique_ptr<Guitar>> guitars;
+
+    // Replay the frames on the recorded schedule (scaled by the speed)
+    size_t frames = 0;
+    RecordedFrame frame;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    while (!g_replay_interrupted && recording.next(&frame))
+    {
+        // Wait until the frame is due
+        if (g_replay_speed > 0)
+        {
+            std::this_thread::sleep_until(started + std::chrono::microseconds((int64_t)(frame.time / g_replay_speed)));
+        }
+
+        // Create a guitar for every recorded one
+        std::unique_ptr<Guitar>& guitar = guitars[frame.address];
+        if (!guitar)
+        {
+            guitar = std::make_unique<Guitar>(unpackAddress(frame.address));
+        }
+
+        // Feed it the frame
+        guitar->replay(*frame.data, LatencyStats::now());
+        frames++;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    // Log the results
+    g_print("Replayed %zu frame(s) of %zu guitar(s) in %.3f s (%.0f ns per frame)%s\n", frames, guitars.size(), elapsed, frames > 0 ? elapsed * 1e9 / frames : 0.0, recording.isCorrupt() ? ", the recording ends with a corrupt record" : "");
+    for (const auto& guitar : guitars)
+    {
+        const LatencyHistogram& total = guitar.second->getLatency().get(Latency_Total);
+        g_print("%s: %" G_GUINT64_FORMAT " report(s), total latency p50 %" G_GUINT64_FORMAT " ns, p99 %" G_GUINT64_FORMAT " ns\n", guitar.second->getAddress().c_str(), total.count(), total.percentile(50), total.percentile(99));
+    }
+    return recording.isCorrupt() ? EIO : 0;
+}
+
 // The entry point
 int main(int argc, char *argv[])
 {
     // The result
     int result = 1;
-    
+
+    // Whether we've been asked to run the daemon
+    bool daemon = false;
+
+    // The recording we've been asked to replay
+    std::string replay;
+
     // Define long options
     static struct option long_options[] = {
         {"daemon", no_argument, nullptr, 'd'},
         {"scan", optional_argument, nullptr, 's'},
         {"guitars", optional_argument, nullptr, 'g'},
+        {"latency", required_argument, nullptr, 'l'},
+        {"watch", no_argument, nullptr, 'W'},
+        {"stats", no_argument, nullptr, 'S'},
+        {"input", required_argument, nullptr, 'i'},
+        {"profiles", required_argument, nullptr, 'p'},
+        {"engine", required_argument, nullptr, 'e'},
+        {"workers", required_argument, nullptr, 'w'},
+        {"cache", required_argument, nullptr, 'c'},
+        {"transport", required_argument, nullptr, 't'},
+        {"balance", required_argument, nullptr, 'B'},
+        {"sink", required_argument, nullptr, 'k'},
+        {"analog-rate", required_argument, nullptr, 'A'},
+        {"gamepad-grace", required_argument, nullptr, 'a'},
+        {"connect-limit", required_argument, nullptr, 'L'},
+        {"scan-policy", required_argument, nullptr, 'o'},
+        {"spare-gamepads", required_argument, nullptr, 'G'},
+        {"pipeline", no_argument, nullptr, 'P'},
+        {"metrics", required_argument, nullptr, 'M'},
+        {"shm", optional_argument, nullptr, 'm'},
+        {"record", required_argument, nullptr, 'R'},
+        {"replay", required_argument, nullptr, 'r'},
+        {"speed", required_argument, nullptr, 'x'},
         {nullptr, 0, nullptr, 0}
     };
 
     // Parse options
     int opt = -1;
     int option_index = -1;
-    while ((opt = getopt_long(argc, argv, "d:s:g", long_options, &option_index)) != -1)
+    while ((opt = getopt_long(argc, argv, "d:s:gl:WSi:p:e:w:c:t:B:k:A:a:L:o:G:PM:m::R:r:x:", long_options, &option_index)) != -1)
     {
         switch (opt)
         {
             case 'd':
-                result = run_daemon();
+                daemon = true;
                 break;
             case 's':
                 if (optarg != NULL)
                 {
-                    result = execute_with_callbacks(toggle_scanning, (gpointer)(std::string(optarg) == "on"));
+                    result = execute_with_callbacks(toggle_scanning, optarg);
                 }
                 else
                 {
@@ -576,14 +1483,137 @@ int main(int argc, char *argv[])
             case 'g':
                 result = execute_with_callbacks(get_connected_devices, NULL);
                 break;
+            case 'l':
+                result = execute_with_callbacks(get_latency_stats, optarg);
+                break;
+            case 'W':
+                result = execute_with_callbacks(watch_signals, NULL);
+                break;
+            case 'S':
+                result = execute_with_callbacks(get_stats, NULL);
+                break;
+            case 'i':
+                if (std::string(optarg) == "notify")
+                {
+                    g_input_mode = InputMode_Notify;
+                }
+                else if (std::string(optarg) == "poll")
+                {
+                    g_input_mode = InputMode_Poll;
+                }
+                else
+                {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'p':
+                Profiles::setDirectory(optarg);
+                break;
+            case 'e':
+                if (std::string(optarg) == "reactor" || std::string(optarg) == "threads")
+                {
+                    g_use_reactor = std::string(optarg) == "reactor";
+                }
+                else
+                {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'w':
+                g_worker_count = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                DeviceCache::setPath(optarg);
+                break;
+            case 't':
+                g_transport_specification = optarg;
+                break;
+            case 'B':
+                g_balance_options = optarg;
+                break;
+            case 'k':
+                if (std::string(optarg) == "uinput")
+                {
+                    Gamepad::setSink(Sink_Uinput);
+                }
+                else if (std::string(optarg) == "none")
+                {
+                    Gamepad::setSink(Sink_None);
+                }
+                else if (std::string(optarg) == "capture" || std::string(optarg).compare(0, 8, "capture:") == 0)
+                {
+                    Gamepad::setSink(Sink_Capture, std::string(optarg).size() > 8 ? optarg + 8 : "");
+                }
+                else
+                {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'A':
+                Guitar::setAnalogRate((int)strtol(optarg, NULL, 10));
+                break;
+            case 'a':
+                Guitar::setGracePeriod((int)strtol(optarg, NULL, 10));
+                break;
+            case 'L':
+                ConnectScheduler::setLimit((size_t)strtoul(optarg, NULL, 10));
+                break;
+            case 'o':
+                if (!Scanner::parsePolicy(optarg, &g_scan_policy))
+                {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'G':
+                g_spare_gamepads = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'P':
+                g_use_pipeline = true;
+                break;
+            case 'M':
+                g_metrics_path = optarg;
+                break;
+            case 'm':
+                g_shm_name = optarg != NULL ? optarg : GHLBLE_STATE_DEFAULT_NAME;
+                break;
+            case 'R':
+                g_record_path = optarg;
+                break;
+            case 'r':
+                replay = optarg;
+                break;
+            case 'x':
+                g_replay_speed = std::string(optarg) == "max" ? 0 : strtod(optarg, NULL);
+                if (g_replay_speed <= 0 && std::string(optarg) != "max")
+                {
+                    print_usage();
+                    return 1;
+                }
+                break;
             case '?':
             default:
                 print_usage();
         }
     }
 
+    // Run the daemon once all of its options have been parsed
+    if (daemon)
+    {
+        result = run_daemon();
+    }
+
+    // Replay a recording once all of its options have been parsed
+    else if (!replay.empty())
+    {
+        result = run_replay(replay);
+    }
+
     // We haven't been provided options
-    if (opt == -1 && option_index == -1)
+    else if (opt == -1 && option_index == -1)
     {
         print_usage();
     }
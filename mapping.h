@@ -0,0 +1,182 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include "gamepad.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The guitar input bytes a button mapping can be sourced from
+enum MappingSources {
+    Source_Frets = 0,  // GuitarData::frets, bits 0-7 of the digital word
+    Source_Buttons = 1 // GuitarData::buttons, bits 8-15 of the digital word
+};
+
+// Maps a single guitar input bit to an evdev key code
+typedef struct ButtonMapping {
+    uint8_t source;   // The input byte (see MappingSources)
+    uint8_t mask;     // The input bit
+    uint16_t code;    // The evdev key code
+} ButtonMapping;
+
+// The evdev key code of every bit of the digital word (0 means unmapped)
+typedef struct ButtonLookupTable {
+    uint16_t codes[16];  // The key codes, indexed by bit position
+    uint16_t mask;       // The mapped bits
+} ButtonLookupTable;
+
+// Marks an axis that isn't mapped to anything
+#define MAPPING_UNMAPPED 0xffff
+
+// The strongest low-pass filter an analog input can have (keeps the filter exact to the raw step)
+#define MAPPING_MAX_SMOOTHING 7
+
+// Tames the jitter of an analog input before it's emitted
+typedef struct AnalogConditioning {
+    uint8_t deadzone;    // Raw values this close to the resting position report the resting position
+    uint8_t hysteresis;  // Changes up to this many raw steps are ignored (except at rest and at the ends of the range)
+    uint8_t smoothing;   // The low-pass filter strength, new samples weigh 1/2^smoothing (0 = off)
+} AnalogConditioning;
+
+// The conditioning state of an analog input
+typedef struct AnalogInputState {
+    int32_t filtered;  // The low-pass filtered raw value (8.8 fixed point)
+    uint8_t value;     // The last reported raw value
+} AnalogInputState;
+
+// A compiled, immutable input mapping
+typedef struct MappingTable {
+    ButtonLookupTable buttons;              // Frets and buttons
+    uint16_t strumAxis;                     // The axis the strum bar drives
+    int32_t strumUp;                        // The strum axis value while strumming up
+    int32_t strumDown;                      // The strum axis value while strumming down
+    uint16_t whammyAxis;                    // The axis the whammy bar drives
+    uint16_t tiltAxis;                      // The axis the tilt sensor drives
+    AnalogConditioning whammyConditioning;  // The whammy bar's jitter filter
+    AnalogConditioning tiltConditioning;    // The tilt sensor's jitter filter
+} MappingTable;
+
+// The evdev values of a directional pad direction
+typedef struct DirectionalPadValue {
+    int8_t x;  // The horizontal axis value
+    int8_t y;  // The vertical axis value
+} DirectionalPadValue;
+
+// The default button mappings
+static constexpr ButtonMapping g_default_button_mappings[] = {
+    { Source_Frets, 0x01, BTN_X },          // W1 -> X
+    { Source_Frets, 0x10, BTN_TL },         // W2 -> BTN_TL (aka. L1)
+    { Source_Frets, 0x20, BTN_TR },         // W3 -> BTN_TR (aka. R1)
+    { Source_Frets, 0x02, BTN_A },          // B1 -> A
+    { Source_Frets, 0x04, BTN_B },          // B2 -> B
+    { Source_Frets, 0x08, BTN_Y },          // B3 -> Y
+    { Source_Buttons, 0x02, BTN_START },    // Pause -> BTN_START
+    { Source_Buttons, 0x08, BTN_SELECT },   // HeroPower -> BTN_SELECT
+    { Source_Buttons, 0x04, BTN_THUMBL },   // GHTV -> BTN_THUMBL
+    { Source_Buttons, 0x10, BTN_A },        // Sync -> BTN_A (BTN_MODE opens the Steam overlay)
+};
+
+// Packs the frets and buttons bytes into a single digital word
+static constexpr uint16_t packDigitalInput(uint8_t frets, uint8_t buttons)
+{
+    return (uint16_t)(frets | (buttons << 8));
+}
+
+// Builds the bit-indexed lookup table of the given button mappings
+static constexpr ButtonLookupTable makeButtonLookupTable(const ButtonMapping* mappings, size_t count)
+{
+    ButtonLookupTable table = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (mappings[i].mask & (1 << bit))
+            {
+                int index = bit + (mappings[i].source == Source_Buttons ? 8 : 0);
+                table.codes[index] = mappings[i].code;
+                table.mask |= (uint16_t)(1 << index);
+            }
+        }
+    }
+    return table;
+}
+
+// The default button lookup table
+static constexpr ButtonLookupTable g_default_button_table = makeButtonLookupTable(g_default_button_mappings, sizeof(g_default_button_mappings) / sizeof(g_default_button_mappings[0]));
+
+// The default mapping table
+static constexpr MappingTable g_default_mapping_table = {
+    g_default_button_table,
+    AXIS_DPAD_VERTICAL,            // Strum -> Dpad Y (AXIS_LEFT_ANALOG_VERTICAL works too)
+    DPAD_VALUE_MAX,
+    DPAD_VALUE_MIN,
+    AXIS_RIGHT_ANALOG_VERTICAL,    // Whammy -> Right Analog Y
+    AXIS_RIGHT_ANALOG_HORIZONTAL,  // Tilt -> Right Analog X
+    { 2, 0, 0 },                   // Whammy: ignore the resting jitter, but keep every step of its travel
+    { 0, 2, 2 }                    // Tilt: rests anywhere (e.g. on a knee), so smooth it instead
+};
+
+// The evdev values of every GuitarDirectionalPadDirections value
+static constexpr DirectionalPadValue g_directional_pad_table[16] = {
+    { 0, DPAD_VALUE_MIN },               // South
+    { DPAD_VALUE_MAX, DPAD_VALUE_MIN },  // SouthEast
+    { DPAD_VALUE_MAX, 0 },               // East
+    { DPAD_VALUE_MAX, DPAD_VALUE_MAX },  // NorthEast
+    { 0, DPAD_VALUE_MAX },               // North
+    { DPAD_VALUE_MIN, DPAD_VALUE_MAX },  // NorthWest
+    { DPAD_VALUE_MIN, 0 },               // West
+    { DPAD_VALUE_MIN, DPAD_VALUE_MIN },  // SouthWest
+    { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+    { 0, 0 }                             // Centered
+};
+
+// Looks up the evdev values of a directional pad direction
+static inline const DirectionalPadValue& directionalPadValue(uint8_t direction)
+{
+    return g_directional_pad_table[direction < 16 ? direction : 0xf];
+}
+
+// Scales a raw 0x00 ~ 0xFF analog input to the given axis' range
+static inline int32_t analogAxisValue(uint16_t axis, uint8_t raw)
+{
+    return (axis == AXIS_LEFT_TRIGGER || axis == AXIS_RIGHT_TRIGGER) ? raw : (short)((raw * 0x101) - ANALOG_VALUE_MAX);
+}
+
+// Runs a raw analog input through its conditioning, returns whether the reported value (state.value) changed
+static inline bool conditionAnalogInput(const AnalogConditioning& conditioning, uint8_t rest, AnalogInputState& state, uint8_t raw)
+{
+    // Low-pass the input (an exponential moving average in 8.8 fixed point, rounded back to a raw step)
+    state.filtered += ((int32_t)(raw << 8) - state.filtered) >> conditioning.smoothing;
+    int32_t value = (state.filtered + 0x80) >> 8;
+
+    // Snap to the resting position
+    if (value >= rest - conditioning.deadzone && value <= rest + conditioning.deadzone)
+    {
+        value = rest;
+    }
+
+    // Ignore small changes, but always report the resting position and the ends of the range
+    int32_t change = value > state.value ? value - state.value : state.value - value;
+    if (change == 0 || (change <= conditioning.hysteresis && value != rest && value != 0x00 && value != 0xff))
+    {
+        return false;
+    }
+    state.value = (uint8_t)value;
+    return true;
+}
+
+// Calls emit(code, value) for every mapped bit that differs between the previous and the current digital word
+template <typename Emit>
+static inline void mapButtons(const ButtonLookupTable& table, uint16_t previous, uint16_t current, Emit&& emit)
+{
+    // Only walk the bits that actually changed
+    uint32_t changed = (uint32_t)((previous ^ current) & table.mask);
+    while (changed != 0)
+    {
+        int bit = __builtin_ctz(changed);
+        changed &= changed - 1;
+        emit(table.codes[bit], (current >> bit) & 1 ? BTN_PRESSED : BTN_RELEASED);
+    }
+}
+
+#endif // MAPPING_H
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "guitar.h"
+
+// Feeds frames through the per-input if-chain Guitar::update used before the mapping table (its checks, codes and values, written against the batched gamepad API)
+class LegacyMapper {
+public:
+    // Constructor
+    LegacyMapper() : gamepad("Legacy mapping")
+    {
+        // Start from the state the guitar starts from
+        memset(&lastInputState, 0, sizeof(lastInputState));
+        lastInputState.directionalPad = Direction_Centered;
+        lastInputState.strum = 0x80;
+        lastInputState.whammy = 0x80;
+        lastInputState.tilt = 0x80;
+    }
+
+    // Maps a frame
+    void update(const GuitarData& data)
+    {
+        // Collect all changes of this frame into a single report
+        gamepad.beginFrame();
+
+        // W1 -> X
+        if ((lastInputState.frets & Fret_W1) != (data.frets & Fret_W1))
+        {
+            gamepad.append(EV_KEY, BTN_X, data.frets & Fret_W1 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // W2 -> BTN_TL (aka. L1)
+        if ((lastInputState.frets & Fret_W2) != (data.frets & Fret_W2))
+        {
+            gamepad.append(EV_KEY, BTN_TL, data.frets & Fret_W2 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // W3 -> BTN_TR (aka. R1)
+        if ((lastInputState.frets & Fret_W3) != (data.frets & Fret_W3))
+        {
+            gamepad.append(EV_KEY, BTN_TR, data.frets & Fret_W3 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // B1 -> A
+        if ((lastInputState.frets & Fret_B1) != (data.frets & Fret_B1))
+        {
+            gamepad.append(EV_KEY, BTN_A, data.frets & Fret_B1 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // B2 -> B
+        if ((lastInputState.frets & Fret_B2) != (data.frets & Fret_B2))
+        {
+            gamepad.append(EV_KEY, BTN_B, data.frets & Fret_B2 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // B3 -> Y
+        if ((lastInputState.frets & Fret_B3) != (data.frets & Fret_B3))
+        {
+            gamepad.append(EV_KEY, BTN_Y, data.frets & Fret_B3 ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // Pause -> BTN_START
+        if ((lastInputState.buttons & Button_Pause) != (data.buttons & Button_Pause))
+        {
+            gamepad.append(EV_KEY, BTN_START, data.buttons & Button_Pause ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // HeroPower -> BTN_SELECT
+        if ((lastInputState.buttons & Button_HeroPower) != (data.buttons & Button_HeroPower))
+        {
+            gamepad.append(EV_KEY, BTN_SELECT, data.buttons & Button_HeroPower ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // GHTV -> BTN_THUMBL
+        if ((lastInputState.buttons & Button_GHTV) != (data.buttons & Button_GHTV))
+        {
+            gamepad.append(EV_KEY, BTN_THUMBL, data.buttons & Button_GHTV ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // Sync -> BTN_A
+        if ((lastInputState.buttons & Button_Sync) != (data.buttons & Button_Sync))
+        {
+            gamepad.append(EV_KEY, BTN_A, data.buttons & Button_Sync ? BTN_PRESSED : BTN_RELEASED);
+        }
+
+        // The directional pad
+        if (lastInputState.directionalPad != data.directionalPad)
+        {
+            int dpadX = (data.directionalPad == Direction_SouthEast || data.directionalPad == Direction_East || data.directionalPad == Direction_NorthEast) ? DPAD_VALUE_MAX : (data.directionalPad == Direction_SouthWest || data.directionalPad == Direction_West || data.directionalPad == Direction_NorthWest) ? DPAD_VALUE_MIN : 0;
+            int dpadY = (data.directionalPad == Direction_SouthEast || data.directionalPad == Direction_South || data.directionalPad == Direction_SouthWest) ? DPAD_VALUE_MIN : (data.directionalPad == Direction_NorthEast || data.directionalPad == Direction_North || data.directionalPad == Direction_NorthWest) ? DPAD_VALUE_MAX : 0;
+            gamepad.append(EV_ABS, AXIS_DPAD_HORIZONTAL, dpadX);
+            gamepad.append(EV_ABS, AXIS_DPAD_VERTICAL, dpadY);
+        }
+
+        // Whammy -> Right Analog Y
+        if (lastInputState.whammy != data.whammy)
+        {
+            gamepad.append(EV_ABS, AXIS_RIGHT_ANALOG_VERTICAL, (short)((data.whammy * 0x101) - ANALOG_VALUE_MAX));
+        }
+
+        // Tilt -> Right Analog X
+        if (lastInputState.tilt != data.tilt)
+        {
+            gamepad.append(EV_ABS, AXIS_RIGHT_ANALOG_HORIZONTAL, (short)((data.tilt * 0x101) - ANALOG_VALUE_MAX));
+        }
+
+        // Strum -> Dpad Y
+        if (lastInputState.strum != data.strum)
+        {
+            int strum = data.strum == 0xff ? DPAD_VALUE_MAX : data.strum == 0 ? DPAD_VALUE_MIN : 0;
+            gamepad.append(EV_ABS, AXIS_DPAD_VERTICAL, strum);
+        }
+
+        // Emit the frame as a single report
+        gamepad.commit();
+
+        // Set the last input state
+        lastInputState = data;
+    }
+
+private:
+    // The reference gamepad
+    Gamepad gamepad;
+
+    // The previous frame
+    GuitarData lastInputState;
+};
+
+// A captured event (without its timestamp)
+typedef struct CapturedEvent {
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} CapturedEvent;
+
+// Reads a capture file as a list of reports
+static std::vector<std::vector<CapturedEvent>> read_reports(const std::string& path)
+{
+    std::vector<std::vector<CapturedEvent>> reports(1);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct input_event ev;
+    while (fd >= 0 && read(fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+    {
+        // A report ends
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+        {
+            reports.push_back(std::vector<CapturedEvent>());
+            continue;
+        }
+        reports.back().push_back({ ev.type, ev.code, ev.value });
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    reports.pop_back();
+
+    // Events of different codes in one report may come in any order (the last value of a code wins, so keep their own order)
+    for (std::vector<CapturedEvent>& report : reports)
+    {
+        std::stable_sort(report.begin(), report.end(), [](const CapturedEvent& a, const CapturedEvent& b) {
+            return a.type != b.type ? a.type < b.type : a.code < b.code;
+        });
+    }
+    return reports;
+}
+
+// Prints a report
+static void print_report(const char* label, const std::vector<CapturedEvent>& report)
+{
+    printf("  %s:", label);
+    for (const CapturedEvent& ev : report)
+    {
+        printf(" %u/%u=%d", ev.type, ev.code, ev.value);
+    }
+    printf("\n");
+}
+
+// Appends a frame and the same frame with one input changed, for every pair of values of that input
+template <typename Set>
+static void append_transitions(std::vector<GuitarData>& frames, const GuitarData& background, const std::vector<uint8_t>& values, Set set)
+{
+    for (uint8_t from : values)
+    {
+        for (uint8_t to : values)
+        {
+            GuitarData frame = background;
+            set(frame, from);
+            frames.push_back(frame);
+            set(frame, to);
+            frames.push_back(frame);
+        }
+    }
+}
+
+// The entry point
+int main()
+{
+    // Capture both event streams into a directory of our own
+    char directory[] = "/tmp/ghlble_mapping_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    Gamepad::setSink(Sink_Capture, directory);
+    Guitar::setAnalogRate(0);
+
+    // The if-chain reported every analog step, so turn the jitter filter off
+    std::string profilePath = std::string(directory) + "/default.conf";
+    FILE* profile = fopen(profilePath.c_str(), "w");
+    if (profile == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fputs("whammy.deadzone = 0\nwhammy.hysteresis = 0\nwhammy.smoothing = 0\ntilt.deadzone = 0\ntilt.hysteresis = 0\ntilt.smoothing = 0\n", profile);
+    fclose(profile);
+    Profiles::setDirectory(directory);
+    if (!Profiles::reload())
+    {
+        printf("The profile without jitter filtering was rejected.\n");
+        return 1;
+    }
+
+    // The values every input can take (including the ones guitars don't send)
+    std::vector<uint8_t> bytes;
+    for (int value = 0; value < 256; value++)
+    {
+        bytes.push_back((uint8_t)value);
+    }
+    std::vector<uint8_t> directions;
+    for (int value = 0; value < 16; value++)
+    {
+        directions.push_back((uint8_t)value);
+    }
+
+    // Every transition of every input, against a resting background and against a busy one
+    GuitarData rest;
+    memset(&rest, 0, sizeof(rest));
+    rest.directionalPad = Direction_Centered;
+    rest.strum = 0x80;
+    rest.whammy = 0x80;
+    rest.tilt = 0x80;
+    GuitarData busy = rest;
+    busy.frets = Fret_W1 | Fret_B2;
+    busy.buttons = Button_HeroPower;
+    busy.directionalPad = Direction_North;
+    busy.strum = 0xff;
+    busy.whammy = 0xc0;
+    busy.tilt = 0x20;
+    std::vector<GuitarData> frames;
+    for (const GuitarData& background : { rest, busy })
+    {
+        append_transitions(frames, background, bytes, [](GuitarData& frame, uint8_t value) { frame.frets = value; });
+        append_transitions(frames, background, bytes, [](GuitarData& frame, uint8_t value) { frame.buttons = value; });
+        append_transitions(frames, background, directions, [](GuitarData& frame, uint8_t value) { frame.directionalPad = value; });
+        append_transitions(frames, background, bytes, [](GuitarData& frame, uint8_t value) { frame.strum = value; });
+        append_transitions(frames, background, bytes, [](GuitarData& frame, uint8_t value) { frame.whammy = value; });
+        append_transitions(frames, background, bytes, [](GuitarData& frame, uint8_t value) { frame.tilt = value; });
+    }
+
+    // Random walks over all inputs at once (chords, several inputs changing in one frame, dpad and strum sharing an axis, analog moves alongside)
+    uint32_t random = 0x2545f491;
+    GuitarData frame = rest;
+    for (int i = 0; i < 200000; i++)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        frame.frets ^= (uint8_t)(1 << (random % 6));
+        frame.buttons = (random >> 3) % 4 == 0 ? (uint8_t)(random >> 8) : frame.buttons;
+        frame.directionalPad = (random >> 16) % 3 == 0 ? (uint8_t)((random >> 20) % 16) : frame.directionalPad;
+        frame.strum = (random >> 24) % 3 == 0 ? 0x00 : (random >> 24) % 3 == 1 ? 0xff : 0x80;
+        frame.whammy = (random >> 4) % 2 == 0 ? (uint8_t)(random >> 12) : frame.whammy;
+        frame.tilt = (random >> 5) % 4 == 0 ? (uint8_t)(random >> 20) : frame.tilt;
+        frames.push_back(frame);
+    }
+
+    // Map every frame both ways
+    std::string guitarCapture;
+    {
+        LegacyMapper legacy;
+        Guitar guitar("5E:00:00:00:7E:01");
+        int64_t arrival = 1;
+        for (const GuitarData& data : frames)
+        {
+            legacy.update(data);
+            guitar.replay(data, arrival++);
+        }
+        guitarCapture = guitar.getGamepadName();
+    }
+    for (char& c : guitarCapture)
+    {
+        c = isalnum((unsigned char)c) ? c : '_';
+    }
+
+    // Compare the streams report by report
+    std::string legacyPath = std::string(directory) + "/Legacy_mapping.events";
+    std::string guitarPath = std::string(directory) + "/" + guitarCapture + ".events";
+    std::vector<std::vector<CapturedEvent>> expected = read_reports(legacyPath);
+    std::vector<std::vector<CapturedEvent>> actual = read_reports(guitarPath);
+    int result = 0;
+    size_t count = std::min(expected.size(), actual.size());
+    for (size_t i = 0; i < count && result == 0; i++)
+    {
+        bool same = expected[i].size() == actual[i].size();
+        for (size_t j = 0; j < expected[i].size() && same; j++)
+        {
+            same = expected[i][j].type == actual[i][j].type && expected[i][j].code == actual[i][j].code && expected[i][j].value == actual[i][j].value;
+        }
+        if (!same)
+        {
+            printf("Report %zu differs:\n", i);
+            print_report("if-chain", expected[i]);
+            print_report("table", actual[i]);
+            result = 1;
+        }
+    }
+    if (result == 0 && expected.size() != actual.size())
+    {
+        printf("The if-chain emitted %zu reports, the table %zu.\n", expected.size(), actual.size());
+        result = 1;
+    }
+    if (result == 0 && expected.empty())
+    {
+        printf("Nothing was captured.\n");
+        result = 1;
+    }
+    if (result == 0)
+    {
+        printf("%zu frames, %zu identical reports.\n", frames.size(), actual.size());
+    }
+
+    // Clean up
+    unlink(legacyPath.c_str());
+    unlink(guitarPath.c_str());
+    unlink(profilePath.c_str());
+    rmdir(directory);
+    return result;
+}
@@ -0,0 +1,426 @@
+#include "multitransport.h"
+#include "address.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+// How often the monitor looks at the links
+static const std::chrono::milliseconds g_monitor_period(500);
+
+// A link through one of the adapters
+class MultiLink : public TransportLink
+{
+public:
+    // Constructor
+    MultiLink(size_t adapterValue, TransportLink* innerValue, uint64_t addressValue) : adapter(adapterValue), inner(innerValue), address(addressValue), degradedSince(0), moving(false) {}
+
+    // The adapter the link goes through
+    size_t adapter;
+
+    // The adapter's link
+    TransportLink* inner;
+
+    // The packed address of the guitar
+    uint64_t address;
+
+    // The frame arrivals (written by whoever reads or is notified, the jitter is read by the monitor)
+    LatencyStats arrivals;
+
+    // Since when the link has been degraded (monotonic nanoseconds, 0 = it isn't, monitor only)
+    int64_t degradedSince;
+
+    // Whether the link has been dropped to move the guitar (monitor only)
+    bool moving;
+};
+
+MultiTransport::MultiTransport(std::vector<std::unique_ptr<Transport>> adaptersValue) : balancing(Balance_Links), degradedJitter(2000000), patience(5 * (int64_t)1000000000), avoidance(60 * (int64_t)1000000000), monitoring(false)
+{
+    // Take the adapters and name ourselves after them
+    for (auto& transport : adaptersValue)
+    {
+        name += name.empty() ? "" : "+";
+        name += transport->getName();
+        adapters.push_back({ std::move(transport), false, 0 });
+    }
+}
+
+MultiTransport::~MultiTransport()
+{
+    // Stop the monitor and close the adapters
+    close();
+}
+
+bool MultiTransport::configure(const std::string& options)
+{
+    // Parse the "option=value" pairs
+    std::stringstream stream(options);
+    std::string option;
+    while (std::getline(stream, option, ','))
+    {
+        // Split the pair
+        size_t separator = option.find('=');
+        if (separator == std::string::npos)
+        {
+            printf("Invalid balancing option \"%s\".\n", option.c_str());
+            return false;
+        }
+        std::string key = option.substr(0, separator);
+        std::string text = option.substr(separator + 1);
+
+        // The policy is a word, everything else a number
+        if (key == "balance" && (text == "links" || text == "latency"))
+        {
+            balancing = text == "latency" ? Balance_Latency : Balance_Links;
+            continue;
+        }
+        char* end;
+        double value = strtod(text.c_str(), &end);
+        if (*end != '\0' || end == text.c_str() || value < 0)
+        {
+            printf("Invalid balancing option \"%s\".\n", option.c_str());
+            return false;
+        }
+
+        // Apply it
+        if (key == "degraded")
+        {
+            degradedJitter = (int64_t)(value * 1000);
+        }
+        else if (key == "patience")
+        {
+            patience = (int64_t)(value * 1000000000.0);
+        }
+        else if (key == "avoid")
+        {
+            avoidance = (int64_t)(value * 1000000000.0);
+        }
+        else
+        {
+            printf("Invalid balancing option \"%s\".\n", option.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t MultiTransport::getLinkCount(size_t adapter)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return adapter < adapters.size() ? adapters[adapter].links : 0;
+}
+
+const char* MultiTransport::getName() const
+{
+    return name.c_str();
+}
+
+bool MultiTransport::open()
+{
+    // Open every adapter we can (a missing one shouldn't keep the others from working)
+    bool opened = false;
+    for (size_t i = 0; i < adapters.size() && i < 32; i++)
+    {
+        adapters[i].open = adapters[i].transport->open();
+        if (!adapters[i].open)
+        {
+            printf("Failed to open adapter %zu (%s).\n", i, adapters[i].transport->getName());
+        }
+        opened = opened || adapters[i].open;
+    }
+
+    // Start moving guitars off degraded links
+    if (opened)
+    {
+        monitoring = true;
+        monitor = std::thread(&MultiTransport::watchLinks, this);
+    }
+    return opened;
+}
+
+void MultiTransport::close()
+{
+    // Stop the monitor
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        monitoring = false;
+    }
+    condition.notify_all();
+    if (monitor.joinable())
+    {
+        monitor.join();
+    }
+
+    // Close the adapters
+    for (Adapter& adapter : adapters)
+    {
+        if (adapter.open)
+        {
+            adapter.transport->close();
+            adapter.open = false;
+        }
+    }
+}
+
+bool MultiTransport::scan(DiscoveryHandler handler)
+{
+    // Scan on all adapters at once, remembering which of them see which guitar
+    std::vector<std::thread> scanners;
+    std::atomic<size_t> scanned(0);
+    for (size_t i = 0; i < adapters.size(); i++)
+    {
+        if (!adapters[i].open)
+        {
+            continue;
+        }
+        scanners.emplace_back([this, i, &handler, &scanned]() {
+            bool result = adapters[i].transport->scan([this, i, &handler](const std::string& address, const std::string& deviceName) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    routes[packAddress(address)].seenBy |= 1u << i;
+                }
+                handler(address, deviceName);
+            });
+            scanned += result ? 1 : 0;
+        });
+    }
+
+    // Wait for all of them to be stopped
+    for (std::thread& scanner : scanners)
+    {
+        scanner.join();
+    }
+    return scanned > 0;
+}
+
+void MultiTransport::stopScan()
+{
+    // Stop every adapter's scan
+    for (Adapter& adapter : adapters)
+    {
+        if (adapter.open)
+        {
+            adapter.transport->stopScan();
+        }
+    }
+}
+
+bool MultiTransport::connect(const std::string& address, ConnectHandler handler)
+{
+    // Pick the adapter and count the attempt against it right away (so guitars connecting at once spread out)
+    uint64_t packed = packAddress(address);
+    size_t adapter;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        adapter = pickAdapter(packed, LatencyStats::now());
+        if (adapter == adapters.size())
+        {
+            return false;
+        }
+        adapters[adapter].links++;
+    }
+
+    // Connect through it
+    printf("Connecting Guitar (%s) through adapter %zu (%s).\n", address.c_str(), adapter, adapters[adapter].transport->getName());
+    bool started = adapters[adapter].transport->connect(address, [this, adapter, packed, handler](TransportLink* inner) {
+        // The attempt failed
+        if (inner == NULL)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                adapters[adapter].links--;
+            }
+            handler(NULL);
+            return;
+        }
+
+        // Wrap the adapter's link
+        MultiLink* link = new MultiLink(adapter, inner, packed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            links.push_back(link);
+        }
+        handler(link);
+    });
+
+    // The attempt couldn't be started
+    if (!started)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        adapters[adapter].links--;
+    }
+    return started;
+}
+
+void MultiTransport::disconnect(TransportLink* link)
+{
+    MultiLink* multiLink = (MultiLink*)link;
+    adapters[multiLink->adapter].transport->disconnect(multiLink->inner);
+}
+
+void MultiTransport::release(TransportLink* link)
+{
+    // Forget the link (waits for the monitor to finish with it)
+    MultiLink* multiLink = (MultiLink*)link;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        links.erase(std::find(links.begin(), links.end(), multiLink));
+        adapters[multiLink->adapter].links--;
+    }
+
+    // Free it
+    adapters[multiLink->adapter].transport->release(multiLink->inner);
+    delete multiLink;
+}
+
+bool MultiTransport::discover(TransportLink* link, TransportCharacteristic* characteristic)
+{
+    MultiLink* multiLink = (MultiLink*)link;
+    return adapters[multiLink->adapter].transport->discover(multiLink->inner, characteristic);
+}
+
+bool MultiTransport::read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size)
+{
+    // Read through the adapter and time the frame's arrival
+    MultiLink* multiLink = (MultiLink*)link;
+    if (!adapters[multiLink->adapter].transport->read(multiLink->inner, characteristic, buffer, size))
+    {
+        return false;
+    }
+    multiLink->arrivals.recordArrival(LatencyStats::now());
+    return true;
+}
+
+bool MultiTransport::subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost)
+{
+    // Subscribe through the adapter and time the frames' arrival
+    MultiLink* multiLink = (MultiLink*)link;
+    return adapters[multiLink->adapter].transport->subscribe(multiLink->inner, characteristic, [multiLink, notification](const uint8_t* data, size_t length) {
+        multiLink->arrivals.recordArrival(LatencyStats::now());
+        notification(data, length);
+    }, lost);
+}
+
+void MultiTransport::unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic)
+{
+    MultiLink* multiLink = (MultiLink*)link;
+    adapters[multiLink->adapter].transport->unsubscribe(multiLink->inner, characteristic);
+}
+
+size_t MultiTransport::pickAdapter(uint64_t address, int64_t now)
+{
+    // Stick to the adapters that have seen the guitar (any adapter if none has, e.g. for cached guitars before a scan)
+    const GuitarRoute& route = routes[address];
+    uint32_t candidates = 0;
+    for (size_t i = 0; i < adapters.size() && i < 32; i++)
+    {
+        if (adapters[i].open && (route.seenBy == 0 || (route.seenBy & 1u << i) != 0))
+        {
+            candidates |= 1u << i;
+        }
+    }
+
+    // Avoid the adapter the guitar was moved away from (unless it's the only one)
+    if (route.avoidUntil > now && (candidates & ~(1u << route.avoided)) != 0)
+    {
+        candidates &= ~(1u << route.avoided);
+    }
+
+    // Pick the best candidate (the one with fewer links wins a tie)
+    size_t best = adapters.size();
+    for (size_t i = 0; i < adapters.size() && i < 32; i++)
+    {
+        if ((candidates & 1u << i) == 0)
+        {
+            continue;
+        }
+        if (best == adapters.size())
+        {
+            best = i;
+            continue;
+        }
+        uint64_t jitter = balancing == Balance_Latency ? adapterJitter(i) : 0;
+        uint64_t bestJitter = balancing == Balance_Latency ? adapterJitter(best) : 0;
+        if (jitter < bestJitter || (jitter == bestJitter && adapters[i].links < adapters[best].links))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint64_t MultiTransport::adapterJitter(size_t adapter) const
+{
+    // Average the jitter of the adapter's links
+    uint64_t total = 0;
+    size_t count = 0;
+    for (const MultiLink* link : links)
+    {
+        if (link->adapter == adapter)
+        {
+            total += link->arrivals.jitter();
+            count++;
+        }
+    }
+    return count > 0 ? total / count : 0;
+}
+
+void MultiTransport::watchLinks()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (monitoring)
+    {
+        // Look at the links every now and then
+        condition.wait_for(lock, g_monitor_period, [this]() { return !monitoring; });
+        if (!monitoring || degradedJitter == 0)
+        {
+            continue;
+        }
+        int64_t now = LatencyStats::now();
+        for (MultiLink* link : links)
+        {
+            // The link is fine (or it's already being dropped)
+            int64_t jitter = (int64_t)link->arrivals.jitter();
+            if (link->moving || jitter <= degradedJitter)
+            {
+                link->degradedSince = 0;
+                continue;
+            }
+
+            // Give it a chance to recover
+            if (link->degradedSince == 0)
+            {
+                link->degradedSince = now;
+            }
+            if (now - link->degradedSince < patience)
+            {
+                continue;
+            }
+
+            // Look for a healthy adapter that has seen the guitar
+            GuitarRoute& route = routes[link->address];
+            size_t target = adapters.size();
+            for (size_t i = 0; i < adapters.size() && i < 32 && target == adapters.size(); i++)
+            {
+                if (i != link->adapter && adapters[i].open && (route.seenBy == 0 || (route.seenBy & 1u << i) != 0) && (int64_t)adapterJitter(i) <= degradedJitter)
+                {
+                    target = i;
+                }
+            }
+            if (target == adapters.size())
+            {
+                continue;
+            }
+
+            // Drop the link so the guitar reconnects elsewhere (release waits for us, so the link stays valid meanwhile)
+            printf("Moving Guitar (%s) off adapter %zu (%s), its jitter has been above %.1f ms for %.0f s.\n", unpackAddress(link->address).c_str(), link->adapter, adapters[link->adapter].transport->getName(), degradedJitter / 1e6, (now - link->degradedSince) / 1e9);
+            route.avoided = link->adapter;
+            route.avoidUntil = now + avoidance;
+            link->moving = true;
+            adapters[link->adapter].transport->disconnect(link->inner);
+        }
+    }
+}
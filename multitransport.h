@@ -0,0 +1,127 @@
+#ifndef MULTITRANSPORT_H
+#define MULTITRANSPORT_H
+
+#include "transport.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// How guitars are assigned to adapters
+enum AdapterBalancing {
+    Balance_Links = 0,   // The adapter with the fewest links (including attempts in flight)
+    Balance_Latency = 1  // The adapter whose links have the lowest frame interval jitter
+};
+
+class MultiLink;
+
+// Spreads guitars over several adapters.
+//
+// Every adapter shares its radio and connection events between its links, so
+// a party's worth of guitars on one controller degrades them all. This
+// transport scans on all adapters at once and connects each guitar through
+// one of the adapters that have seen it, picked by the balancing policy. A
+// monitor moves guitars whose frame interval jitter stays above a threshold
+// to a better adapter by dropping their link: the guitar reconnects, and
+// the adapter it was on is avoided for a while. The options are given as
+// "option=value" pairs:
+//
+//     balance=links|latency  How guitars are assigned (default: links)
+//     degraded=US            Jitter above which a link counts as degraded (default: 2000, 0 = never move guitars)
+//     patience=S             How long a link has to stay degraded before it's moved (default: 5)
+//     avoid=S                How long a guitar avoids the adapter it was moved away from (default: 60)
+class MultiTransport : public Transport
+{
+public:
+    // Creates a transport over the given adapters (named after their specifications)
+    MultiTransport(std::vector<std::unique_ptr<Transport>> adaptersValue);
+
+    // Destructor
+    ~MultiTransport();
+
+    // Applies a comma separated option list, returns false if it contained errors
+    bool configure(const std::string& options);
+
+    // Returns the number of links (and connection attempts in flight) of an adapter
+    size_t getLinkCount(size_t adapter);
+
+    const char* getName() const override;
+    bool open() override;
+    void close() override;
+    bool scan(DiscoveryHandler handler) override;
+    void stopScan() override;
+    bool connect(const std::string& address, ConnectHandler handler) override;
+    void disconnect(TransportLink* link) override;
+    void release(TransportLink* link) override;
+    bool discover(TransportLink* link, TransportCharacteristic* characteristic) override;
+    bool read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size) override;
+    bool subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost) override;
+    void unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic) override;
+
+private:
+    // An adapter and what we know about it
+    struct Adapter {
+        std::unique_ptr<Transport> transport;
+        bool open;
+        size_t links;
+    };
+
+    // A guitar's history with the adapters
+    struct GuitarRoute {
+        uint32_t seenBy;     // The adapters that have seen the guitar advertise (bit mask)
+        size_t avoided;      // The adapter the guitar was moved away from
+        int64_t avoidUntil;  // Until when it avoids that adapter (monotonic nanoseconds, 0 = it doesn't)
+    };
+
+    // The adapters (at most 32)
+    std::vector<Adapter> adapters;
+
+    // The transport's name ("sim+sim", ...)
+    std::string name;
+
+    // How guitars are assigned to adapters
+    AdapterBalancing balancing;
+
+    // The jitter above which a link counts as degraded in nanoseconds (0 = never move guitars)
+    int64_t degradedJitter;
+
+    // How long a link has to stay degraded before it's moved in nanoseconds
+    int64_t patience;
+
+    // How long a guitar avoids the adapter it was moved away from in nanoseconds
+    int64_t avoidance;
+
+    // Guards everything below and the adapters' link counts
+    std::mutex mutex;
+
+    // Wakes up the monitor
+    std::condition_variable condition;
+
+    // The guitars' history, keyed by packed address
+    std::unordered_map<uint64_t, GuitarRoute> routes;
+
+    // The live links
+    std::vector<MultiLink*> links;
+
+    // Whether the monitor should keep running
+    bool monitoring;
+
+    // Moves guitars off degraded links
+    std::thread monitor;
+
+    // Picks the adapter to connect a guitar through (mutex must be held), returns adapters.size() if there's none
+    size_t pickAdapter(uint64_t address, int64_t now);
+
+    // Returns an adapter's mean link jitter in nanoseconds (mutex must be held)
+    uint64_t adapterJitter(size_t adapter) const;
+
+    // The monitor's main loop
+    void watchLinks();
+};
+
+#endif // MULTITRANSPORT_H
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connectscheduler.h"
+#include "guitar.h"
+#include "multitransport.h"
+#include "simtransport.h"
+
+// The number of guitars, all of them in range of both adapters
+static const int g_guitar_count = 4;
+
+// Two simulated adapters, the first one with a frame interval jitter well above the degraded threshold
+static const char* g_specification = "sim:guitars=4,jitter=6000+sim:guitars=4";
+static const char* g_balancing = "balance=links,degraded=2000,patience=0.5,avoid=60";
+
+// Waits up to the given time for a condition, returns whether it came true
+template <typename Condition>
+static bool wait_for(int milliseconds, Condition condition)
+{
+    for (int i = 0; i < milliseconds / 10 && !condition(); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return condition();
+}
+
+// Returns whether all guitars are streaming
+static bool all_streaming(const std::vector<std::unique_ptr<Guitar>>& guitars)
+{
+    for (const std::unique_ptr<Guitar>& guitar : guitars)
+    {
+        if (guitar->getState() != State_Streaming)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The entry point
+int main()
+{
+    // The guitars only exist in memory and connect all at once
+    Gamepad::setSink(Sink_None);
+    ConnectScheduler::setLimit(0);
+
+    // Open both adapters
+    std::unique_ptr<Transport> transport = Transport::create(g_specification);
+    MultiTransport* multiTransport = dynamic_cast<MultiTransport*>(transport.get());
+    if (multiTransport == NULL || !multiTransport->configure(g_balancing) || !transport->open())
+    {
+        printf("The adapters couldn't be set up.\n");
+        return 1;
+    }
+
+    // Let both of them see the guitars
+    std::thread scanner([&transport]() { transport->scan([](const std::string& /*address*/, const std::string& /*name*/) {}); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    transport->stopScan();
+    scanner.join();
+
+    int result = 0;
+    {
+        // The guitars connect spread evenly over the adapters
+        std::vector<std::unique_ptr<Guitar>> guitars;
+        for (int i = 0; i < g_guitar_count; i++)
+        {
+            guitars.push_back(std::make_unique<Guitar>(transport.get(), SimTransport::guitarAddress(i), InputMode_Notify));
+        }
+        if (!wait_for(2000, [&guitars]() { return all_streaming(guitars); }))
+        {
+            printf("Not every guitar started streaming.\n");
+            result = 1;
+        }
+        size_t first = multiTransport->getLinkCount(0);
+        size_t second = multiTransport->getLinkCount(1);
+        if (result == 0 && (first != g_guitar_count / 2 || second != g_guitar_count / 2))
+        {
+            printf("The guitars were split %zu/%zu over the adapters.\n", first, second);
+            result = 1;
+        }
+
+        // The degraded adapter's guitars move to the healthy one and stay there
+        if (result == 0 && !wait_for(10000, [&guitars, multiTransport]() { return multiTransport->getLinkCount(0) == 0 && multiTransport->getLinkCount(1) == g_guitar_count && all_streaming(guitars); }))
+        {
+            printf("The guitars ended up split %zu/%zu instead of moving off the degraded adapter.\n", multiTransport->getLinkCount(0), multiTransport->getLinkCount(1));
+            result = 1;
+        }
+        uint64_t reconnects = 0;
+        for (const std::unique_ptr<Guitar>& guitar : guitars)
+        {
+            reconnects += guitar->getCounters().get(Counter_Reconnects);
+        }
+        if (result == 0 && reconnects != g_guitar_count / 2)
+        {
+            printf("%llu reconnects for %d moved guitars.\n", (unsigned long long)reconnects, g_guitar_count / 2);
+            result = 1;
+        }
+    }
+    transport->close();
+    if (result == 0)
+    {
+        printf("%d guitars split over two adapters, the degraded one's moved.\n", g_guitar_count);
+    }
+    return result;
+}
@@ -0,0 +1,328 @@
+#include "profile.h"
+#include "address.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fstream>
+
+// A named profile input
+typedef struct ProfileInput {
+    const char* name;  // The input's name in profile files
+    uint8_t source;    // The input byte (see MappingSources), or 0xff for axes
+    uint8_t mask;      // The input bit
+} ProfileInput;
+
+// A named evdev code
+typedef struct ProfileCode {
+    const char* name;  // The code's name in profile files
+    uint16_t type;     // EV_KEY or EV_ABS
+    uint16_t code;     // The evdev code
+} ProfileCode;
+
+// The inputs profiles can map
+static const ProfileInput g_profile_inputs[] = {
+    { "w1", Source_Frets, 0x01 },
+    { "b1", Source_Frets, 0x02 },
+    { "b2", Source_Frets, 0x04 },
+    { "b3", Source_Frets, 0x08 },
+    { "w2", Source_Frets, 0x10 },
+    { "w3", Source_Frets, 0x20 },
+    { "pause", Source_Buttons, 0x02 },
+    { "ghtv", Source_Buttons, 0x04 },
+    { "heropower", Source_Buttons, 0x08 },
+    { "sync", Source_Buttons, 0x10 },
+    { "strum", 0xff, 0 },
+    { "whammy", 0xff, 0 },
+    { "tilt", 0xff, 0 },
+};
+
+// The codes the virtual gamepad supports
+static const ProfileCode g_profile_codes[] = {
+    { "BTN_A", EV_KEY, BTN_A },
+    { "BTN_SOUTH", EV_KEY, BTN_SOUTH },
+    { "BTN_B", EV_KEY, BTN_B },
+    { "BTN_EAST", EV_KEY, BTN_EAST },
+    { "BTN_X", EV_KEY, BTN_X },
+    { "BTN_NORTH", EV_KEY, BTN_NORTH },
+    { "BTN_Y", EV_KEY, BTN_Y },
+    { "BTN_WEST", EV_KEY, BTN_WEST },
+    { "BTN_TL", EV_KEY, BTN_TL },
+    { "BTN_TR", EV_KEY, BTN_TR },
+    { "BTN_SELECT", EV_KEY, BTN_SELECT },
+    { "BTN_START", EV_KEY, BTN_START },
+    { "BTN_MODE", EV_KEY, BTN_MODE },
+    { "BTN_THUMBL", EV_KEY, BTN_THUMBL },
+    { "BTN_THUMBR", EV_KEY, BTN_THUMBR },
+    { "AXIS_LEFT_ANALOG_HORIZONTAL", EV_ABS, AXIS_LEFT_ANALOG_HORIZONTAL },
+    { "AXIS_LEFT_ANALOG_VERTICAL", EV_ABS, AXIS_LEFT_ANALOG_VERTICAL },
+    { "AXIS_LEFT_TRIGGER", EV_ABS, AXIS_LEFT_TRIGGER },
+    { "AXIS_RIGHT_ANALOG_HORIZONTAL", EV_ABS, AXIS_RIGHT_ANALOG_HORIZONTAL },
+    { "AXIS_RIGHT_ANALOG_VERTICAL", EV_ABS, AXIS_RIGHT_ANALOG_VERTICAL },
+    { "AXIS_RIGHT_TRIGGER", EV_ABS, AXIS_RIGHT_TRIGGER },
+    { "AXIS_DPAD_HORIZONTAL", EV_ABS, AXIS_DPAD_HORIZONTAL },
+    { "AXIS_DPAD_VERTICAL", EV_ABS, AXIS_DPAD_VERTICAL },
+    { "NONE", 0, MAPPING_UNMAPPED },
+};
+
+// The built-in profiles (never reclaimed)
+static const ProfileSet g_builtin_profiles = { g_default_mapping_table, {} };
+
+std::string Profiles::directory;
+std::atomic<const ProfileSet*> Profiles::current(&g_builtin_profiles);
+
+// Removes leading and trailing whitespace
+static std::string trim(const std::string& value)
+{
+    size_t start = value.find_first_not_of(" \t\r\n");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    return start == std::string::npos ? "" : value.substr(start, end - start + 1);
+}
+
+// Applies an analog conditioning setting ("whammy.deadzone = 4"), returns false if it's invalid
+static bool set_conditioning(const std::string& setting, const std::string& value, MappingTable& table)
+{
+    // Find the analog input
+    size_t separator = setting.find('.');
+    std::string inputName = setting.substr(0, separator);
+    std::string parameter = setting.substr(separator + 1);
+    AnalogConditioning* conditioning = strcasecmp(inputName.c_str(), "whammy") == 0 ? &table.whammyConditioning : strcasecmp(inputName.c_str(), "tilt") == 0 ? &table.tiltConditioning : NULL;
+    if (conditioning == NULL)
+    {
+        return false;
+    }
+
+    // Parse the value (in raw input steps)
+    char* end = NULL;
+    long number = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < 0 || number > 0xff)
+    {
+        return false;
+    }
+
+    // Apply the parameter
+    if (strcasecmp(parameter.c_str(), "deadzone") == 0)
+    {
+        conditioning->deadzone = (uint8_t)number;
+    }
+    else if (strcasecmp(parameter.c_str(), "hysteresis") == 0)
+    {
+        conditioning->hysteresis = (uint8_t)number;
+    }
+    else if (strcasecmp(parameter.c_str(), "smoothing") == 0 && number <= MAPPING_MAX_SMOOTHING)
+    {
+        conditioning->smoothing = (uint8_t)number;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void Profiles::setDirectory(const std::string& path)
+{
+    // Remember the directory for the next reload
+    directory = path;
+}
+
+std::string Profiles::getDirectory()
+{
+    // We've been given a directory
+    if (!directory.empty())
+    {
+        return directory;
+    }
+
+    // Follow the XDG base directory specification
+    const char* configHome = getenv("XDG_CONFIG_HOME");
+    if (configHome != NULL && configHome[0] != '\0')
+    {
+        return std::string(configHome) + "/ghlble";
+    }
+    const char* home = getenv("HOME");
+    return std::string(home != NULL ? home : ".") + "/.config/ghlble";
+}
+
+bool Profiles::load(const std::string& path, MappingTable& table)
+{
+    // Open the profile
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Parse the profile line by line
+    bool valid = true;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+    {
+        // Skip comments and empty lines
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+        {
+            continue;
+        }
+
+        // Split the line into input and code
+        size_t separator = line.find('=');
+        std::string inputName = separator == std::string::npos ? "" : trim(line.substr(0, separator));
+        std::string codeName = separator == std::string::npos ? "" : trim(line.substr(separator + 1));
+
+        // Tune the conditioning of an analog input
+        if (inputName.find('.') != std::string::npos)
+        {
+            if (!set_conditioning(inputName, codeName, table))
+            {
+                printf("Ignoring invalid setting in %s:%d.\n", path.c_str(), lineNumber);
+                valid = false;
+            }
+            continue;
+        }
+
+        // Look up the input and the code
+        const ProfileInput* input = NULL;
+        for (const auto& candidate : g_profile_inputs)
+        {
+            if (strcasecmp(candidate.name, inputName.c_str()) == 0)
+            {
+                input = &candidate;
+            }
+        }
+        const ProfileCode* code = NULL;
+        for (const auto& candidate : g_profile_codes)
+        {
+            if (strcasecmp(candidate.name, codeName.c_str()) == 0)
+            {
+                code = &candidate;
+            }
+        }
+
+        // We don't know the input or the code, or they don't go together (the whammy bar and the tilt sensor need an analog axis, the hat only goes from -1 to 1)
+        bool isAxisInput = input != NULL && input->source == 0xff;
+        bool isAnalogInput = isAxisInput && strcasecmp(input->name, "strum") != 0;
+        bool isHatCode = code != NULL && code->type == EV_ABS && (code->code == AXIS_DPAD_HORIZONTAL || code->code == AXIS_DPAD_VERTICAL);
+        if (input == NULL || code == NULL || (code->type == EV_KEY && isAxisInput) || (code->type == EV_ABS && !isAxisInput) || (isAnalogInput && isHatCode))
+        {
+            printf("Ignoring invalid mapping in %s:%d.\n", path.c_str(), lineNumber);
+            valid = false;
+            continue;
+        }
+
+        // Map a fret or button
+        if (!isAxisInput)
+        {
+            int index = __builtin_ctz(input->mask) + (input->source == Source_Buttons ? 8 : 0);
+            table.buttons.codes[index] = code->code == MAPPING_UNMAPPED ? 0 : code->code;
+            table.buttons.mask = (uint16_t)(code->code == MAPPING_UNMAPPED ? table.buttons.mask & ~(1 << index) : table.buttons.mask | (1 << index));
+        }
+
+        // Map the strum bar
+        else if (strcasecmp(input->name, "strum") == 0)
+        {
+            bool isDpad = code->code == AXIS_DPAD_HORIZONTAL || code->code == AXIS_DPAD_VERTICAL;
+            bool isTrigger = code->code == AXIS_LEFT_TRIGGER || code->code == AXIS_RIGHT_TRIGGER;
+            table.strumAxis = code->code;
+            table.strumUp = isDpad ? DPAD_VALUE_MAX : isTrigger ? TRIGGER_VALUE_MAX : ANALOG_VALUE_MAX;
+            table.strumDown = isDpad ? DPAD_VALUE_MIN : isTrigger ? TRIGGER_VALUE_MIN : ANALOG_VALUE_MIN;
+        }
+
+        // Map the whammy bar
+        else if (strcasecmp(input->name, "whammy") == 0)
+        {
+            table.whammyAxis = code->code;
+        }
+
+        // Map the tilt sensor
+        else
+        {
+            table.tiltAxis = code->code;
+        }
+    }
+
+    // Let the caller know whether the profile was valid
+    return valid;
+}
+
+bool Profiles::reload()
+{
+    // The new profiles
+    ProfileSet* profiles = new ProfileSet();
+    profiles->global = g_default_mapping_table;
+    bool valid = true;
+
+    // Apply the global profile
+    std::string path = getDirectory();
+    std::ifstream globalFile(path + "/default.conf");
+    if (globalFile.is_open())
+    {
+        globalFile.close();
+        valid = load(path + "/default.conf", profiles->global) && valid;
+    }
+
+    // Apply the per-guitar profiles
+    DIR* profileDirectory = opendir(path.c_str());
+    if (profileDirectory != NULL)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(profileDirectory)) != NULL)
+        {
+            // Per-guitar profiles are named after the guitar's MAC address
+            std::string name = entry->d_name;
+            uint64_t address = name.size() == 22 && name.compare(17, 5, ".conf") == 0 ? packAddress(name.substr(0, 17)) : 0;
+            if (address != 0)
+            {
+                MappingTable table = profiles->global;
+                valid = load(path + "/" + name, table) && valid;
+                profiles->perAddress.emplace_back(address, table);
+            }
+        }
+        closedir(profileDirectory);
+    }
+
+    // Log the reload
+    printf("Loaded %zu guitar profile(s) from %s.\n", profiles->perAddress.size(), path.c_str());
+
+    // Publish the new profiles with a single pointer swap
+    const ProfileSet* previous = current.exchange(profiles, std::memory_order_acq_rel);
+
+    // Free the previous profiles once no input thread can be looking at them anymore
+    if (previous != &g_builtin_profiles)
+    {
+        Epoch::retire([previous]() { delete previous; });
+    }
+
+    // Let the caller know whether all profiles were valid
+    return valid;
+}
+
+const MappingTable& Profiles::lookup(uint64_t address)
+{
+    // Find the guitar's own profile, fall back to the global one
+    const ProfileSet* profiles = current.load(std::memory_order_acquire);
+    for (const auto& entry : profiles->perAddress)
+    {
+        if (entry.first == address)
+        {
+            return entry.second;
+        }
+    }
+    return profiles->global;
+}
+
+std::string Profiles::name(uint64_t address)
+{
+    // Guitars with their own profile file use it, everything else uses the global one
+    Epoch::Guard guard;
+    const ProfileSet* profiles = current.load(std::memory_order_acquire);
+    for (const auto& entry : profiles->perAddress)
+    {
+        if (entry.first == address)
+        {
+            return unpackAddress(address);
+        }
+    }
+    return "default";
+}
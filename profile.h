@@ -0,0 +1,66 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "mapping.h"
+#include "epoch.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// The compiled set of all mapping profiles
+typedef struct ProfileSet {
+    MappingTable global;                                         // The global profile
+    std::vector<std::pair<uint64_t, MappingTable>> perAddress;  // The per-guitar profiles, keyed by packed MAC address
+} ProfileSet;
+
+// Loads mapping profiles and publishes them to the input threads.
+//
+// Profiles are plain text files with one "input = code" pair per line:
+//
+//     # default.conf or AA:BB:CC:DD:EE:FF.conf
+//     sync = BTN_MODE
+//     strum = AXIS_LEFT_ANALOG_VERTICAL
+//
+// "default.conf" overrides the built-in mapping for all guitars and
+// "<MAC>.conf" overrides the global profile for a single guitar. Inputs are
+// w1, w2, w3, b1, b2, b3, pause, ghtv, heropower, sync, strum, whammy and
+// tilt; "none" unmaps an input.
+//
+// The jitter of the whammy bar and the tilt sensor is filtered before it's
+// emitted, tuned in raw input steps (0 ~ 255) with "<input>.<parameter> =
+// value" lines:
+//
+//     tilt.deadzone = 0    # Report values this close to rest as rest
+//     tilt.hysteresis = 2  # Ignore changes up to this size
+//     tilt.smoothing = 2   # Low-pass filter strength (0 = off, up to 7)
+class Profiles {
+public:
+    // Sets the directory profiles are loaded from
+    static void setDirectory(const std::string& path);
+
+    // Returns the directory profiles are loaded from
+    static std::string getDirectory();
+
+    // Compiles all profiles and publishes them, returns false if a file contained errors
+    static bool reload();
+
+    // Returns the mapping table of the given guitar (the caller must hold an Epoch::Guard)
+    static const MappingTable& lookup(uint64_t address);
+
+    // Returns the name of the profile the given guitar uses ("default" or its MAC address)
+    static std::string name(uint64_t address);
+
+private:
+    // The profile directory
+    static std::string directory;
+
+    // The published profiles
+    static std::atomic<const ProfileSet*> current;
+
+    // Applies a profile file on top of the given table, returns false if the file contained errors
+    static bool load(const std::string& path, MappingTable& table);
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "address.h"
+#include "guitar.h"
+
+// The profiles the test swaps between (on top of the built-in mapping, none of them maps two inputs to the same code)
+static const char* g_profiles[] = {
+    "",
+    "w1 = BTN_Y\nb3 = BTN_X\nstrum = AXIS_LEFT_ANALOG_VERTICAL\nwhammy = AXIS_LEFT_ANALOG_HORIZONTAL\ntilt = AXIS_RIGHT_ANALOG_VERTICAL\n",
+    "w2 = none\nheropower = BTN_MODE\npause = BTN_THUMBR\nstrum = none\nwhammy = AXIS_RIGHT_TRIGGER\ntilt = AXIS_LEFT_ANALOG_VERTICAL\n",
+    "w1 = BTN_TL\nw2 = BTN_X\nstrum = AXIS_RIGHT_ANALOG_HORIZONTAL\nwhammy = none\ntilt = AXIS_LEFT_TRIGGER\n",
+};
+
+// Every code a profile can map to
+static const uint16_t g_keys[] = { BTN_A, BTN_B, BTN_X, BTN_Y, BTN_TL, BTN_TR, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR };
+static const uint16_t g_axes[] = { AXIS_LEFT_ANALOG_HORIZONTAL, AXIS_LEFT_ANALOG_VERTICAL, AXIS_LEFT_TRIGGER, AXIS_RIGHT_ANALOG_HORIZONTAL, AXIS_RIGHT_ANALOG_VERTICAL, AXIS_RIGHT_TRIGGER, AXIS_DPAD_HORIZONTAL, AXIS_DPAD_VERTICAL };
+
+// Writes the global profile (with the jitter filter off, so every analog step is reported) and publishes it
+static bool use_profile(const std::string& directory, int index)
+{
+    std::string path = directory + "/default.conf";
+    FILE* profile = fopen(path.c_str(), "w");
+    if (profile == NULL)
+    {
+        return false;
+    }
+    fputs(g_profiles[index], profile);
+    fputs("whammy.deadzone = 0\nwhammy.hysteresis = 0\nwhammy.smoothing = 0\ntilt.deadzone = 0\ntilt.hysteresis = 0\ntilt.smoothing = 0\n", profile);
+    fclose(profile);
+    return Profiles::reload();
+}
+
+// Returns the value the gamepad should report for an axis, false if it should be at rest
+static bool expected_axis_value(const MappingTable& mapping, const GuitarData& data, uint16_t axis, int32_t* value)
+{
+    if (axis == mapping.strumAxis)
+    {
+        *value = data.strum == 0xff ? mapping.strumUp : data.strum == 0 ? mapping.strumDown : 0;
+        return true;
+    }
+    if (axis == mapping.whammyAxis)
+    {
+        *value = analogAxisValue(axis, data.whammy);
+        return true;
+    }
+    if (axis == mapping.tiltAxis)
+    {
+        *value = analogAxisValue(axis, data.tilt);
+        return true;
+    }
+    return false;
+}
+
+// Checks the gamepad's state against a frame mapped with the table in force, returns false (and says why) if it differs
+static bool check_state(const std::map<uint16_t, int32_t>& keys, const std::map<uint16_t, int32_t>& axes, const GuitarData& data, size_t frameIndex)
+{
+    Epoch::Guard guard;
+    const MappingTable& mapping = Profiles::lookup(packAddress("5E:00:00:00:7E:02"));
+    uint16_t held = packDigitalInput(data.frets, data.buttons) & mapping.buttons.mask;
+
+    // A key is down exactly while an input mapped to it is held
+    for (uint16_t key : g_keys)
+    {
+        bool pressed = false;
+        for (int bit = 0; bit < 16; bit++)
+        {
+            pressed = pressed || ((held >> bit) & 1 && mapping.buttons.codes[bit] == key);
+        }
+        auto reported = keys.find(key);
+        int32_t value = reported == keys.end() ? BTN_RELEASED : reported->second;
+        if (value != (pressed ? BTN_PRESSED : BTN_RELEASED))
+        {
+            printf("Frame %zu: key %u is %d, expected %d.\n", frameIndex, key, value, pressed ? BTN_PRESSED : BTN_RELEASED);
+            return false;
+        }
+    }
+
+    // An axis follows the input mapped to it, the others are at rest (never moved or centered)
+    for (uint16_t axis : g_axes)
+    {
+        auto reported = axes.find(axis);
+        int32_t value = reported == axes.end() ? 0 : reported->second;
+        int32_t rest = analogAxisValue(axis, 0x80);
+        int32_t expected;
+        bool driven = expected_axis_value(mapping, data, axis, &expected);
+        if ((driven && value != expected && !(expected == rest && value == 0)) || (!driven && value != 0 && value != rest))
+        {
+            printf("Frame %zu: axis %u is %d, expected %s%d.\n", frameIndex, axis, value, driven ? "" : "rest, not ", driven ? expected : value);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The entry point
+int main()
+{
+    // Capture the events and load profiles from a directory of our own
+    char directory[] = "/tmp/ghlble_profile_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    Gamepad::setSink(Sink_Capture, directory);
+    Guitar::setAnalogRate(0);
+    Profiles::setDirectory(directory);
+    if (!use_profile(directory, 0))
+    {
+        printf("The initial profile was rejected.\n");
+        return 1;
+    }
+
+    // Random walks over all inputs (except sync, which shares BTN_A with b1, and the directional pad, which shares its axis with strum), swapping profiles in between
+    GuitarData frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.directionalPad = Direction_Centered;
+    frame.strum = 0x80;
+    frame.whammy = 0x80;
+    frame.tilt = 0x80;
+    int result = 0;
+    int swaps = 0;
+    int fd = -1;
+    std::string capture;
+    std::map<uint16_t, int32_t> keys;
+    std::map<uint16_t, int32_t> axes;
+    {
+        Guitar guitar("5E:00:00:00:7E:02");
+        capture = std::string(directory) + "/" + guitar.getGamepadName() + ".events";
+        for (size_t i = std::string(directory).size() + 1; i < capture.size() - 7; i++)
+        {
+            capture[i] = isalnum((unsigned char)capture[i]) ? capture[i] : '_';
+        }
+        uint32_t random = 0x6b8b4567;
+        for (int i = 0; i < 20000 && result == 0; i++)
+        {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+
+            // Reload the profiles now and then (with inputs held, strumming and the analog inputs away from rest)
+            if (random % 16 == 0)
+            {
+                if (!use_profile(directory, (random >> 4) % 4))
+                {
+                    printf("A test profile was rejected.\n");
+                    result = 1;
+                    break;
+                }
+                swaps++;
+            }
+
+            // Move some inputs, or let the guitar rest for a while
+            if ((random >> 6) % 8 == 0)
+            {
+                frame.frets = 0;
+                frame.buttons = 0;
+                frame.strum = 0x80;
+                frame.whammy = 0x80;
+                frame.tilt = 0x80;
+            }
+            else
+            {
+                frame.frets ^= (uint8_t)(1 << ((random >> 9) % 6));
+                frame.buttons = (random >> 12) % 4 == 0 ? (uint8_t)((random >> 14) & 0x0e) : frame.buttons;
+                frame.strum = (random >> 18) % 3 == 0 ? 0x00 : (random >> 18) % 3 == 1 ? 0xff : 0x80;
+                frame.whammy = (random >> 20) % 2 == 0 ? (uint8_t)(random >> 24) : frame.whammy;
+                frame.tilt = (random >> 21) % 2 == 0 ? (uint8_t)(random >> 16) : frame.tilt;
+            }
+            guitar.replay(frame, i + 1);
+
+            // Apply the reports to the gamepad's state (the capture file exists once the first report has been written)
+            if (fd < 0)
+            {
+                fd = open(capture.c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            struct input_event ev;
+            while (fd >= 0 && read(fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev))
+            {
+                if (ev.type == EV_KEY)
+                {
+                    keys[ev.code] = ev.value;
+                }
+                else if (ev.type == EV_ABS)
+                {
+                    axes[ev.code] = ev.value;
+                }
+            }
+            if (!check_state(keys, axes, frame, i))
+            {
+                result = 1;
+            }
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (result == 0 && swaps == 0)
+    {
+        printf("The profiles were never swapped.\n");
+        result = 1;
+    }
+    if (result == 0)
+    {
+        printf("20000 frames, %d profile swaps, nothing stuck.\n", swaps);
+    }
+
+    // Clean up
+    unlink(capture.c_str());
+    unlink((std::string(directory) + "/default.conf").c_str());
+    rmdir(directory);
+    return result;
+}
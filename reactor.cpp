@@ -0,0 +1,351 @@
+#include "reactor.h"
+
+#include <algorithm>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// The owner of the task the calling thread is currently running
+static thread_local const void* t_current_owner = nullptr;
+
+Reactor::Reactor() : epollFd(-1), wakeFd(-1), timerFd(-1), running(false), nextTimerId(1)
+{
+}
+
+Reactor::~Reactor()
+{
+    // Stop the threads
+    stop();
+}
+
+bool Reactor::start(size_t workerCount)
+{
+    // Create the file descriptors
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    // We failed to create the file descriptors
+    if (epollFd < 0 || wakeFd < 0 || timerFd < 0)
+    {
+        stop();
+        return false;
+    }
+
+    // Listen for wake-ups and timers
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+    ev.data.fd = timerFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+
+    // Start the threads
+    running = true;
+    thread = std::thread(&Reactor::run, this);
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        workers.emplace_back(&Reactor::work, this);
+    }
+    return true;
+}
+
+void Reactor::stop()
+{
+    // Ask the threads to stop
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_all();
+    if (wakeFd >= 0)
+    {
+        wake();
+    }
+
+    // Wait for the threads to finish
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+
+    // Discard everything that's left
+    tasks.clear();
+    workerTasks.clear();
+    timers.clear();
+    timerDeadlines.clear();
+    watchers.clear();
+
+    // Close the file descriptors
+    for (int* fd : { &epollFd, &wakeFd, &timerFd })
+    {
+        if (*fd >= 0)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void Reactor::post(const void* owner, Task task)
+{
+    // Queue the task and wake the reactor thread up
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back({ owner, std::move(task) });
+    }
+    wake();
+}
+
+uint64_t Reactor::schedule(const void* owner, std::chrono::milliseconds delay, Task task)
+{
+    // Queue the timer
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t id = nextTimerId++;
+    auto deadline = std::chrono::steady_clock::now() + delay;
+    timers.emplace(deadline, Timer{ id, owner, std::move(task) });
+    timerDeadlines[id] = deadline;
+
+    // The new timer might be the earliest one
+    armTimer();
+    return id;
+}
+
+void Reactor::cancel(uint64_t timerId)
+{
+    // Find the timer
+    std::lock_guard<std::mutex> lock(mutex);
+    auto deadline = timerDeadlines.find(timerId);
+    if (deadline == timerDeadlines.end())
+    {
+        return;
+    }
+
+    // Remove it
+    auto range = timers.equal_range(deadline->second);
+    for (auto timer = range.first; timer != range.second; ++timer)
+    {
+        if (timer->second.id == timerId)
+        {
+            timers.erase(timer);
+            break;
+        }
+    }
+    timerDeadlines.erase(deadline);
+}
+
+void Reactor::offload(const void* owner, Task task)
+{
+    // There are no workers, use the reactor thread
+    if (workers.empty())
+    {
+        post(owner, std::move(task));
+        return;
+    }
+
+    // Queue the task for the workers
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        workerTasks.push_back({ owner, std::move(task) });
+    }
+    condition.notify_all();
+}
+
+bool Reactor::watch(const void* owner, int fd, uint32_t events, Handler handler)
+{
+    // Remember the handler
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watchers[fd] = Watcher{ owner, std::make_shared<Handler>(std::move(handler)) };
+    }
+
+    // Add the file descriptor to the epoll set
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void Reactor::unwatch(int fd)
+{
+    // Remove the file descriptor from the epoll set
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+
+    // Forget the handler
+    std::lock_guard<std::mutex> lock(mutex);
+    watchers.erase(fd);
+}
+
+void Reactor::purge(const void* owner)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Discard the owner's queued tasks
+    auto ownedBy = [owner](const QueuedTask& task) { return task.owner == owner; };
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(), ownedBy), tasks.end());
+    workerTasks.erase(std::remove_if(workerTasks.begin(), workerTasks.end(), ownedBy), workerTasks.end());
+
+    // Discard the owner's timers
+    for (auto timer = timers.begin(); timer != timers.end();)
+    {
+        if (timer->second.owner == owner)
+        {
+            timerDeadlines.erase(timer->second.id);
+            timer = timers.erase(timer);
+        }
+        else
+        {
+            ++timer;
+        }
+    }
+
+    // Discard the owner's watchers
+    for (auto watcher = watchers.begin(); watcher != watchers.end();)
+    {
+        if (watcher->second.owner == owner)
+        {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, watcher->first, NULL);
+            watcher = watchers.erase(watcher);
+        }
+        else
+        {
+            ++watcher;
+        }
+    }
+
+    // Wait for the owner's running tasks to finish (unless we're being called from one of them)
+    size_t ownTasks = t_current_owner == owner ? 1 : 0;
+    condition.wait(lock, [this, owner, ownTasks]() { return (size_t)std::count(runningOwners.begin(), runningOwners.end(), owner) <= ownTasks; });
+}
+
+bool Reactor::isReactorThread() const
+{
+    // Compare the thread IDs
+    return std::this_thread::get_id() == thread.get_id();
+}
+
+void Reactor::wake()
+{
+    // Bump the event counter
+    uint64_t value = 1;
+    ssize_t written = write(wakeFd, &value, sizeof(value));
+    (void)written;
+}
+
+void Reactor::armTimer()
+{
+    // Fire at the earliest deadline (or never)
+    struct itimerspec spec = {};
+    if (!timers.empty())
+    {
+        auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(timers.begin()->first - std::chrono::steady_clock::now()).count();
+        delay = delay < 1 ? 1 : delay;
+        spec.it_value.tv_sec = delay / 1000000000;
+        spec.it_value.tv_nsec = delay % 1000000000;
+    }
+    timerfd_settime(timerFd, 0, &spec, NULL);
+}
+
+void Reactor::execute(std::unique_lock<std::mutex>& lock, const void* owner, Task& task)
+{
+    // Mark the owner as busy
+    runningOwners.push_back(owner);
+    lock.unlock();
+
+    // Run the task
+    t_current_owner = owner;
+    task();
+    t_current_owner = nullptr;
+
+    // Mark the owner as idle again
+    lock.lock();
+    runningOwners.erase(std::find(runningOwners.begin(), runningOwners.end(), owner));
+    condition.notify_all();
+}
+
+void Reactor::run()
+{
+    // The ready file descriptors
+    struct epoll_event events[16];
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+        // Wait for something to happen
+        lock.unlock();
+        int count = epoll_wait(epollFd, events, 16, -1);
+        lock.lock();
+
+        // Handle the ready file descriptors
+        for (int i = 0; i < count && running; i++)
+        {
+            int fd = events[i].data.fd;
+
+            // Consume wake-ups and timer expirations
+            if (fd == wakeFd || fd == timerFd)
+            {
+                uint64_t value;
+                ssize_t consumed = read(fd, &value, sizeof(value));
+                (void)consumed;
+                continue;
+            }
+
+            // Call the watcher (it might unwatch itself, so keep the handler alive)
+            auto watcher = watchers.find(fd);
+            if (watcher != watchers.end())
+            {
+                const void* owner = watcher->second.owner;
+                std::shared_ptr<Handler> handler = watcher->second.handler;
+                uint32_t mask = events[i].events;
+                Task task = [handler, mask]() { (*handler)(mask); };
+                execute(lock, owner, task);
+            }
+        }
+
+        // Run the due timers
+        auto now = std::chrono::steady_clock::now();
+        while (running && !timers.empty() && timers.begin()->first <= now)
+        {
+            Timer timer = std::move(timers.begin()->second);
+            timers.erase(timers.begin());
+            timerDeadlines.erase(timer.id);
+            execute(lock, timer.owner, timer.task);
+        }
+
+        // Run the queued tasks one by one so they can still be purged (tasks queued meanwhile wait for their own wake-up)
+        for (size_t remaining = tasks.size(); running && remaining > 0 && !tasks.empty(); remaining--)
+        {
+            QueuedTask task = std::move(tasks.front());
+            tasks.erase(tasks.begin());
+            execute(lock, task.owner, task.task);
+        }
+
+        // Arm the timer for the next deadline
+        armTimer();
+    }
+}
+
+void Reactor::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        // Wait for work
+        condition.wait(lock, [this]() { return !running || !workerTasks.empty(); });
+        if (!running)
+        {
+            break;
+        }
+
+        // Run the oldest task
+        QueuedTask task = std::move(workerTasks.front());
+        workerTasks.erase(workerTasks.begin());
+        execute(lock, task.owner, task.task);
+    }
+}
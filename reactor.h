@@ -0,0 +1,144 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A single-threaded epoll event loop with one-shot timers, fd watchers and an optional worker pool.
+//
+// Every task, timer and watcher is tagged with an owner so objects can purge
+// everything that still refers to them before they go away.
+class Reactor {
+public:
+    // A unit of work
+    typedef std::function<void()> Task;
+
+    // A file descriptor event handler (receives the epoll event mask)
+    typedef std::function<void(uint32_t)> Handler;
+
+    // Constructor
+    Reactor();
+
+    // Destructor
+    ~Reactor();
+
+    // Starts the reactor thread and the given number of worker threads
+    bool start(size_t workerCount = 0);
+
+    // Stops all threads, pending tasks and timers are discarded
+    void stop();
+
+    // Runs the task on the reactor thread
+    void post(const void* owner, Task task);
+
+    // Runs the task on the reactor thread after the given delay, returns the timer ID
+    uint64_t schedule(const void* owner, std::chrono::milliseconds delay, Task task);
+
+    // Cancels a scheduled task
+    void cancel(uint64_t timerId);
+
+    // Runs a potentially blocking task on a worker thread (or the reactor thread if there are no workers)
+    void offload(const void* owner, Task task);
+
+    // Calls the handler on the reactor thread whenever the file descriptor becomes ready
+    bool watch(const void* owner, int fd, uint32_t events, Handler handler);
+
+    // Stops watching the file descriptor
+    void unwatch(int fd);
+
+    // Discards all tasks, timers and watchers of the owner and waits for its running tasks to finish
+    void purge(const void* owner);
+
+    // Returns whether the calling thread is the reactor thread
+    bool isReactorThread() const;
+
+private:
+    // A queued task
+    struct QueuedTask {
+        const void* owner;
+        Task task;
+    };
+
+    // A scheduled task
+    struct Timer {
+        uint64_t id;
+        const void* owner;
+        Task task;
+    };
+
+    // A watched file descriptor
+    struct Watcher {
+        const void* owner;
+        std::shared_ptr<Handler> handler;
+    };
+
+    // The epoll handle
+    int epollFd;
+
+    // Wakes the reactor thread up
+    int wakeFd;
+
+    // Fires when the earliest timer is due
+    int timerFd;
+
+    // Whether the threads should keep running
+    bool running;
+
+    // Guards everything below
+    std::mutex mutex;
+
+    // Signaled when a task finishes or work is queued for the workers
+    std::condition_variable condition;
+
+    // The tasks waiting to run on the reactor thread
+    std::vector<QueuedTask> tasks;
+
+    // The tasks waiting to run on a worker thread
+    std::vector<QueuedTask> workerTasks;
+
+    // The scheduled tasks, ordered by deadline
+    std::multimap<std::chrono::steady_clock::time_point, Timer> timers;
+
+    // The deadline of every scheduled task, keyed by ID
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> timerDeadlines;
+
+    // The next timer ID
+    uint64_t nextTimerId;
+
+    // The watched file descriptors
+    std::unordered_map<int, Watcher> watchers;
+
+    // The owners of the tasks that are currently running
+    std::vector<const void*> runningOwners;
+
+    // The reactor thread
+    std::thread thread;
+
+    // The worker threads
+    std::vector<std::thread> workers;
+
+    // The reactor thread's main loop
+    void run();
+
+    // A worker thread's main loop
+    void work();
+
+    // Wakes the reactor thread up
+    void wake();
+
+    // Arms the timer file descriptor for the earliest deadline (mutex must be held)
+    void armTimer();
+
+    // Runs a task on behalf of its owner
+    void execute(std::unique_lock<std::mutex>& lock, const void* owner, Task& task);
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,282 @@
+#include "recording.h"
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// The recording file header
+typedef struct RecordingHeader {
+    char magic[4];        // "GHLR"
+    uint16_t version;     // The file format version
+    uint16_t frameSize;   // sizeof(GuitarData)
+} __attribute__((packed)) RecordingHeader;
+
+// The current file format version
+#define RECORDING_VERSION 1
+
+// The record keys
+#define RECORDING_KEY_SESSION 0
+#define RECORDING_KEY_GUITAR 1
+#define RECORDING_KEY_FRAME 2
+
+// The stdio buffer size of the recording (keeps the writes off the input path most of the time)
+#define RECORDING_BUFFER_SIZE 65536
+
+std::atomic<bool> Recorder::recording(false);
+std::mutex Recorder::mutex;
+FILE* Recorder::file = NULL;
+std::vector<uint64_t> Recorder::guitars;
+int64_t Recorder::lastTime = 0;
+
+bool Recorder::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Open the recording for appending
+    file = fopen(path.c_str(), "ab");
+    if (file == NULL)
+    {
+        printf("Failed to open the recording (%s).\n", path.c_str());
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, RECORDING_BUFFER_SIZE);
+
+    // Write the header if the file is new
+    if (ftell(file) == 0)
+    {
+        RecordingHeader header = { { 'G', 'H', 'L', 'R' }, RECORDING_VERSION, sizeof(GuitarData) };
+        fwrite(&header, sizeof(header), 1, file);
+    }
+
+    // Start a new session
+    struct timespec wallClock;
+    clock_gettime(CLOCK_REALTIME, &wallClock);
+    uint64_t started = (uint64_t)wallClock.tv_sec * 1000000000 + wallClock.tv_nsec;
+    writeVarint(RECORDING_KEY_SESSION);
+    fwrite(&started, sizeof(started), 1, file);
+    guitars.clear();
+    lastTime = LatencyStats::now() / 1000;
+
+    // Start recording
+    recording = true;
+    printf("Recording guitar input to %s.\n", path.c_str());
+    return true;
+}
+
+void Recorder::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Stop recording
+    recording = false;
+    if (file != NULL)
+    {
+        // Flush and close the file
+        fclose(file);
+        file = NULL;
+    }
+}
+
+void Recorder::write(uint64_t address, int64_t arrival, const GuitarData& data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The recording has been closed in the meantime
+    if (file == NULL)
+    {
+        return;
+    }
+
+    // Find the guitar (there are only a few of them)
+    size_t index = std::find(guitars.begin(), guitars.end(), address) - guitars.begin();
+
+    // Introduce the guitar the first time it shows up
+    if (index == guitars.size())
+    {
+        uint8_t mac[6];
+        for (int i = 0; i < 6; i++)
+        {
+            mac[i] = (uint8_t)(address >> (40 - 8 * i));
+        }
+        writeVarint(RECORDING_KEY_GUITAR);
+        fwrite(mac, sizeof(mac), 1, file);
+        guitars.push_back(address);
+    }
+
+    // Frames of different guitars may be recorded slightly out of order, never let the time go backwards
+    int64_t time = std::max(arrival / 1000, lastTime);
+
+    // Write the frame
+    writeVarint(RECORDING_KEY_FRAME + index);
+    writeVarint((uint64_t)(time - lastTime));
+    fwrite(&data, sizeof(data), 1, file);
+    lastTime = time;
+}
+
+void Recorder::writeVarint(uint64_t value)
+{
+    // 7 bits per byte, the top bit marks that more bytes follow
+    uint8_t bytes[10];
+    size_t length = 0;
+    do
+    {
+        bytes[length] = (uint8_t)(value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+        length++;
+    } while (value != 0);
+    fwrite(bytes, length, 1, file);
+}
+
+Recording::Recording() : map(NULL), size(0), position(0), time(0), corrupt(false)
+{
+}
+
+Recording::~Recording()
+{
+    // Unmap the recording
+    close();
+}
+
+bool Recording::open(const std::string& path)
+{
+    // Start over
+    close();
+
+    // Open the recording
+    int handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (handle < 0)
+    {
+        return false;
+    }
+
+    // Map all of it (the mapping outlives the handle)
+    struct stat status;
+    if (fstat(handle, &status) == 0 && (size_t)status.st_size >= sizeof(RecordingHeader))
+    {
+        void* mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+        if (mapped != MAP_FAILED)
+        {
+            map = (const uint8_t*)mapped;
+            size = status.st_size;
+            madvise(mapped, size, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(handle);
+    if (map == NULL)
+    {
+        return false;
+    }
+
+    // Validate the header
+    const RecordingHeader* header = (const RecordingHeader*)map;
+    if (memcmp(header->magic, "GHLR", 4) != 0 || header->version != RECORDING_VERSION || header->frameSize != sizeof(GuitarData))
+    {
+        close();
+        return false;
+    }
+    position = sizeof(RecordingHeader);
+    return true;
+}
+
+void Recording::close()
+{
+    // Unmap the recording
+    if (map != NULL)
+    {
+        munmap((void*)map, size);
+    }
+    map = NULL;
+    size = 0;
+    position = 0;
+    time = 0;
+    corrupt = false;
+    guitars.clear();
+}
+
+bool Recording::next(RecordedFrame* frame)
+{
+    // Skip the records until the next frame (a record cut short is corrupt, e.g. because the daemon crashed while writing it)
+    uint64_t key;
+    while (map != NULL && !corrupt && position < size)
+    {
+        // Read the key
+        if (!readVarint(&key))
+        {
+            corrupt = true;
+            return false;
+        }
+
+        // A new session (its guitars are introduced again, its time carries on from the previous one)
+        if (key == RECORDING_KEY_SESSION)
+        {
+            if (size - position < sizeof(uint64_t))
+            {
+                corrupt = true;
+                return false;
+            }
+            position += sizeof(uint64_t);
+            guitars.clear();
+        }
+
+        // A new guitar
+        else if (key == RECORDING_KEY_GUITAR)
+        {
+            if (size - position < 6)
+            {
+                corrupt = true;
+                return false;
+            }
+            uint64_t address = 0;
+            for (int i = 0; i < 6; i++)
+            {
+                address = address << 8 | map[position++];
+            }
+            guitars.push_back(address);
+        }
+
+        // A frame
+        else
+        {
+            uint64_t delta;
+            if (key - RECORDING_KEY_FRAME >= guitars.size() || !readVarint(&delta) || size - position < sizeof(GuitarData))
+            {
+                corrupt = true;
+                return false;
+            }
+            time += (int64_t)delta;
+            frame->address = guitars[key - RECORDING_KEY_FRAME];
+            frame->time = time;
+            frame->data = (const GuitarData*)(map + position);
+            position += sizeof(GuitarData);
+            return true;
+        }
+    }
+
+    // We've reached the end of the recording
+    return false;
+}
+
+bool Recording::isCorrupt() const
+{
+    return corrupt;
+}
+
+bool Recording::readVarint(uint64_t* value)
+{
+    // 7 bits per byte, the top bit marks that more bytes follow
+    *value = 0;
+    for (int shift = 0; shift < 64 && position < size; shift += 7)
+    {
+        uint8_t byte = map[position++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
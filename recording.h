@@ -0,0 +1,113 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "guitar.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A recorded frame (the data points into the mapped recording)
+typedef struct RecordedFrame {
+    uint64_t address;        // The packed MAC address of the guitar
+    int64_t time;            // The arrival time in microseconds since the start of the recording
+    const GuitarData* data;  // The raw frame
+} RecordedFrame;
+
+// Appends the raw frames of all guitars to a compact binary log.
+//
+// The file starts with a small header followed by variable length records,
+// each introduced by a varint key: 0 starts a session (followed by its wall
+// clock start time), 1 introduces a guitar (followed by its 6 byte MAC) and
+// 2 + N is a frame of the Nth guitar of the session (followed by the varint
+// microseconds since the previous frame and the 20 raw bytes). Every daemon
+// run appends a session of its own.
+class Recorder {
+public:
+    // Starts appending frames to the given file
+    static bool open(const std::string& path);
+
+    // Flushes and closes the file
+    static void close();
+
+    // Records a frame (arrival is the frame's monotonic arrival time in nanoseconds)
+    static inline void record(uint64_t address, int64_t arrival, const GuitarData& data)
+    {
+        // We're recording
+        if (recording.load(std::memory_order_relaxed))
+        {
+            write(address, arrival, data);
+        }
+    }
+
+private:
+    // Whether frames are being recorded
+    static std::atomic<bool> recording;
+
+    // Serializes the writers
+    static std::mutex mutex;
+
+    // The recording
+    static FILE* file;
+
+    // The guitars of the current session (their index is their key - 2)
+    static std::vector<uint64_t> guitars;
+
+    // The arrival time of the previous frame in microseconds
+    static int64_t lastTime;
+
+    // Appends a frame to the file
+    static void write(uint64_t address, int64_t arrival, const GuitarData& data);
+
+    // Appends a varint to the file (mutex must be held)
+    static void writeVarint(uint64_t value);
+};
+
+// Reads a recording through a read-only memory mapping
+class Recording {
+public:
+    // Constructor
+    Recording();
+
+    // Destructor
+    ~Recording();
+
+    // Maps the given recording
+    bool open(const std::string& path);
+
+    // Unmaps the recording
+    void close();
+
+    // Returns the next frame, returns false at the end of the recording (or at the first corrupt record)
+    bool next(RecordedFrame* frame);
+
+    // Returns whether reading stopped at a corrupt record
+    bool isCorrupt() const;
+
+private:
+    // The mapped file
+    const uint8_t* map;
+
+    // The size of the mapped file
+    size_t size;
+
+    // The read position
+    size_t position;
+
+    // The arrival time of the previous frame in microseconds
+    int64_t time;
+
+    // Whether we've hit a corrupt record
+    bool corrupt;
+
+    // The guitars of the current session
+    std::vector<uint64_t> guitars;
+
+    // Reads a varint, returns false if the file ends in the middle of it
+    bool readVarint(uint64_t* value);
+};
+
+#endif // RECORDING_H
@@ -0,0 +1,85 @@
+#include "registry.h"
+
+GuitarRegistry::GuitarRegistry() : table(new Table())
+{
+}
+
+GuitarRegistry::~GuitarRegistry()
+{
+    // Destroy the guitars and the last snapshot
+    clear();
+    delete table.load();
+}
+
+Guitar* GuitarRegistry::find(uint64_t address) const
+{
+    // Look the guitar up in the current snapshot
+    const Table* current = table.load(std::memory_order_acquire);
+    auto it = current->index.find(address);
+    return it != current->index.end() ? it->second : NULL;
+}
+
+bool GuitarRegistry::add(uint64_t address, const Factory& create)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Somebody else beat us to it
+    const Table* current = table.load(std::memory_order_acquire);
+    if (current->index.count(address) != 0)
+    {
+        return false;
+    }
+
+    // Create the guitar
+    owned.push_back(create());
+    Guitar* guitar = owned.back().get();
+
+    // Publish a snapshot that includes it
+    Table* next = new Table(*current);
+    next->index.emplace(address, guitar);
+    next->guitars.push_back(guitar);
+    publish(next);
+    return true;
+}
+
+void GuitarRegistry::forEach(const std::function<void(Guitar*)>& visitor) const
+{
+    // Pin the snapshot while we're iterating it
+    Epoch::Guard guard;
+    for (Guitar* guitar : table.load(std::memory_order_acquire)->guitars)
+    {
+        visitor(guitar);
+    }
+}
+
+size_t GuitarRegistry::size() const
+{
+    // Count the guitars of the current snapshot
+    Epoch::Guard guard;
+    return table.load(std::memory_order_acquire)->guitars.size();
+}
+
+void GuitarRegistry::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // There's nothing to remove
+    if (owned.empty())
+    {
+        return;
+    }
+
+    // Hide the guitars from new readers and wait for the current ones
+    publish(new Table());
+    Epoch::synchronize();
+
+    // Destroy the guitars
+    owned.clear();
+}
+
+void GuitarRegistry::publish(const Table* next)
+{
+    // Swap the snapshot and free the previous one once nobody can see it anymore
+    const Table* previous = table.exchange(next, std::memory_order_acq_rel);
+    Epoch::retire([previous]() { delete previous; });
+}
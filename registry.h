@@ -0,0 +1,68 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "epoch.h"
+#include "guitar.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// The set of known guitars, keyed by their packed MAC addresses.
+//
+// The guitars are published as an immutable table through an atomic pointer,
+// so lookups and iteration never lock and never wait for a writer (readers
+// only have to hold an Epoch::Guard while they use what they found). Adding a
+// guitar copies the table, which is fine since that only happens once per
+// guitar.
+class GuitarRegistry {
+public:
+    // Creates a guitar
+    typedef std::function<std::unique_ptr<Guitar>()> Factory;
+
+    // Constructor
+    GuitarRegistry();
+
+    // Destructor
+    ~GuitarRegistry();
+
+    // Returns the guitar with the given address or NULL (the caller must hold an Epoch::Guard while using it)
+    Guitar* find(uint64_t address) const;
+
+    // Creates and adds a guitar unless one with the same address exists, returns whether it was added
+    bool add(uint64_t address, const Factory& create);
+
+    // Calls the visitor for every guitar of the current snapshot
+    void forEach(const std::function<void(Guitar*)>& visitor) const;
+
+    // Returns the number of guitars
+    size_t size() const;
+
+    // Removes and destroys all guitars (waits for the readers that might still use them)
+    void clear();
+
+private:
+    // An immutable snapshot of the guitars
+    struct Table {
+        std::unordered_map<uint64_t, Guitar*> index;
+        std::vector<Guitar*> guitars;
+    };
+
+    // The current snapshot
+    std::atomic<const Table*> table;
+
+    // Serializes the writers
+    std::mutex mutex;
+
+    // The guitars (writers only)
+    std::vector<std::unique_ptr<Guitar>> owned;
+
+    // Publishes a new snapshot and retires the previous one (mutex must be held)
+    void publish(const Table* next);
+};
+
+#endif // REGISTRY_H
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "address.h"
+#include "registry.h"
+
+// The number of concurrent writers and readers
+static const int g_writer_count = 4;
+static const int g_reader_count = 4;
+
+// The number of fill-and-clear rounds and the guitars added per round
+static const int g_round_count = 25;
+static const int g_guitars_per_round = 64;
+
+// The failures seen by any thread
+static std::atomic<int> g_failures(0);
+
+// Reports a failure
+static void fail(const char* what, uint64_t address)
+{
+    // Keep the output short if things go badly wrong
+    if (g_failures.fetch_add(1) < 10)
+    {
+        printf("%s (%s)\n", what, unpackAddress(address).c_str());
+    }
+}
+
+// Returns the address of a guitar of a round
+static uint64_t address_of(int round, int index)
+{
+    return 0x5E0000000000ull | ((uint64_t)round << 8) | (uint64_t)index;
+}
+
+// Checks that a guitar belongs to the address it was found under
+static void check_guitar(Guitar* guitar, uint64_t address)
+{
+    if (guitar->getAddress() != unpackAddress(address))
+    {
+        fail("A guitar was found under another address", address);
+    }
+}
+
+// Adds the guitars of a round, racing the other writers for every one of them
+static void write_round(GuitarRegistry& registry, int round, std::atomic<int>& added)
+{
+    for (int index = 0; index < g_guitars_per_round; index++)
+    {
+        uint64_t address = address_of(round, index);
+        if (registry.add(address, [address]() { return std::unique_ptr<Guitar>(new Guitar(unpackAddress(address))); }))
+        {
+            added++;
+        }
+    }
+}
+
+// Looks guitars up and walks the registry until told to stop
+static void read_registry(GuitarRegistry& registry, uint32_t seed, const std::atomic<int>& round, const std::atomic<bool>& stop, std::atomic<uint64_t>& reads)
+{
+    uint32_t random = 0x9e3779b9 ^ seed;
+    while (!stop.load())
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+
+        // Look up a guitar of the current round (it might not have been added yet)
+        {
+            Epoch::Guard guard;
+            uint64_t address = address_of(round.load(), random % g_guitars_per_round);
+            Guitar* guitar = registry.find(address);
+            if (guitar != NULL)
+            {
+                check_guitar(guitar, address);
+            }
+        }
+
+        // Walk a snapshot (its guitars have to stay alive and unique while we're on it)
+        size_t count = 0;
+        registry.forEach([&count](Guitar* guitar) {
+            uint64_t address = packAddress(guitar->getAddress());
+            if ((address & ~0xffffull) != 0x5E0000000000ull)
+            {
+                fail("A snapshot holds a guitar that was never added", address);
+            }
+            count++;
+        });
+        if (count > (size_t)g_guitars_per_round)
+        {
+            fail("A snapshot holds more guitars than were added", 0);
+        }
+        reads++;
+    }
+}
+
+// Holds on to a guitar across a clear() and checks that it's still alive afterwards
+static bool check_clear_waits(GuitarRegistry& registry)
+{
+    uint64_t address = address_of(0xff, 0);
+    registry.add(address, [address]() { return std::unique_ptr<Guitar>(new Guitar(unpackAddress(address))); });
+
+    // Pin the guitar, let clear() start and use the guitar once clear() had all the time in the world to destroy it
+    std::atomic<bool> pinned(false);
+    std::atomic<bool> released(false);
+    std::atomic<bool> cleared(false);
+    std::thread reader([&]() {
+        Epoch::Guard guard;
+        Guitar* guitar = registry.find(address);
+        pinned = true;
+        usleep(100000);
+        if (guitar == NULL || cleared.load())
+        {
+            fail("clear() didn't wait for a reader", address);
+        }
+        else
+        {
+            check_guitar(guitar, address);
+        }
+        released = true;
+    });
+    while (!pinned.load())
+    {
+        std::this_thread::yield();
+    }
+    registry.clear();
+    cleared = true;
+    reader.join();
+    return released.load() && registry.size() == 0 && registry.find(address) == NULL;
+}
+
+// The entry point
+int main()
+{
+    // The guitars only exist in memory
+    Gamepad::setSink(Sink_None);
+
+    // Readers run through every round, including the clears between them
+    GuitarRegistry registry;
+    std::atomic<int> round(0);
+    std::atomic<bool> stop(false);
+    std::vector<std::atomic<uint64_t>> reads(g_reader_count);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < g_reader_count; i++)
+    {
+        reads[i] = 0;
+        readers.emplace_back(read_registry, std::ref(registry), (uint32_t)i, std::cref(round), std::cref(stop), std::ref(reads[i]));
+    }
+
+    // Every round, the writers race to add the same guitars and the registry is cleared under the readers' feet
+    for (int r = 0; r < g_round_count && g_failures.load() == 0; r++)
+    {
+        round = r;
+        std::atomic<int> added(0);
+        std::vector<std::thread> writers;
+        for (int i = 0; i < g_writer_count; i++)
+        {
+            writers.emplace_back(write_round, std::ref(registry), r, std::ref(added));
+        }
+        for (std::thread& writer : writers)
+        {
+            writer.join();
+        }
+
+        // Every guitar was added exactly once and can be found
+        if (added.load() != g_guitars_per_round || registry.size() != (size_t)g_guitars_per_round)
+        {
+            printf("Round %d added %d guitars, the registry holds %zu.\n", r, added.load(), registry.size());
+            g_failures++;
+        }
+        for (int index = 0; index < g_guitars_per_round; index++)
+        {
+            Epoch::Guard guard;
+            uint64_t address = address_of(r, index);
+            Guitar* guitar = registry.find(address);
+            if (guitar == NULL)
+            {
+                fail("An added guitar can't be found", address);
+            }
+            else
+            {
+                check_guitar(guitar, address);
+            }
+        }
+        registry.clear();
+    }
+
+    // Stop the readers
+    stop = true;
+    uint64_t total = 0;
+    for (int i = 0; i < g_reader_count; i++)
+    {
+        readers[i].join();
+        total += reads[i].load();
+    }
+
+    // clear() must not destroy a guitar a reader still holds
+    if (!check_clear_waits(registry))
+    {
+        printf("A guitar didn't survive its reader.\n");
+        g_failures++;
+    }
+
+    // Done
+    if (g_failures.load() != 0)
+    {
+        printf("%d failures.\n", g_failures.load());
+        return 1;
+    }
+    printf("%d rounds of %d guitars, %llu concurrent reads.\n", g_round_count, g_guitars_per_round, (unsigned long long)total);
+    return 0;
+}
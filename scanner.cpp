@@ -0,0 +1,254 @@
+#include "scanner.h"
+#include "TimerService.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+
+// How often a continuous scan checks whether it should end (in case the stop request came before the scan started)
+static const std::chrono::milliseconds g_scan_check_period(1000);
+
+std::mutex Scanner::mutex;
+std::condition_variable Scanner::condition;
+Transport* Scanner::transport = NULL;
+Transport::DiscoveryHandler Scanner::handler;
+ScanPolicy Scanner::policy = g_default_scan_policy;
+ScanStates Scanner::state = Scan_Off;
+bool Scanner::running = false;
+int64_t Scanner::windowEnd = 0;
+size_t Scanner::streaming = 0;
+Scanner::StateListener Scanner::stateListener;
+std::thread Scanner::thread;
+
+bool Scanner::parsePolicy(const std::string& options, ScanPolicy* policy)
+{
+    // Parse the "option=value" pairs
+    std::stringstream stream(options);
+    std::string option;
+    ScanPolicy parsed = *policy;
+    while (std::getline(stream, option, ','))
+    {
+        // Split the pair
+        size_t separator = option.find('=');
+        if (separator == std::string::npos)
+        {
+            printf("Invalid scan option \"%s\".\n", option.c_str());
+            return false;
+        }
+        std::string name = option.substr(0, separator);
+        char* end;
+        unsigned long value = strtoul(option.c_str() + separator + 1, &end, 10);
+        if (*end != '\0' || end == option.c_str() + separator + 1 || value > UINT32_MAX)
+        {
+            printf("Invalid scan option \"%s\".\n", option.c_str());
+            return false;
+        }
+
+        // Apply it
+        if (name == "window")
+        {
+            parsed.window = (uint32_t)value;
+        }
+        else if (name == "interval")
+        {
+            parsed.interval = (uint32_t)value;
+        }
+        else if (name == "expected")
+        {
+            parsed.expectedGuitars = (uint32_t)value;
+        }
+        else if (name == "resume" && value <= 1)
+        {
+            parsed.resume = value == 1;
+        }
+        else
+        {
+            printf("Invalid scan option \"%s\".\n", option.c_str());
+            return false;
+        }
+    }
+
+    // Only take policies that make sense
+    if (!isValidPolicy(parsed))
+    {
+        printf("Invalid scan policy \"%s\" (the interval must be longer than the window).\n", options.c_str());
+        return false;
+    }
+    *policy = parsed;
+    return true;
+}
+
+bool Scanner::isValidPolicy(const ScanPolicy& policy)
+{
+    return policy.window == 0 || policy.interval > policy.window;
+}
+
+void Scanner::setStateListener(const StateListener& listener)
+{
+    // Remember who to tell about state changes
+    std::lock_guard<std::mutex> lock(mutex);
+    stateListener = listener;
+}
+
+void Scanner::start(Transport* transportValue, Transport::DiscoveryHandler handlerValue, const ScanPolicy& policyValue)
+{
+    // Restart a running session (or clean up after one that ended on its own)
+    stop();
+
+    // Start the new one
+    std::lock_guard<std::mutex> lock(mutex);
+    transport = transportValue;
+    handler = handlerValue;
+    policy = policyValue;
+    running = true;
+    thread = std::thread(&Scanner::run);
+}
+
+bool Scanner::stop()
+{
+    // Take the scan thread
+    std::thread finished;
+    Transport* scanning;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable())
+        {
+            return false;
+        }
+        running = false;
+        finished = std::move(thread);
+        scanning = transport;
+    }
+    condition.notify_all();
+
+    // End the running scan and wait for the thread
+    scanning->stopScan();
+    finished.join();
+    return true;
+}
+
+ScanStates Scanner::getState()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return state;
+}
+
+void Scanner::setStreamingGuitars(size_t count)
+{
+    // Remember the number of streaming guitars
+    Transport* scanning;
+    bool satisfied;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        streaming = count;
+        scanning = running ? transport : NULL;
+        satisfied = running && state == Scan_Active && isSatisfied();
+    }
+    condition.notify_all();
+
+    // Enough guitars are streaming, free the radio right away
+    if (satisfied)
+    {
+        scanning->stopScan();
+    }
+}
+
+bool Scanner::isSatisfied()
+{
+    return policy.expectedGuitars > 0 && streaming >= policy.expectedGuitars;
+}
+
+bool Scanner::shouldStopScan()
+{
+    return !running || isSatisfied() || (windowEnd != 0 && TimerService::now() >= windowEnd);
+}
+
+void Scanner::changeState(std::unique_lock<std::mutex>& lock, ScanStates next)
+{
+    // Nothing changed
+    if (state == next)
+    {
+        return;
+    }
+    state = next;
+
+    // Tell the listener (without the lock, it may call back into the scanner)
+    StateListener listener = stateListener;
+    lock.unlock();
+    if (listener)
+    {
+        listener(next);
+    }
+    lock.lock();
+}
+
+void Scanner::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running)
+    {
+        // Enough guitars are streaming
+        if (isSatisfied())
+        {
+            // Nobody wants the scan back
+            if (!policy.resume)
+            {
+                printf("Stopping scan, %zu guitar(s) are streaming\n", streaming);
+                break;
+            }
+
+            // Wait for one of them to drop
+            printf("Suspending scan, %zu guitar(s) are streaming\n", streaming);
+            changeState(lock, Scan_Suspended);
+            condition.wait(lock, []() { return !running || !isSatisfied(); });
+            if (running)
+            {
+                printf("Resuming scan, %zu guitar(s) are streaming\n", streaming);
+            }
+            continue;
+        }
+        changeState(lock, Scan_Active);
+        if (!running)
+        {
+            break;
+        }
+
+        // Scan until the window is over (checking regularly, a stop request that came before the scan started is lost on the transport)
+        int64_t started = TimerService::now();
+        windowEnd = policy.window > 0 ? started + (int64_t)policy.window * 1000000 : 0;
+        std::chrono::nanoseconds period = policy.window > 0 ? std::chrono::milliseconds(policy.window) : g_scan_check_period;
+        Transport* scanning = transport;
+        Transport::DiscoveryHandler discovered = handler;
+        lock.unlock();
+        TimerService::Timer* check = TimerService::instance().add(period, [scanning]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (shouldStopScan())
+            {
+                lock.unlock();
+                scanning->stopScan();
+            }
+        });
+        bool scanned = scanning->scan(discovered);
+        TimerService::instance().remove(check);
+        lock.lock();
+        windowEnd = 0;
+
+        // The adapter wouldn't scan
+        if (!scanned)
+        {
+            printf("Failed to scan\n");
+            break;
+        }
+
+        // Rest until the next window (unless we're stopped or enough guitars are streaming)
+        if (policy.window > 0)
+        {
+            int64_t nextWindow = started + (int64_t)policy.interval * 1000000;
+            condition.wait_for(lock, std::chrono::nanoseconds(std::max<int64_t>(nextWindow - TimerService::now(), 0)), []() { return !running || isSatisfied(); });
+        }
+    }
+
+    // The session is over
+    running = false;
+    changeState(lock, Scan_Off);
+}
@@ -0,0 +1,116 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include "transport.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// The states of a scan session
+enum ScanStates {
+    Scan_Off = 0,       // Not scanning
+    Scan_Active = 1,    // Scanning (or resting between two windows of a duty cycle)
+    Scan_Suspended = 2  // Enough guitars are streaming, waiting for one of them to drop
+};
+
+// How the adapter looks for guitars
+typedef struct ScanPolicy {
+    uint32_t window;           // How long each scan lasts in milliseconds (0 = scan continuously)
+    uint32_t interval;         // How often a scan starts in milliseconds (duty-cycled scans only)
+    uint32_t expectedGuitars;  // Stop scanning once this many guitars are streaming (0 = never)
+    bool resume;               // Resume scanning once fewer guitars are streaming again (otherwise the session ends)
+} ScanPolicy;
+
+// Scans continuously until it's stopped (the behavior without a policy)
+static constexpr ScanPolicy g_default_scan_policy = { 0, 0, 0, true };
+
+// Runs scan sessions according to a policy.
+//
+// Active scanning shares the radio with the guitars' connections and adds
+// jitter to their frame intervals. A policy can cut that down by scanning in
+// windows (e.g. 200 ms every second), by stopping once the expected number of
+// guitars is streaming, and by resuming when one of them drops.
+class Scanner {
+public:
+    // Gets called whenever the session's state changes (on the scan thread)
+    typedef std::function<void(ScanStates state)> StateListener;
+
+    // Applies a comma separated "option=value" list on top of the given policy, returns false if it contained errors
+    //
+    //     window=MS      Scan for MS milliseconds at a time (0 = continuously)
+    //     interval=MS    Start a scan every MS milliseconds
+    //     expected=N     Stop scanning once N guitars are streaming (0 = never)
+    //     resume=0|1     Resume once fewer guitars are streaming again (1) or end the session (0)
+    static bool parsePolicy(const std::string& options, ScanPolicy* policy);
+
+    // Returns whether a policy makes sense (a duty cycle's interval must be longer than its window)
+    static bool isValidPolicy(const ScanPolicy& policy);
+
+    // Sets who's told about state changes (set it before starting a session)
+    static void setStateListener(const StateListener& listener);
+
+    // Starts a scan session reporting advertisements to the handler (restarts a running session with the new policy)
+    static void start(Transport* transportValue, Transport::DiscoveryHandler handlerValue, const ScanPolicy& policyValue);
+
+    // Ends the scan session and waits for it, returns false if none was running
+    static bool stop();
+
+    // Returns the state of the scan session
+    static ScanStates getState();
+
+    // Tells the scanner how many guitars are streaming (suspends or resumes the session)
+    static void setStreamingGuitars(size_t count);
+
+private:
+    // Guards everything below
+    static std::mutex mutex;
+
+    // Signaled when the session is stopped or the number of streaming guitars changes
+    static std::condition_variable condition;
+
+    // The transport that's scanning
+    static Transport* transport;
+
+    // Receives the advertisements
+    static Transport::DiscoveryHandler handler;
+
+    // The policy of the current session
+    static ScanPolicy policy;
+
+    // The state of the session
+    static ScanStates state;
+
+    // Whether the session should keep going
+    static bool running;
+
+    // When the current scan window ends (monotonic nanoseconds, 0 = never)
+    static int64_t windowEnd;
+
+    // The number of streaming guitars
+    static size_t streaming;
+
+    // Told about state changes
+    static StateListener stateListener;
+
+    // The scan thread
+    static std::thread thread;
+
+    // Returns whether enough guitars are streaming to stop scanning (mutex must be held)
+    static bool isSatisfied();
+
+    // Returns whether the running scan should end now (mutex must be held)
+    static bool shouldStopScan();
+
+    // Changes the session's state and tells the listener (mutex must be held, it's released while the listener runs)
+    static void changeState(std::unique_lock<std::mutex>& lock, ScanStates next);
+
+    // The scan thread's main loop
+    static void run();
+};
+
+#endif // SCANNER_H
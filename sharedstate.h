@@ -0,0 +1,187 @@
+#ifndef SHAREDSTATE_H
+#define SHAREDSTATE_H
+
+/*
+ * The guitar state the daemon publishes to shared memory (--shm), and a
+ * reader for it. This header is self-contained and works from C and C++, so
+ * games, emulators and overlays can copy it and read the current state of
+ * every guitar without any syscalls or evdev parsing:
+ *
+ *     const GhlbleStateRegion* region = ghlble_state_open(GHLBLE_STATE_DEFAULT_NAME);
+ *     GhlbleGuitarState state;
+ *     if (region != NULL && ghlble_state_read(region, 0, &state) == GHLBLE_STATE_OK)
+ *     {
+ *         // state.frame - previous.frame - 1 frames were missed since the last read
+ *     }
+ *     ghlble_state_close(region);
+ *
+ * Every guitar owns a slot (it keeps it while it's known to the daemon). A
+ * slot is protected by a seqlock: the daemon makes the sequence odd, updates
+ * the state and makes it even again, and readers retry until they've copied
+ * the state between two identical even sequences.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The shared memory object the daemon publishes to by default (/dev/shm/ghlble) */
+#define GHLBLE_STATE_DEFAULT_NAME "/ghlble"
+
+/* Identifies the region ("GHLS") and its layout */
+#define GHLBLE_STATE_MAGIC 0x53484c47u
+#define GHLBLE_STATE_VERSION 1u
+
+/* The number of guitar slots */
+#define GHLBLE_STATE_SLOTS 16
+
+/* How often a read retries before giving up on a slot that's being written */
+#define GHLBLE_STATE_READ_ATTEMPTS 1000
+
+/* The frets (GhlbleGuitarState::frets) */
+#define GHLBLE_FRET_W1 0x01
+#define GHLBLE_FRET_B1 0x02
+#define GHLBLE_FRET_B2 0x04
+#define GHLBLE_FRET_B3 0x08
+#define GHLBLE_FRET_W2 0x10
+#define GHLBLE_FRET_W3 0x20
+
+/* The buttons (GhlbleGuitarState::buttons) */
+#define GHLBLE_BUTTON_PAUSE 0x02
+#define GHLBLE_BUTTON_GHTV 0x04
+#define GHLBLE_BUTTON_HERO_POWER 0x08
+#define GHLBLE_BUTTON_SYNC 0x10
+
+/* The flags (GhlbleGuitarState::flags) */
+#define GHLBLE_STATE_STREAMING 0x01  /* The guitar is connected (otherwise the state is the resting one it was released to) */
+
+/* The results of ghlble_state_read() */
+#define GHLBLE_STATE_OK 1      /* The state was copied */
+#define GHLBLE_STATE_EMPTY 0   /* The slot doesn't belong to a guitar */
+#define GHLBLE_STATE_BUSY -1   /* The slot kept changing (or its writer died halfway through) */
+
+/* The decoded state of a guitar (32 bytes) */
+typedef struct GhlbleGuitarState {
+    uint64_t address;    /* The packed MAC address of the guitar (AA:BB:CC:DD:EE:FF is 0xAABBCCDDEEFF) */
+    uint64_t frame;      /* The number of frames published for the guitar so far (gaps are missed frames) */
+    int64_t timestamp;   /* When the frame arrived (CLOCK_MONOTONIC nanoseconds) */
+    uint8_t frets;       /* GHLBLE_FRET_* */
+    uint8_t buttons;     /* GHLBLE_BUTTON_* */
+    int8_t dpadX;        /* -1 left, 0 centered, 1 right */
+    int8_t dpadY;        /* -1 up, 0 centered, 1 down */
+    int8_t strum;        /* 1 up, 0 resting, -1 down */
+    uint8_t whammy;      /* 0x80 resting to 0xff fully pressed (jitter filtered) */
+    uint8_t tilt;        /* 0x00 to 0xff (jitter filtered) */
+    uint8_t flags;       /* GHLBLE_STATE_* */
+} GhlbleGuitarState;
+
+/* A guitar's slot (one cache line) */
+typedef struct GhlbleStateSlot {
+    uint64_t sequence;                                                 /* The seqlock sequence (odd while the state is being written) */
+    uint64_t words[sizeof(GhlbleGuitarState) / sizeof(uint64_t)];      /* The state */
+    uint8_t padding[64 - sizeof(uint64_t) - sizeof(GhlbleGuitarState)];
+} __attribute__((aligned(64))) GhlbleStateSlot;
+
+/* The start of the region (one cache line) */
+typedef struct GhlbleStateHeader {
+    uint32_t magic;      /* GHLBLE_STATE_MAGIC once the region is initialized */
+    uint32_t version;    /* GHLBLE_STATE_VERSION */
+    uint32_t slotCount;  /* GHLBLE_STATE_SLOTS */
+    uint32_t slotSize;   /* sizeof(GhlbleStateSlot) */
+    uint32_t writerPid;  /* The daemon's process ID (the region outlives a crashed daemon) */
+    uint8_t padding[44];
+} __attribute__((aligned(64))) GhlbleStateHeader;
+
+/* The whole shared memory region */
+typedef struct GhlbleStateRegion {
+    GhlbleStateHeader header;
+    GhlbleStateSlot slots[GHLBLE_STATE_SLOTS];
+} GhlbleStateRegion;
+
+/* Maps the region published under the given name read-only, returns NULL if there's none (or it has another layout) */
+static inline const GhlbleStateRegion* ghlble_state_open(const char* name)
+{
+    /* Map the shared memory object */
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat info;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(GhlbleStateRegion))
+    {
+        map = mmap(NULL, sizeof(GhlbleStateRegion), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    /* Check the layout (the magic is written last) */
+    const GhlbleStateRegion* region = (const GhlbleStateRegion*)map;
+    if (__atomic_load_n(&region->header.magic, __ATOMIC_ACQUIRE) != GHLBLE_STATE_MAGIC || region->header.version != GHLBLE_STATE_VERSION || region->header.slotCount != GHLBLE_STATE_SLOTS || region->header.slotSize != sizeof(GhlbleStateSlot))
+    {
+        munmap(map, sizeof(GhlbleStateRegion));
+        return NULL;
+    }
+    return region;
+}
+
+/* Unmaps a region */
+static inline void ghlble_state_close(const GhlbleStateRegion* region)
+{
+    if (region != NULL)
+    {
+        munmap((void*)region, sizeof(GhlbleStateRegion));
+    }
+}
+
+/* Copies a slot's state, returns GHLBLE_STATE_OK, GHLBLE_STATE_EMPTY or GHLBLE_STATE_BUSY */
+static inline int ghlble_state_read(const GhlbleStateRegion* region, unsigned int slot, GhlbleGuitarState* state)
+{
+    const GhlbleStateSlot* source = &region->slots[slot % GHLBLE_STATE_SLOTS];
+    for (int attempt = 0; attempt < GHLBLE_STATE_READ_ATTEMPTS; attempt++)
+    {
+        /* Wait for the writer to finish */
+        uint64_t before = __atomic_load_n(&source->sequence, __ATOMIC_ACQUIRE);
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+
+        /* Copy the state and make sure it didn't change meanwhile */
+        uint64_t words[sizeof(GhlbleGuitarState) / sizeof(uint64_t)];
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        {
+            words[i] = __atomic_load_n(&source->words[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&source->sequence, __ATOMIC_RELAXED) == before)
+        {
+            memcpy(state, words, sizeof(words));
+            return state->address != 0 ? GHLBLE_STATE_OK : GHLBLE_STATE_EMPTY;
+        }
+    }
+    return GHLBLE_STATE_BUSY;
+}
+
+/* Copies the state of the guitar with the given packed address, returns its slot or -1 if it has none */
+static inline int ghlble_state_find(const GhlbleStateRegion* region, uint64_t address, GhlbleGuitarState* state)
+{
+    for (unsigned int slot = 0; slot < GHLBLE_STATE_SLOTS; slot++)
+    {
+        if (ghlble_state_read(region, slot, state) == GHLBLE_STATE_OK && state->address == address)
+        {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+#endif /* SHAREDSTATE_H */
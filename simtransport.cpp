@@ -0,0 +1,421 @@
+#include "simtransport.h"
+#include "guitar.h"
+#include "address.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <thread>
+
+// A simulated connection
+class SimLink : public TransportLink
+{
+public:
+    // Constructor
+    SimLink(uint32_t indexValue, uint32_t randomValue) : index(indexValue), random(randomValue), frameIndex(0), connected(true), subscribed(false)
+    {
+        established = std::chrono::steady_clock::now();
+        nextFrame = established;
+        memset(&frame, 0, sizeof(frame));
+    }
+
+    // The index of the simulated guitar
+    uint32_t index;
+
+    // The link's random state
+    uint32_t random;
+
+    // When the link was established
+    std::chrono::steady_clock::time_point established;
+
+    // When the next frame is due (without jitter)
+    std::chrono::steady_clock::time_point nextFrame;
+
+    // The number of frames produced so far
+    uint64_t frameIndex;
+
+    // The current frame
+    GuitarData frame;
+
+    // Whether the link is still up
+    std::atomic<bool> connected;
+
+    // Whether notifications are enabled
+    std::atomic<bool> subscribed;
+
+    // The notification handler
+    Transport::NotificationHandler notification;
+
+    // The connection loss handler
+    Transport::DisconnectHandler lost;
+
+    // The notification thread
+    std::thread streamer;
+};
+
+// The fret combinations the simulated guitars cycle through
+static const uint8_t g_simulated_chords[] = {
+    0, Fret_W1, Fret_B1, Fret_W1 | Fret_W2, Fret_B1 | Fret_B2 | Fret_B3, Fret_W2, Fret_W3 | Fret_B3, Fret_W1 | Fret_W2 | Fret_W3
+};
+
+// Advances a xorshift random state
+static inline uint32_t next_random(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Produces the given frame of the simulated guitar pattern
+static void synthesize_frame(GuitarData& frame, uint64_t index, uint32_t& random)
+{
+    // A new chord every 16 frames, strummed (alternating up and down) shortly after it's fretted
+    uint64_t chord = index / 16;
+    frame.frets = g_simulated_chords[chord % (sizeof(g_simulated_chords) / sizeof(g_simulated_chords[0]))];
+    frame.strum = index % 16 == 4 ? (chord % 2 == 0 ? 0xff : 0x00) : 0x80;
+
+    // Tap pause every now and then
+    frame.buttons = index % 1024 == 0 ? Button_Pause : 0;
+    frame.directionalPad = Direction_Centered;
+    frame.unused1 = 0x80;
+    frame.lift = 0x80;
+
+    // Sweep the whammy bar every 64 frames, jitter the analog inputs by a step like real sensors do
+    uint64_t sweep = index % 64;
+    frame.whammy = (uint8_t)(0x80 + (sweep < 32 ? sweep * 4 : 0) + (sweep < 32 ? 0 : next_random(random) % 2));
+    frame.tilt = (uint8_t)(0x80 + next_random(random) % 3 - 1);
+}
+
+SimTransport::SimTransport() : guitarCount(1), frameInterval(8000000), frameJitter(0), scanJitter(0), loadJitter(0), connectLatency(10), failurePercent(0), sessionLength(0), seed(1), present(true), scanning(false), activeLinks(0), pendingCallbacks(0), connectAttempts(0)
+{
+}
+
+SimTransport::~SimTransport()
+{
+    // Wait for the connection callbacks
+    close();
+}
+
+bool SimTransport::configure(const std::string& options)
+{
+    // Parse the "option=value" pairs
+    std::stringstream stream(options);
+    std::string option;
+    while (std::getline(stream, option, ','))
+    {
+        // Split the pair
+        size_t separator = option.find('=');
+        if (separator == std::string::npos)
+        {
+            printf("Invalid simulator option \"%s\".\n", option.c_str());
+            return false;
+        }
+        std::string name = option.substr(0, separator);
+        char* end;
+        double value = strtod(option.c_str() + separator + 1, &end);
+        if (*end != '\0' || value < 0)
+        {
+            printf("Invalid simulator option \"%s\".\n", option.c_str());
+            return false;
+        }
+
+        // Apply it
+        if (name == "guitars")
+        {
+            guitarCount = (uint32_t)value;
+        }
+        else if (name == "rate" && value > 0)
+        {
+            frameInterval = (int64_t)(1000000000.0 / value);
+        }
+        else if (name == "jitter")
+        {
+            frameJitter = (int64_t)(value * 1000);
+        }
+        else if (name == "scanjitter")
+        {
+            scanJitter = (int64_t)(value * 1000);
+        }
+        else if (name == "load")
+        {
+            loadJitter = (int64_t)(value * 1000);
+        }
+        else if (name == "connect")
+        {
+            connectLatency = std::chrono::milliseconds((int64_t)value);
+        }
+        else if (name == "fail" && value <= 100)
+        {
+            failurePercent = (uint32_t)value;
+        }
+        else if (name == "session")
+        {
+            sessionLength = (int64_t)(value * 1000000000.0);
+        }
+        else if (name == "seed")
+        {
+            seed = (uint32_t)value != 0 ? (uint32_t)value : 1;
+        }
+        else
+        {
+            printf("Invalid simulator option \"%s\".\n", option.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string SimTransport::guitarAddress(uint32_t index)
+{
+    // Locally administered addresses that can't clash with real guitars
+    char address[18];
+    snprintf(address, sizeof(address), "5E:00:00:00:%02X:%02X", ((index + 1) >> 8) & 0xff, (index + 1) & 0xff);
+    return address;
+}
+
+void SimTransport::setPresent(bool value)
+{
+    // Links notice on their next frame
+    present = value;
+}
+
+const char* SimTransport::getName() const
+{
+    return "sim";
+}
+
+bool SimTransport::open()
+{
+    // There's no hardware to open
+    return true;
+}
+
+void SimTransport::close()
+{
+    // Stop scanning and wait for the connection callbacks to return
+    stopScan();
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return pendingCallbacks == 0; });
+}
+
+bool SimTransport::scan(DiscoveryHandler handler)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    scanning = true;
+    while (scanning)
+    {
+        // Advertise every guitar that's in range
+        if (present)
+        {
+            lock.unlock();
+            for (uint32_t i = 0; i < guitarCount; i++)
+            {
+                handler(guitarAddress(i), TRANSPORT_GUITAR_NAME);
+            }
+            lock.lock();
+        }
+
+        // Advertise again a second later
+        condition.wait_for(lock, std::chrono::seconds(1), [this]() { return !scanning; });
+    }
+    return true;
+}
+
+void SimTransport::stopScan()
+{
+    // Wake up the scan
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        scanning = false;
+    }
+    condition.notify_all();
+}
+
+bool SimTransport::connect(const std::string& address, ConnectHandler handler)
+{
+    // There's no such guitar
+    if (!isGuitar(address))
+    {
+        return false;
+    }
+
+    // Roll the dice for this attempt
+    uint32_t index = (uint32_t)(packAddress(address) & 0xffff) - 1;
+    uint32_t random;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingCallbacks++;
+        random = seed * 2654435761u ^ (index + 1) * 40503u ^ ++connectAttempts * 2246822519u;
+        random = random != 0 ? random : 1;
+    }
+    bool fails = next_random(random) % 100 < failurePercent;
+
+    // Call back from a thread of our own like gattlib does (the callback may block for the whole session)
+    std::thread([this, index, random, fails, handler]() {
+        std::this_thread::sleep_for(connectLatency);
+        SimLink* link = NULL;
+        if (!fails && present)
+        {
+            link = new SimLink(index, random);
+            activeLinks++;
+        }
+        handler(link);
+
+        // Let close() know we're done
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingCallbacks--;
+        condition.notify_all();
+    }).detach();
+    return true;
+}
+
+void SimTransport::disconnect(TransportLink* link)
+{
+    // Blocked reads and the notification thread notice on their next frame
+    ((SimLink*)link)->connected = false;
+}
+
+void SimTransport::release(TransportLink* link)
+{
+    // Stop the notifications and free the link
+    disconnect(link);
+    unsubscribe(link, TransportCharacteristic());
+    delete (SimLink*)link;
+    activeLinks--;
+}
+
+bool SimTransport::discover(TransportLink* link, TransportCharacteristic* characteristic)
+{
+    // The link is gone
+    if (!((SimLink*)link)->connected || !present)
+    {
+        return false;
+    }
+
+    // Every simulated guitar has the same layout as a real one
+    static const uint8_t uuid[16] = { 0x53, 0x3e, 0x15, 0x24, 0x3a, 0xbe, 0xf3, 0x3f, 0xcd, 0x00, 0x59, 0x4e, 0x8b, 0x0a, 0x8e, 0xa3 };
+    characteristic->handle = 0x0010;
+    characteristic->valueHandle = 0x0011;
+    characteristic->uuidType = 0;
+    memcpy(characteristic->uuid, uuid, sizeof(uuid));
+    return true;
+}
+
+bool SimTransport::read(TransportLink* link, const TransportCharacteristic& /*characteristic*/, void* buffer, size_t size)
+{
+    // Wait for the next frame and hand it out
+    SimLink* simLink = (SimLink*)link;
+    if (size != sizeof(GuitarData) || !waitForFrame(link))
+    {
+        return false;
+    }
+    memcpy(buffer, &simLink->frame, size);
+    return true;
+}
+
+bool SimTransport::subscribe(TransportLink* link, const TransportCharacteristic& /*characteristic*/, NotificationHandler notification, DisconnectHandler lost)
+{
+    // The link is gone
+    SimLink* simLink = (SimLink*)link;
+    if (!simLink->connected || !present)
+    {
+        return false;
+    }
+
+    // Start streaming
+    simLink->notification = std::move(notification);
+    simLink->lost = std::move(lost);
+    simLink->subscribed = true;
+    simLink->streamer = std::thread(&SimTransport::stream, this, link);
+    return true;
+}
+
+void SimTransport::unsubscribe(TransportLink* link, const TransportCharacteristic& /*characteristic*/)
+{
+    // Stop the notification thread
+    SimLink* simLink = (SimLink*)link;
+    simLink->subscribed = false;
+    if (simLink->streamer.joinable())
+    {
+        if (simLink->streamer.get_id() == std::this_thread::get_id())
+        {
+            simLink->streamer.detach();
+        }
+        else
+        {
+            simLink->streamer.join();
+        }
+    }
+}
+
+bool SimTransport::isGuitar(const std::string& address) const
+{
+    // Simulated guitars count up from 5E:00:00:00:00:01
+    uint64_t packed = packAddress(address);
+    return (packed >> 16) == 0x5e0000000000ull >> 16 && (packed & 0xffff) >= 1 && (packed & 0xffff) <= guitarCount;
+}
+
+bool SimTransport::waitForFrame(TransportLink* link)
+{
+    // Work out when the next frame is due
+    SimLink* simLink = (SimLink*)link;
+    simLink->nextFrame += std::chrono::nanoseconds(frameInterval);
+    std::chrono::nanoseconds jitter(0);
+    if (frameJitter > 0)
+    {
+        jitter = std::chrono::nanoseconds((int64_t)(next_random(simLink->random) % (uint32_t)(2 * frameJitter + 1)) - frameJitter);
+    }
+
+    // A running scan takes radio time away from the links, frames that miss their connection event arrive late
+    if (scanJitter > 0 && scanning)
+    {
+        jitter += std::chrono::nanoseconds((int64_t)(next_random(simLink->random) % (uint32_t)(scanJitter + 1)));
+    }
+
+    // The other links on the adapter compete for the same connection events, the more of them the later frames arrive
+    uint32_t others = activeLinks > 0 ? activeLinks - 1 : 0;
+    if (loadJitter > 0 && others > 0)
+    {
+        jitter += std::chrono::nanoseconds((int64_t)(next_random(simLink->random) % (uint32_t)(loadJitter * others + 1)));
+    }
+    std::chrono::steady_clock::time_point due = simLink->nextFrame + jitter;
+    std::this_thread::sleep_until(due);
+
+    // The link was dropped, the guitar left or the session is over
+    if (!simLink->connected || !present || (sessionLength > 0 && due - simLink->established >= std::chrono::nanoseconds(sessionLength)))
+    {
+        simLink->connected = false;
+        return false;
+    }
+
+    // Produce the frame
+    synthesize_frame(simLink->frame, simLink->frameIndex++, simLink->random);
+    return true;
+}
+
+void SimTransport::stream(TransportLink* link)
+{
+    // Push frames until we're unsubscribed
+    SimLink* simLink = (SimLink*)link;
+    while (simLink->subscribed)
+    {
+        // The link was lost
+        if (!waitForFrame(link))
+        {
+            // Let the subscriber know unless it's the one who dropped the link
+            if (simLink->subscribed && simLink->lost)
+            {
+                simLink->lost();
+            }
+            return;
+        }
+
+        // Deliver the frame
+        if (simLink->subscribed)
+        {
+            simLink->notification((const uint8_t*)&simLink->frame, sizeof(simLink->frame));
+        }
+    }
+}
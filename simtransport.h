@@ -0,0 +1,117 @@
+#ifndef SIMTRANSPORT_H
+#define SIMTRANSPORT_H
+
+#include "transport.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Simulates guitars without any Bluetooth hardware.
+//
+// The simulated guitars advertise as "Ble Guitar" on addresses
+// 5E:00:00:00:00:01 and up and play a deterministic pattern of frets, strums
+// and analog noise. The options are given as "option=value" pairs:
+//
+//     guitars=N      Number of simulated guitars (default: 1)
+//     rate=HZ        Input frames per second and guitar (default: 125)
+//     jitter=US      Random frame interval variation (default: 0)
+//     scanjitter=US  Extra random frame delay while a scan shares the radio (default: 0)
+//     load=US        Extra random frame delay per other link on the adapter (default: 0)
+//     connect=MS     Connection latency (default: 10)
+//     fail=PERCENT   Share of failing connection attempts (default: 0)
+//     session=S      Drop links after this many seconds (default: 0 = never)
+//     seed=N         Random seed (default: 1)
+class SimTransport : public Transport
+{
+public:
+    // Constructor
+    SimTransport();
+
+    // Destructor
+    ~SimTransport();
+
+    // Applies a comma separated option list, returns false if it contained errors
+    bool configure(const std::string& options);
+
+    // Returns the address of the given simulated guitar (0-based)
+    static std::string guitarAddress(uint32_t index);
+
+    // Makes all simulated guitars vanish (dropping their links) or come back
+    void setPresent(bool present);
+
+    const char* getName() const override;
+    bool open() override;
+    void close() override;
+    bool scan(DiscoveryHandler handler) override;
+    void stopScan() override;
+    bool connect(const std::string& address, ConnectHandler handler) override;
+    void disconnect(TransportLink* link) override;
+    void release(TransportLink* link) override;
+    bool discover(TransportLink* link, TransportCharacteristic* characteristic) override;
+    bool read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size) override;
+    bool subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost) override;
+    void unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic) override;
+
+private:
+    // The number of simulated guitars
+    uint32_t guitarCount;
+
+    // The frame interval in nanoseconds
+    int64_t frameInterval;
+
+    // The maximum frame interval variation in nanoseconds
+    int64_t frameJitter;
+
+    // The maximum extra frame delay while scanning in nanoseconds
+    int64_t scanJitter;
+
+    // The maximum extra frame delay per other link in nanoseconds
+    int64_t loadJitter;
+
+    // The connection latency
+    std::chrono::milliseconds connectLatency;
+
+    // The share of failing connection attempts (0 - 100)
+    uint32_t failurePercent;
+
+    // How long links last in nanoseconds (0 = forever)
+    int64_t sessionLength;
+
+    // The random seed
+    uint32_t seed;
+
+    // Whether the simulated guitars are in range
+    std::atomic<bool> present;
+
+    // Guards the scan state and the connection callbacks
+    std::mutex mutex;
+
+    // Wakes up the scan and waits for connection callbacks
+    std::condition_variable condition;
+
+    // Whether a scan is running (read by the links without the lock)
+    std::atomic<bool> scanning;
+
+    // The number of links that haven't been released yet (read by the links without the lock)
+    std::atomic<uint32_t> activeLinks;
+
+    // The number of connection callbacks that haven't returned yet
+    uint32_t pendingCallbacks;
+
+    // The number of connection attempts so far (feeds the failure dice)
+    uint32_t connectAttempts;
+
+    // Returns whether the given address belongs to a simulated guitar
+    bool isGuitar(const std::string& address) const;
+
+    // Waits for the next frame of a link, returns false if the link was lost meanwhile
+    bool waitForFrame(TransportLink* link);
+
+    // Streams notifications until the link is unsubscribed or lost
+    void stream(TransportLink* link);
+};
+
+#endif // SIMTRANSPORT_H
@@ -0,0 +1,114 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// A bounded wait-free ring buffer for exactly one producer and one consumer thread.
+//
+// Both sides keep a private copy of the other side's index and only reload it
+// when the ring looks full (or empty), so an uncontended push or pop touches a
+// single shared cache line. The ring also tracks how often it overflowed and
+// the highest fill level the consumer has seen.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+public:
+    // Constructor
+    SpscRing() : head(0), tail(0), producerHead(0), overflows(0), consumerTail(0), highWaterMark(0)
+    {
+    }
+
+    // Appends an item (producer only), returns false if the ring is full
+    bool push(const T& item)
+    {
+        // Only look at the consumer's progress if the ring seems to be full
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (position - producerHead >= Capacity)
+        {
+            producerHead = head.load(std::memory_order_acquire);
+            if (position - producerHead >= Capacity)
+            {
+                overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+
+        // Store the item and publish it
+        slots[position & (Capacity - 1)] = item;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Removes the oldest item (consumer only), returns false if the ring is empty
+    bool pop(T* item)
+    {
+        // Only look at the producer's progress if the ring seems to be empty
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == consumerTail)
+        {
+            consumerTail = tail.load(std::memory_order_acquire);
+            if (position == consumerTail)
+            {
+                return false;
+            }
+        }
+
+        // Track the fill level as of our last look at the producer's progress (a ring that filled up in between shows in the overflows)
+        size_t fill = consumerTail - position;
+        if (fill > highWaterMark.load(std::memory_order_relaxed))
+        {
+            highWaterMark.store((uint32_t)fill, std::memory_order_relaxed);
+        }
+
+        // Take the item and release its slot
+        *item = slots[position & (Capacity - 1)];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns the number of pushes that failed because the ring was full
+    uint64_t getOverflows() const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+    // Returns the highest number of items the consumer has found waiting
+    uint32_t getHighWaterMark() const
+    {
+        return highWaterMark.load(std::memory_order_relaxed);
+    }
+
+    // Returns the capacity
+    static constexpr size_t capacity()
+    {
+        return Capacity;
+    }
+
+private:
+    // The consumer's read position
+    alignas(64) std::atomic<size_t> head;
+
+    // The producer's write position
+    alignas(64) std::atomic<size_t> tail;
+
+    // The producer's copy of the read position
+    size_t producerHead;
+
+    // The number of failed pushes (written by the producer only)
+    std::atomic<uint64_t> overflows;
+
+    // The consumer's copy of the write position
+    alignas(64) size_t consumerTail;
+
+    // The highest fill level (written by the consumer only)
+    std::atomic<uint32_t> highWaterMark;
+
+    // The items
+    alignas(64) T slots[Capacity];
+};
+
+#endif // SPSCRING_H
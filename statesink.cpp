@@ -0,0 +1,146 @@
+#include "statesink.h"
+#include "epoch.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+std::atomic<GhlbleStateRegion*> StateSink::region(NULL);
+std::mutex StateSink::mutex;
+std::string StateSink::name;
+uint64_t StateSink::owners[GHLBLE_STATE_SLOTS];
+bool StateSink::taken[GHLBLE_STATE_SLOTS];
+
+bool StateSink::open(const std::string& nameValue)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // We're already publishing
+    if (region.load(std::memory_order_relaxed) != NULL)
+    {
+        return false;
+    }
+
+    // Create the shared memory object (readers only get to read it) and start from a clean region
+    int fd = shm_open(nameValue.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("Failed to create the shared memory object %s (%s).\n", nameValue.c_str(), strerror(errno));
+        return false;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, 0) == 0 && ftruncate(fd, sizeof(GhlbleStateRegion)) == 0)
+    {
+        map = mmap(NULL, sizeof(GhlbleStateRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("Failed to map the shared memory object %s (%s).\n", nameValue.c_str(), strerror(errno));
+        shm_unlink(nameValue.c_str());
+        return false;
+    }
+
+    // Describe the layout (the magic goes last, readers check it first)
+    GhlbleStateRegion* mapped = (GhlbleStateRegion*)map;
+    mapped->header.version = GHLBLE_STATE_VERSION;
+    mapped->header.slotCount = GHLBLE_STATE_SLOTS;
+    mapped->header.slotSize = sizeof(GhlbleStateSlot);
+    mapped->header.writerPid = (uint32_t)getpid();
+    __atomic_store_n(&mapped->header.magic, GHLBLE_STATE_MAGIC, __ATOMIC_RELEASE);
+
+    // Start publishing
+    name = nameValue;
+    for (int i = 0; i < GHLBLE_STATE_SLOTS; i++)
+    {
+        owners[i] = 0;
+        taken[i] = false;
+    }
+    region.store(mapped, std::memory_order_release);
+    printf("Publishing guitar states to %s.\n", name.c_str());
+    return true;
+}
+
+void StateSink::close()
+{
+    // Stop publishing and remove the shared memory object (readers keep their mapping until they close it)
+    GhlbleStateRegion* mapped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        mapped = region.exchange(NULL);
+        if (mapped == NULL)
+        {
+            return;
+        }
+        shm_unlink(name.c_str());
+    }
+
+    // Unmap the region once no publisher can be writing to it anymore (outside the lock, a publisher may be waiting for it to claim a slot)
+    Epoch::synchronize();
+    munmap(mapped, sizeof(GhlbleStateRegion));
+}
+
+int StateSink::claim(uint64_t address)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // We're not publishing
+    if (region.load(std::memory_order_relaxed) == NULL)
+    {
+        return -1;
+    }
+
+    // Take the slot the guitar had before, otherwise one nobody has had yet, otherwise any free one (readers looking for a guitar by slot keep finding it)
+    int slot = -1;
+    for (int pass = 0; pass < 3 && slot < 0; pass++)
+    {
+        for (int i = 0; i < GHLBLE_STATE_SLOTS && slot < 0; i++)
+        {
+            if (!taken[i] && (pass == 2 || owners[i] == (pass == 0 ? address : 0)))
+            {
+                slot = i;
+            }
+        }
+    }
+    if (slot >= 0)
+    {
+        owners[slot] = address;
+        taken[slot] = true;
+    }
+    return slot;
+}
+
+void StateSink::release(int slot)
+{
+    // Clear the slot so readers stop seeing the guitar
+    GhlbleGuitarState empty = {};
+    publish(slot, empty);
+
+    // Hand it back
+    std::lock_guard<std::mutex> lock(mutex);
+    taken[slot] = false;
+}
+
+void StateSink::publish(int slot, const GhlbleGuitarState& state)
+{
+    // We're not publishing (anymore), the guard keeps the region mapped until we're done writing
+    Epoch::Guard guard;
+    GhlbleStateRegion* mapped = region.load(std::memory_order_acquire);
+    if (mapped == NULL)
+    {
+        return;
+    }
+
+    // Make the sequence odd, write the state, make the sequence even again
+    GhlbleStateSlot& target = mapped->slots[slot];
+    uint64_t words[sizeof(GhlbleGuitarState) / sizeof(uint64_t)];
+    memcpy(words, &state, sizeof(words));
+    uint64_t sequence = __atomic_load_n(&target.sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&target.sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    {
+        __atomic_store_n(&target.words[i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&target.sequence, sequence + 2, __ATOMIC_RELEASE);
+}
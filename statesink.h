@@ -0,0 +1,98 @@
+#ifndef STATESINK_H
+#define STATESINK_H
+
+#include "sharedstate.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+// Publishes the decoded state of every guitar to a shared memory region (see sharedstate.h for the layout and the reader).
+//
+// Each guitar writes its own slot through a StateSinkSlot, so publishing
+// doesn't take any locks. Only claiming and releasing a slot do.
+class StateSink {
+public:
+    // Creates the shared memory object (e.g. "/ghlble" for /dev/shm/ghlble) and starts publishing
+    static bool open(const std::string& name);
+
+    // Stops publishing and removes the shared memory object, waits for running publishers before unmapping it (must not be called inside an epoch guard)
+    static void close();
+
+    // Returns whether states are being published
+    static inline bool isOpen()
+    {
+        return region.load(std::memory_order_relaxed) != NULL;
+    }
+
+    // Claims a slot for the guitar (the one it had before if it's still free), returns -1 if there's none left
+    static int claim(uint64_t address);
+
+    // Clears a slot and hands it back
+    static void release(int slot);
+
+    // Writes a slot's state (only one thread may write a slot at a time)
+    static void publish(int slot, const GhlbleGuitarState& state);
+
+private:
+    // The mapped region (NULL unless we're publishing)
+    static std::atomic<GhlbleStateRegion*> region;
+
+    // Guards the slot owners
+    static std::mutex mutex;
+
+    // The name of the shared memory object
+    static std::string name;
+
+    // The guitar that owns (or last owned) each slot
+    static uint64_t owners[GHLBLE_STATE_SLOTS];
+
+    // Whether each slot is taken
+    static bool taken[GHLBLE_STATE_SLOTS];
+};
+
+// A guitar's slot, claimed when it first publishes and released when it goes away
+class StateSinkSlot {
+public:
+    // Constructor
+    StateSinkSlot() : slot(-1), frames(0) {}
+
+    // Destructor
+    ~StateSinkSlot()
+    {
+        // Hand the slot back
+        if (slot >= 0)
+        {
+            StateSink::release(slot);
+        }
+    }
+
+    // Publishes a state (fills in the address and frame number)
+    inline void publish(uint64_t address, GhlbleGuitarState& state)
+    {
+        // Claim a slot (there may be none left)
+        if (slot < 0)
+        {
+            slot = StateSink::claim(address);
+            if (slot < 0)
+            {
+                return;
+            }
+        }
+
+        // Number the frame and write it
+        state.address = address;
+        state.frame = ++frames;
+        StateSink::publish(slot, state);
+    }
+
+private:
+    // The claimed slot (-1 if there's none yet)
+    int slot;
+
+    // The number of frames published so far
+    uint64_t frames;
+};
+
+#endif // STATESINK_H
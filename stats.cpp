@@ -0,0 +1,194 @@
+#include "stats.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// How a counter is exported
+typedef struct CounterExport {
+    const char* name;    // The counter's name (D-Bus)
+    const char* metric;  // The Prometheus metric name
+    const char* help;    // The Prometheus help text
+    bool seconds;        // Whether the counter holds nanoseconds (exported as seconds)
+} CounterExport;
+
+// How every GuitarCounterIds value is exported
+static const CounterExport g_counter_exports[Counter_Count] = {
+    { "frames_received", "ghlble_guitar_frames_received_total", "Frames received from the guitar.", false },
+    { "frames_repeated", "ghlble_guitar_frames_repeated_total", "Frames identical to the one before them.", false },
+    { "events_emitted", "ghlble_guitar_events_emitted_total", "Input events handed to the virtual gamepad, excluding SYN reports.", false },
+    { "syn_reports", "ghlble_guitar_syn_reports_total", "Reports handed to the virtual gamepad.", false },
+    { "write_errors", "ghlble_guitar_write_errors_total", "Failed or short writes to the virtual gamepad.", false },
+    { "reconnects", "ghlble_guitar_reconnects_total", "Streaming sessions that ended and were reconnected.", false },
+    { "discoveries", "ghlble_guitar_discoveries_total", "Sessions that found the input characteristic.", false },
+    { "discovery_time_ns", "ghlble_guitar_discovery_seconds_total", "Time sessions took to find the input characteristic.", true },
+    { "watchdog_expiries", "ghlble_guitar_watchdog_expiries_total", "Sessions dropped because the guitar went silent.", false },
+};
+
+int64_t Stats::startedAt = 0;
+
+GuitarCounters::GuitarCounters()
+{
+    // Start out at zero
+    for (auto& slot : slots)
+    {
+        slot.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t GuitarCounters::get(GuitarCounterIds counter) const
+{
+    return slots[counter].value.load(std::memory_order_relaxed);
+}
+
+const char* GuitarCounters::counterName(GuitarCounterIds counter)
+{
+    return counter < Counter_Count ? g_counter_exports[counter].name : "unknown";
+}
+
+void Stats::start()
+{
+    startedAt = LatencyStats::now();
+}
+
+ProcessStats Stats::sample()
+{
+    ProcessStats stats = {};
+
+    // The CPU time of all threads
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0)
+    {
+        stats.cpuNanoseconds = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    }
+
+    // The time since the daemon started
+    if (startedAt != 0)
+    {
+        stats.uptimeNanoseconds = (uint64_t)(LatencyStats::now() - startedAt);
+    }
+
+    // The thread count and resident set size (fields 20 and 24 of /proc/self/stat)
+    FILE* file = fopen("/proc/self/stat", "r");
+    if (file != NULL)
+    {
+        char line[1024];
+        size_t length = fread(line, 1, sizeof(line) - 1, file);
+        fclose(file);
+        line[length] = 0;
+
+        // Skip the command name (it can contain spaces and parentheses), the fields after it start at the state (field 3)
+        const char* fields = strrchr(line, ')');
+        unsigned long long threads = 0;
+        long long pages = 0;
+        if (fields != NULL && sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %llu %*d %*u %*u %lld", &threads, &pages) == 2)
+        {
+            stats.threads = threads;
+            stats.residentBytes = pages > 0 ? (uint64_t)pages * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+        }
+    }
+    return stats;
+}
+
+GuitarSnapshot Stats::snapshot(const std::string& address, bool streaming, const GuitarCounters& counters)
+{
+    GuitarSnapshot snapshot;
+    snapshot.address = address;
+    snapshot.streaming = streaming;
+    for (int counter = 0; counter < Counter_Count; counter++)
+    {
+        snapshot.counters[counter] = counters.get((GuitarCounterIds)counter);
+    }
+    return snapshot;
+}
+
+// Appends a metric's HELP and TYPE lines
+static void append_header(std::string& out, const char* metric, const char* help, const char* type)
+{
+    out += "# HELP ";
+    out += metric;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += metric;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+// Appends a sample (the label is optional)
+static void append_sample(std::string& out, const char* metric, const char* label, const std::string& labelValue, const char* value)
+{
+    out += metric;
+    if (label != NULL)
+    {
+        out += '{';
+        out += label;
+        out += "=\"";
+        out += labelValue;
+        out += "\"}";
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+// Formats a count
+static const char* format_count(char* buffer, size_t size, uint64_t value)
+{
+    snprintf(buffer, size, "%llu", (unsigned long long)value);
+    return buffer;
+}
+
+// Formats nanoseconds as seconds
+static const char* format_seconds(char* buffer, size_t size, uint64_t nanoseconds)
+{
+    snprintf(buffer, size, "%llu.%09llu", (unsigned long long)(nanoseconds / 1000000000), (unsigned long long)(nanoseconds % 1000000000));
+    return buffer;
+}
+
+std::string Stats::renderPrometheus(const ProcessStats& process, const std::vector<GuitarSnapshot>& guitars)
+{
+    std::string out;
+    out.reserve(1024 + guitars.size() * 1024);
+
+    // The daemon
+    char value[32];
+    size_t streaming = 0;
+    for (const GuitarSnapshot& guitar : guitars)
+    {
+        streaming += guitar.streaming ? 1 : 0;
+    }
+    append_header(out, "ghlble_process_threads", "Threads of the daemon.", "gauge");
+    append_sample(out, "ghlble_process_threads", NULL, "", format_count(value, sizeof(value), process.threads));
+    append_header(out, "ghlble_process_resident_memory_bytes", "Resident set size of the daemon.", "gauge");
+    append_sample(out, "ghlble_process_resident_memory_bytes", NULL, "", format_count(value, sizeof(value), process.residentBytes));
+    append_header(out, "ghlble_process_cpu_seconds_total", "User and system CPU time of the daemon.", "counter");
+    append_sample(out, "ghlble_process_cpu_seconds_total", NULL, "", format_seconds(value, sizeof(value), process.cpuNanoseconds));
+    append_header(out, "ghlble_process_uptime_seconds", "Time since the daemon started.", "gauge");
+    append_sample(out, "ghlble_process_uptime_seconds", NULL, "", format_seconds(value, sizeof(value), process.uptimeNanoseconds));
+    append_header(out, "ghlble_guitars", "Known guitars.", "gauge");
+    append_sample(out, "ghlble_guitars", NULL, "", format_count(value, sizeof(value), guitars.size()));
+    append_header(out, "ghlble_guitars_streaming", "Guitars that are streaming input.", "gauge");
+    append_sample(out, "ghlble_guitars_streaming", NULL, "", format_count(value, sizeof(value), streaming));
+
+    // The guitars (all samples of a metric have to be grouped together)
+    append_header(out, "ghlble_guitar_streaming", "Whether the guitar is streaming input.", "gauge");
+    for (const GuitarSnapshot& guitar : guitars)
+    {
+        append_sample(out, "ghlble_guitar_streaming", "address", guitar.address, guitar.streaming ? "1" : "0");
+    }
+    for (int counter = 0; counter < Counter_Count; counter++)
+    {
+        const CounterExport& metric = g_counter_exports[counter];
+        append_header(out, metric.metric, metric.help, "counter");
+        for (const GuitarSnapshot& guitar : guitars)
+        {
+            uint64_t count = guitar.counters[counter];
+            append_sample(out, metric.metric, "address", guitar.address, metric.seconds ? format_seconds(value, sizeof(value), count) : format_count(value, sizeof(value), count));
+        }
+    }
+    return out;
+}
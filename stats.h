@@ -0,0 +1,94 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// The throughput and health counters of a guitar
+enum GuitarCounterIds
+{
+    Counter_FramesReceived,    // Frames received from the guitar
+    Counter_FramesRepeated,    // Frames identical to the one before them
+    Counter_EventsEmitted,     // Input events handed to the virtual gamepad (excluding SYN reports)
+    Counter_SynReports,        // Reports (SYN_REPORT events) handed to the virtual gamepad
+    Counter_WriteErrors,       // Failed or short writes to the virtual gamepad
+    Counter_Reconnects,        // Streaming sessions that ended and were reconnected
+    Counter_Discoveries,       // Sessions that found the input characteristic
+    Counter_DiscoveryTime,     // The time those sessions took to find it in nanoseconds
+    Counter_WatchdogExpiries,  // Sessions dropped because the guitar went silent
+    Counter_Count
+};
+
+// A set of monotonic counters.
+//
+// Every counter lives on a cache line of its own, so the receive path, the
+// emitter and the event loop can bump theirs without bouncing lines between
+// cores. Counting is a single relaxed atomic add and never allocates, the
+// counters can be read from any thread at any time.
+class GuitarCounters
+{
+public:
+    // Creates zeroed counters
+    GuitarCounters();
+
+    // Adds to a counter
+    inline void add(GuitarCounterIds counter, uint64_t amount = 1)
+    {
+        slots[counter].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Returns the current value of a counter
+    uint64_t get(GuitarCounterIds counter) const;
+
+    // Returns the name of a counter
+    static const char* counterName(GuitarCounterIds counter);
+
+private:
+    // A counter padded to a cache line
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value;
+    };
+
+    // The counters
+    Slot slots[Counter_Count];
+};
+
+// The counters of a guitar at a point in time
+typedef struct GuitarSnapshot {
+    std::string address;               // The MAC address of the guitar
+    bool streaming;                    // Whether the guitar was streaming
+    uint64_t counters[Counter_Count];  // The counter values
+} GuitarSnapshot;
+
+// The daemon's resource usage at a point in time
+typedef struct ProcessStats {
+    uint64_t threads;            // The number of threads
+    uint64_t residentBytes;      // The resident set size in bytes
+    uint64_t cpuNanoseconds;     // The user and system CPU time in nanoseconds
+    uint64_t uptimeNanoseconds;  // The time since the daemon started in nanoseconds
+} ProcessStats;
+
+// Samples the daemon's resource usage and renders metrics in the Prometheus text exposition format
+class Stats {
+public:
+    // Remembers when the daemon started
+    static void start();
+
+    // Samples the daemon's resource usage (fields that can't be read are 0)
+    static ProcessStats sample();
+
+    // Takes a snapshot of a guitar's counters
+    static GuitarSnapshot snapshot(const std::string& address, bool streaming, const GuitarCounters& counters);
+
+    // Renders the daemon-wide and per-guitar metrics (version 0.0.4 of the text format)
+    static std::string renderPrometheus(const ProcessStats& process, const std::vector<GuitarSnapshot>& guitars);
+
+private:
+    // When the daemon started (monotonic nanoseconds)
+    static int64_t startedAt;
+};
+
+#endif // STATS_H
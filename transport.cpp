@@ -0,0 +1,112 @@
+#include "transport.h"
+#include "simtransport.h"
+#include "hidrawtransport.h"
+#include "multitransport.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#ifdef GHLBLE_WITH_BLUEZ
+#include "gattlibtransport.h"
+#endif
+
+#ifdef GHLBLE_WITH_BLUEZ
+// Lists the Bluetooth adapters of the system ("hci0", "hci1", ...)
+static std::vector<std::string> list_adapters()
+{
+    std::vector<std::string> names;
+    DIR* directory = opendir("/sys/class/bluetooth");
+    if (directory == NULL)
+    {
+        return names;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        // Skip the adapters' connections ("hci0:64", ...)
+        if (strncmp(entry->d_name, "hci", 3) == 0 && strchr(entry->d_name, ':') == NULL)
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+#endif
+
+std::unique_ptr<Transport> Transport::create(const std::string& specification)
+{
+    // Several adapters ("sim+sim", "bluez:hci0+bluez:hci1", ...)
+    if (specification.find('+') != std::string::npos)
+    {
+        std::vector<std::unique_ptr<Transport>> adapters;
+        std::stringstream stream(specification);
+        std::string part;
+        while (std::getline(stream, part, '+'))
+        {
+            std::unique_ptr<Transport> adapter = create(part);
+            if (!adapter)
+            {
+                return NULL;
+            }
+            adapters.push_back(std::move(adapter));
+        }
+        return std::make_unique<MultiTransport>(std::move(adapters));
+    }
+
+    // Split the backend name from its options
+    size_t separator = specification.find(':');
+    std::string backend = specification.substr(0, separator);
+    std::string options = separator == std::string::npos ? "" : specification.substr(separator + 1);
+
+#ifdef GHLBLE_WITH_BLUEZ
+    // A real Bluetooth adapter
+    if (backend == "bluez" && options != "all")
+    {
+        return std::make_unique<GattlibTransport>(options);
+    }
+
+    // All of them (a single one doesn't need balancing)
+    if (backend == "bluez")
+    {
+        std::vector<std::string> names = list_adapters();
+        if (names.size() < 2)
+        {
+            return std::make_unique<GattlibTransport>(names.empty() ? "" : names[0]);
+        }
+        std::vector<std::unique_ptr<Transport>> adapters;
+        for (const std::string& name : names)
+        {
+            adapters.push_back(std::make_unique<GattlibTransport>(name));
+        }
+        return std::make_unique<MultiTransport>(std::move(adapters));
+    }
+#endif
+
+    // Simulated guitars
+    if (backend == "sim")
+    {
+        std::unique_ptr<SimTransport> transport = std::make_unique<SimTransport>();
+        if (transport->configure(options))
+        {
+            return transport;
+        }
+    }
+
+    // USB dongles
+    if (backend == "hidraw")
+    {
+        std::unique_ptr<HidrawTransport> transport = std::make_unique<HidrawTransport>();
+        if (transport->configure(options))
+        {
+            return transport;
+        }
+    }
+
+    // We don't know that backend (or it wasn't built)
+    return NULL;
+}
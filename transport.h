@@ -0,0 +1,95 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+// The UUID of the characteristic guitars report their input data on
+#define TRANSPORT_INPUT_CHARACTERISTIC "533e1524-3abe-f33f-cd00-594e8b0a8ea3"
+
+// The name guitars advertise under (backends without advertisements report their guitars under it too)
+#define TRANSPORT_GUITAR_NAME "Ble Guitar"
+
+// A backend specific connection to a guitar
+class TransportLink
+{
+public:
+    virtual ~TransportLink() {}
+};
+
+// A GATT characteristic in a backend independent form
+typedef struct TransportCharacteristic {
+    uint16_t handle;       // The declaration handle
+    uint16_t valueHandle;  // The value handle
+    uint8_t uuidType;      // The UUID type (backend specific)
+    uint8_t uuid[16];      // The UUID value (backend specific)
+} TransportCharacteristic;
+
+// Discovers guitars, connects to them and streams their input data.
+//
+// Callbacks run on backend threads. Links stay valid until they're passed to
+// release(), even after they've been disconnected or lost, so every link
+// handed out by connect() must be released exactly once (and not be used by
+// any other thread while that happens).
+class Transport
+{
+public:
+    // Receives the address and name of an advertising device
+    typedef std::function<void(const std::string& address, const std::string& name)> DiscoveryHandler;
+
+    // Receives the result of a connection attempt (NULL if it failed)
+    typedef std::function<void(TransportLink* link)> ConnectHandler;
+
+    // Receives a notification
+    typedef std::function<void(const uint8_t* data, size_t length)> NotificationHandler;
+
+    // Gets called when a subscribed link is lost
+    typedef std::function<void()> DisconnectHandler;
+
+    // Destructor
+    virtual ~Transport() {}
+
+    // Creates a transport from a specification ("bluez[:hciN|all]", "sim[:option=value,...]" or "hidraw[:option=value,...]", several joined by '+' to spread guitars over them), returns NULL if it's unknown
+    static std::unique_ptr<Transport> create(const std::string& specification);
+
+    // Returns the name of the backend
+    virtual const char* getName() const = 0;
+
+    // Opens the adapter
+    virtual bool open() = 0;
+
+    // Closes the adapter
+    virtual void close() = 0;
+
+    // Reports advertising devices until stopScan() is called
+    virtual bool scan(DiscoveryHandler handler) = 0;
+
+    // Stops a running scan
+    virtual void stopScan() = 0;
+
+    // Starts connecting to a device, returns false if the attempt couldn't be started (the handler won't be called then)
+    virtual bool connect(const std::string& address, ConnectHandler handler) = 0;
+
+    // Disconnects a link (this makes blocked reads fail, but the link stays valid)
+    virtual void disconnect(TransportLink* link) = 0;
+
+    // Stops a link's notifications and frees it (disconnecting it first if needed)
+    virtual void release(TransportLink* link) = 0;
+
+    // Finds the characteristic guitars report their input data on
+    virtual bool discover(TransportLink* link, TransportCharacteristic* characteristic) = 0;
+
+    // Reads a characteristic, returns false unless exactly size bytes were read
+    virtual bool read(TransportLink* link, const TransportCharacteristic& characteristic, void* buffer, size_t size) = 0;
+
+    // Subscribes to a characteristic's notifications and the loss of the link
+    virtual bool subscribe(TransportLink* link, const TransportCharacteristic& characteristic, NotificationHandler notification, DisconnectHandler lost) = 0;
+
+    // Unsubscribes from a characteristic's notifications (fails harmlessly if the link is already gone)
+    virtual void unsubscribe(TransportLink* link, const TransportCharacteristic& characteristic) = 0;
+};
+
+#endif // TRANSPORT_H